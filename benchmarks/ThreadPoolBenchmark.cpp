@@ -0,0 +1,182 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "knots/ThreadPool.hpp"
+
+/*
+    Compares the work-stealing ThreadPool against the single mutex + condition variable
+    pool it replaced, at 1 to 128 threads
+
+    Two workloads:
+    - external: one thread enqueues every job, like `HttpServer::AcceptConnections`
+    - nested:   a few jobs each fan out many small jobs from inside the pool
+
+    Build with the `benchmark-release` preset and run `./build/benchmark-release/knots-benchmark`
+*/
+
+/*
+    The previous ThreadPool, kept here only as a baseline
+*/
+class LegacyThreadPool {
+private:
+    std::atomic<bool> m_isRunning = false;
+    std::queue<std::function<void()>> m_jobs;
+    std::vector<std::jthread> m_threads;
+    std::condition_variable m_mutexCondition;
+    std::mutex m_jobsMutex;
+
+    void ThreadLoop() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(m_jobsMutex);
+
+                m_mutexCondition.wait(lock, [this] {
+                    return m_jobs.empty() == false || m_isRunning == false;
+                });
+
+                if (m_isRunning == false) {
+                    return;
+                }
+
+                job = m_jobs.front();
+                m_jobs.pop();
+            }
+
+            job();
+        }
+    }
+
+public:
+    void InitializeThreadPool(const int threadCount) {
+        m_isRunning = true;
+        for (int i = 0; i < threadCount; i++) {
+            m_threads.emplace_back(&LegacyThreadPool::ThreadLoop, this);
+        }
+    }
+
+    bool EnqueueJob(const std::function<void()>& job) {
+        {
+            std::scoped_lock<std::mutex> lock(m_jobsMutex);
+            m_jobs.push(job);
+        }
+
+        m_mutexCondition.notify_one();
+        return true;
+    }
+
+    void Stop() {
+        m_isRunning = false;
+        m_mutexCondition.notify_all();
+        m_threads.clear();
+    }
+};
+
+constexpr int externalJobCount = 200000;
+constexpr int nestedParentCount = 64;
+constexpr int nestedChildCount = 4000;
+
+/*
+    Stand-in for a small request handler
+*/
+void DoWork(std::atomic<int>& done) {
+    volatile int sink = 0;
+    for (int i = 0; i < 64; i++) {
+        sink = sink + i;
+    }
+
+    done.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*
+    Enqueue from outside the pool, waiting for space if it is full
+*/
+template <typename Pool>
+void Enqueue(Pool& pool, const std::function<void()>& job) {
+    while (pool.EnqueueJob(job) == false) {
+        std::this_thread::yield();
+    }
+}
+
+/*
+    Enqueue from inside a job, running it right here if the pool is full
+    Waiting for space instead could deadlock, the worker waiting is one that would make space
+*/
+template <typename Pool>
+void EnqueueOrRun(Pool& pool, const std::function<void()>& job) {
+    if (pool.EnqueueJob(job) == false) {
+        job();
+    }
+}
+
+void WaitUntil(const std::atomic<int>& done, const int target) {
+    while (done.load(std::memory_order_relaxed) < target) {
+        std::this_thread::yield();
+    }
+}
+
+/*
+    @brief Run one workload on a fresh pool
+    @return Jobs completed per second
+*/
+template <typename Pool>
+double Run(const int threadCount, const bool isNested) {
+
+    Pool pool;
+    pool.InitializeThreadPool({threadCount});
+
+    std::atomic<int> done = 0;
+    const int target = isNested ? nestedParentCount * nestedChildCount : externalJobCount;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    if (isNested) {
+        for (int i = 0; i < nestedParentCount; i++) {
+            Enqueue(pool, [&pool, &done] () {
+                for (int j = 0; j < nestedChildCount; j++) {
+                    EnqueueOrRun(pool, [&done] () { DoWork(done); });
+                }
+            });
+        }
+    }
+    else {
+        for (int i = 0; i < externalJobCount; i++) {
+            Enqueue(pool, [&done] () { DoWork(done); });
+        }
+    }
+
+    WaitUntil(done, target);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    pool.Stop();
+    return target / elapsed.count();
+}
+
+int main() {
+
+    std::cout << std::format(
+        "{:>8} | {:>16} {:>16} | {:>16} {:>16}\n",
+        "threads", "legacy external", "stealing external", "legacy nested", "stealing nested"
+    );
+
+    for (int threadCount = 1; threadCount <= 128; threadCount *= 2) {
+        std::cout << std::format(
+            "{:>8} | {:>16.0f} {:>16.0f} | {:>16.0f} {:>16.0f}\n",
+            threadCount,
+            Run<LegacyThreadPool>(threadCount, false),
+            Run<ThreadPool>(threadCount, false),
+            Run<LegacyThreadPool>(threadCount, true),
+            Run<ThreadPool>(threadCount, true)
+        );
+    }
+
+    return 0;
+}
@@ -10,7 +10,8 @@ int main(void) {
         .maxConnections = 125,
         .inputPollingIntevalMs = 100,
         .requestLoggingVerbosity = RequestLoggingVerbosity::FULL,
-        .timeZone = "Asia/Kolkata"
+        .timeZone = "Asia/Kolkata",
+        .minThreads = 4
     };
 
     Router router;
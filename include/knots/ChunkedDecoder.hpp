@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <string>
+#include <string_view>
+
+#include "knots/HttpMessage.hpp"
+
+/*
+    Incremental decoder for a body sent with `Transfer-Encoding: chunked`
+
+    Bytes are fed in as they arrive, in pieces of any size, and nothing is ever scanned twice:
+    the decoder keeps its place in the chunk framing between calls. Chunk data is appended to
+    the body, chunk extensions are skipped, and the trailer fields after the last chunk are
+    collected separately
+
+    Limits on the decoded body and on the chunk size lines and trailers keep a client from
+    making the decoder buffer without bound
+*/
+class ChunkedDecoder {
+public:
+    enum class Status {
+        INCOMPLETE,
+        COMPLETE,
+        MALFORMED,
+        BODY_TOO_LARGE,
+        TRAILERS_TOO_LARGE
+    };
+
+    // Longest chunk size line, extensions included
+    static constexpr size_t maxSizeLineLength = 1024;
+
+private:
+    enum class State {
+        SIZE,
+        EXTENSION,
+        SIZE_LF,
+        DATA,
+        DATA_CR,
+        DATA_LF,
+        TRAILER
+    };
+
+    const size_t m_maxBodySize;
+    const size_t m_maxTrailerSize;
+
+    State m_state;
+    Status m_status;
+
+    size_t m_chunkSize;
+    size_t m_lineLength;
+    size_t m_trailerSize;
+    std::string m_line;
+
+    // Counts everything decoded, `m_body` only what hasn't been taken yet
+    size_t m_bodySize;
+    std::string m_body;
+    Headers m_trailers;
+
+    void ParseSize(const char c);
+    void ParseTrailer(const char c);
+
+public:
+    /*
+        @param maxBodySize Largest decoded body accepted
+        @param maxTrailerSize Largest trailer section accepted, in bytes
+    */
+    explicit ChunkedDecoder(
+        const size_t maxBodySize = std::numeric_limits<size_t>::max(),
+        const size_t maxTrailerSize = std::numeric_limits<size_t>::max()
+    );
+
+    /*
+        @brief Decode the next piece of the body
+        @param input Bytes following the ones fed before
+
+        @return How many bytes of `input` belong to the body, all of them unless it completed
+        or failed within `input`. Anything after the body is left alone, ex: a pipelined request
+    */
+    size_t Feed(const std::string_view input);
+
+    Status GetStatus() const;
+
+    /*
+        @brief Whether a `Transfer-Encoding` value is just "chunked", the only coding understood
+        @param transferEncoding The header's value
+    */
+    static bool IsChunked(const std::string_view transferEncoding);
+
+    /*
+        @brief The body decoded so far, moved out with `TakeBody()` once complete
+        Taking it between feeds hands the body out piece by piece, ex: to stream it
+    */
+    const std::string& Body() const;
+    std::string TakeBody();
+
+    /*
+        @brief Fields sent after the last chunk, complete once the status is `COMPLETE`
+    */
+    const Headers& Trailers() const;
+};
@@ -0,0 +1,450 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "knots/HttpMessage.hpp"
+
+/*
+    Route table that is declared, validated and laid out at compile time
+
+    For services whose routes are all known up front. Patterns are parsed and checked for
+    conflicts by the compiler, and each handler is called directly by its own type instead of
+    through a `std::function`, so it can be inlined into the dispatch code
+
+    Example:
+        constexpr auto health = [] (const HttpRequest& req, HttpResponse& res) { ... };
+        constexpr auto user   = [] (const HttpRequest& req, HttpResponse& res) { ... };
+
+        using Routes = CompiledRoutes::Table<
+            CompiledRoutes::Get<"/health">(health),
+            CompiledRoutes::Get<"/users/{id}">(user)
+        >;
+
+        Routes::Dispatch(req, res);      // Use directly, or
+        router.UseCompiledRoutes<Routes>(); // let the Router try them first
+
+    Patterns follow the same rules as `Router`: static segments, `{name}` segments that match a
+    single segment, and a `{*name}` wildcard as the last segment. Static beats dynamic, which
+    beats wildcard, no matter the order the routes are declared in
+
+    Handlers need to be usable as template arguments, so they have to be captureless lambdas
+    Wrap free functions in one, ex: `[] (const HttpRequest& req, HttpResponse& res) { F(req, res); }`
+*/
+namespace CompiledRoutes {
+
+    enum class MatchResult {
+        HANDLED,
+        METHOD_NOT_ALLOWED,
+        NOT_FOUND
+    };
+
+    /*
+        String literal wrapper that can be passed as a template argument
+    */
+    template <size_t N>
+    struct FixedString {
+        char value[N];
+
+        constexpr FixedString(const char (&str)[N]) {
+            std::copy_n(str, N, value);
+        }
+
+        constexpr std::string_view View() const {
+            return std::string_view(value, N - 1);
+        }
+    };
+
+    /*
+        @brief Get the `index`th segment of `url`, ex: ("/users/100", 1) -> "100"
+        @return The segment, or an empty view if `url` has fewer segments
+    */
+    constexpr std::string_view GetSegment(std::string_view url, size_t index) {
+        size_t start = 1;
+        for (size_t i = 0; i < index; i++) {
+            const size_t slash = url.find('/', start);
+            if (slash == std::string_view::npos) {
+                return {};
+            }
+            start = slash + 1;
+        }
+
+        if (start > url.size()) {
+            return {};
+        }
+
+        const size_t end = url.find('/', start);
+        return url.substr(start, end == std::string_view::npos ? url.size() - start : end - start);
+    }
+
+    /*
+        @brief Number of segments in `url`, "/" has none, "/users/100" has two
+    */
+    constexpr size_t CountSegments(std::string_view url) {
+        if (url.size() <= 1) {
+            return 0;
+        }
+
+        return static_cast<size_t>(std::count(url.begin(), url.end(), '/'));
+    }
+
+    constexpr bool IsWildcardSegment(std::string_view segment) {
+        return segment.size() > 3 && segment.starts_with("{*") && segment.ends_with('}');
+    }
+
+    constexpr bool IsDynamicSegment(std::string_view segment) {
+        return segment.size() > 2 && segment.front() == '{' && segment.back() == '}'
+            && IsWildcardSegment(segment) == false;
+    }
+
+    /*
+        @brief Check that `pattern` is a route URL the table can match
+        Starts with '/', has no empty segments or trailing '/', braces only around whole
+        segments, and a wildcard only as the last segment
+    */
+    constexpr bool IsValidPattern(std::string_view pattern) {
+        if (pattern.empty() || pattern.front() != '/') {
+            return false;
+        }
+        if (pattern == "/") {
+            return true;
+        }
+        if (pattern.back() == '/') {
+            return false;
+        }
+
+        const size_t numSegments = CountSegments(pattern);
+        for (size_t i = 0; i < numSegments; i++) {
+            const std::string_view segment = GetSegment(pattern, i);
+            if (segment.empty()) {
+                return false;
+            }
+
+            const bool hasBraces = segment.find_first_of("{}") != std::string_view::npos;
+            if (hasBraces && IsDynamicSegment(segment) == false && IsWildcardSegment(segment) == false) {
+                return false;
+            }
+            if (IsWildcardSegment(segment) && i + 1 != numSegments) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /*
+        @brief Rank a segment kind for match priority, lower wins
+    */
+    constexpr int SegmentRank(std::string_view segment) {
+        if (IsWildcardSegment(segment)) {
+            return 2;
+        }
+        if (IsDynamicSegment(segment)) {
+            return 1;
+        }
+        return 0;
+    }
+
+    /*
+        @brief Whether `left` should be tried before `right`
+        Compares segment by segment, the first position where one is more specific decides
+    */
+    constexpr bool IsMoreSpecific(std::string_view left, std::string_view right) {
+        const size_t numSegments = std::max(CountSegments(left), CountSegments(right));
+
+        for (size_t i = 0; i < numSegments; i++) {
+            const int leftRank = SegmentRank(GetSegment(left, i));
+            const int rightRank = SegmentRank(GetSegment(right, i));
+            if (leftRank != rightRank) {
+                return leftRank < rightRank;
+            }
+        }
+
+        return false;
+    }
+
+    /*
+        @brief Whether two patterns would match exactly the same URLs
+        This is what makes two routes with the same method ambiguous; a static and a dynamic
+        segment in the same place are not a conflict, the static one simply wins
+    */
+    constexpr bool IsSameShape(std::string_view left, std::string_view right) {
+        const size_t numSegments = CountSegments(left);
+        if (numSegments != CountSegments(right)) {
+            return false;
+        }
+
+        for (size_t i = 0; i < numSegments; i++) {
+            const std::string_view leftSegment = GetSegment(left, i);
+            const std::string_view rightSegment = GetSegment(right, i);
+
+            if (SegmentRank(leftSegment) != SegmentRank(rightSegment)) {
+                return false;
+            }
+            if (SegmentRank(leftSegment) == 0 && leftSegment != rightSegment) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /*
+        @brief Match `url` against `pattern`
+        @param pattern Route pattern, known at compile time at every call site
+        @param url Request URL without the query string or trailing '/'
+
+        @return `true` if it matches
+    */
+    constexpr bool MatchPattern(std::string_view pattern, std::string_view url) {
+        size_t patternPos = 0;
+        size_t urlPos = 0;
+
+        while (patternPos < pattern.size()) {
+            // Both are at a '/' here
+            if (urlPos >= url.size() || url[urlPos] != '/') {
+                // A wildcard also matches an empty remainder, ex: "/files/{*path}" for "/files"
+                return IsWildcardSegment(pattern.substr(patternPos + 1)) && urlPos == url.size();
+            }
+
+            const size_t patternEnd = std::min(pattern.find('/', patternPos + 1), pattern.size());
+            const size_t urlEnd = std::min(url.find('/', urlPos + 1), url.size());
+
+            const std::string_view patternSegment = pattern.substr(patternPos + 1, patternEnd - patternPos - 1);
+            const std::string_view urlSegment = url.substr(urlPos + 1, urlEnd - urlPos - 1);
+
+            if (IsWildcardSegment(patternSegment)) {
+                return true;
+            }
+            if (IsDynamicSegment(patternSegment)) {
+                if (urlSegment.empty()) {
+                    return false;
+                }
+            }
+            else if (patternSegment != urlSegment) {
+                return false;
+            }
+
+            patternPos = patternEnd;
+            urlPos = urlEnd;
+        }
+
+        return urlPos == url.size();
+    }
+
+    /*
+        @brief Copy the route parameters of a matched URL into `req.routeParams`
+        @param pattern Route pattern that `url` matched
+        @param url Request URL
+        @param req Request to fill
+    */
+    inline void ExtractRouteParams(std::string_view pattern, std::string_view url, HttpRequest& req) {
+        const size_t numSegments = CountSegments(pattern);
+
+        size_t urlPos = 0;
+        for (size_t i = 0; i < numSegments; i++) {
+            const std::string_view patternSegment = GetSegment(pattern, i);
+
+            const size_t urlStart = std::min(urlPos + 1, url.size());
+            const size_t urlEnd = std::min(url.find('/', urlStart), url.size());
+
+            if (IsWildcardSegment(patternSegment)) {
+                req.routeParams.insert(std::make_pair(
+                    std::string(patternSegment.substr(2, patternSegment.size() - 3)),
+                    std::string(url.substr(urlStart))
+                ));
+                return;
+            }
+
+            if (IsDynamicSegment(patternSegment)) {
+                req.routeParams.insert(std::make_pair(
+                    std::string(patternSegment.substr(1, patternSegment.size() - 2)),
+                    std::string(url.substr(urlStart, urlEnd - urlStart))
+                ));
+            }
+
+            urlPos = urlEnd;
+        }
+
+        return;
+    }
+
+
+    template <HttpMethod Method, FixedString Pattern, typename Handler>
+    struct Route {
+        Handler handler;
+
+        static constexpr HttpMethod method = Method;
+        static constexpr std::string_view pattern = Pattern.View();
+    };
+
+    template <HttpMethod Method, FixedString Pattern, typename Handler>
+    constexpr Route<Method, Pattern, Handler> MakeRoute(Handler handler) {
+        static_assert(IsValidPattern(Pattern.View()), "CompiledRoutes: Invalid route pattern");
+        static_assert(
+            std::is_invocable_v<const Handler&, const HttpRequest&, HttpResponse&>,
+            "CompiledRoutes: Handlers must be callable as (const HttpRequest&, HttpResponse&)"
+        );
+
+        return Route<Method, Pattern, Handler>{handler};
+    }
+
+    // Individual functions for request types, ex: `CompiledRoutes::Get<"/users/{id}">(handler)`
+    template <FixedString Pattern, typename Handler>
+    constexpr auto Get(Handler handler) { return MakeRoute<HttpMethod::GET, Pattern>(handler); }
+
+    template <FixedString Pattern, typename Handler>
+    constexpr auto Head(Handler handler) { return MakeRoute<HttpMethod::HEAD, Pattern>(handler); }
+
+    template <FixedString Pattern, typename Handler>
+    constexpr auto Post(Handler handler) { return MakeRoute<HttpMethod::POST, Pattern>(handler); }
+
+    template <FixedString Pattern, typename Handler>
+    constexpr auto Put(Handler handler) { return MakeRoute<HttpMethod::PUT, Pattern>(handler); }
+
+    template <FixedString Pattern, typename Handler>
+    constexpr auto Delete(Handler handler) { return MakeRoute<HttpMethod::DELETE, Pattern>(handler); }
+
+    template <FixedString Pattern, typename Handler>
+    constexpr auto Connect(Handler handler) { return MakeRoute<HttpMethod::CONNECT, Pattern>(handler); }
+
+    template <FixedString Pattern, typename Handler>
+    constexpr auto Options(Handler handler) { return MakeRoute<HttpMethod::OPTIONS, Pattern>(handler); }
+
+    template <FixedString Pattern, typename Handler>
+    constexpr auto Trace(Handler handler) { return MakeRoute<HttpMethod::TRACE, Pattern>(handler); }
+
+    template <FixedString Pattern, typename Handler>
+    constexpr auto Patch(Handler handler) { return MakeRoute<HttpMethod::PATCH, Pattern>(handler); }
+
+
+    /*
+        @brief Whether any two routes with the same method match exactly the same URLs
+    */
+    template <size_t N>
+    constexpr bool HasConflicts(
+        const std::array<HttpMethod, N>& methods,
+        const std::array<std::string_view, N>& patterns
+    ) {
+        for (size_t i = 0; i < N; i++) {
+            for (size_t j = i + 1; j < N; j++) {
+                if (methods[i] == methods[j] && IsSameShape(patterns[i], patterns[j])) {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+
+    /*
+        @brief Order in which to try the patterns, most specific first
+        @return Indices into `patterns`; patterns that are equally specific keep their order
+    */
+    template <size_t N>
+    constexpr std::array<size_t, N> SpecificityOrder(const std::array<std::string_view, N>& patterns) {
+        std::array<size_t, N> order{};
+        for (size_t i = 0; i < N; i++) {
+            order[i] = i;
+        }
+
+        // Insertion sort, stable and usable at compile time
+        for (size_t i = 1; i < N; i++) {
+            const size_t current = order[i];
+            size_t j = i;
+            while (j > 0 && IsMoreSpecific(patterns[current], patterns[order[j - 1]])) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = current;
+        }
+
+        return order;
+    }
+
+
+    template <auto... routes>
+    class Table {
+    private:
+        static constexpr size_t m_numRoutes = sizeof...(routes);
+
+        static constexpr std::tuple<decltype(routes)...> m_routes{routes...};
+
+        static constexpr std::array<std::string_view, m_numRoutes> m_patterns{
+            decltype(routes)::pattern...
+        };
+        static constexpr std::array<HttpMethod, m_numRoutes> m_methods{
+            decltype(routes)::method...
+        };
+
+        static_assert(
+            HasConflicts(m_methods, m_patterns) == false,
+            "CompiledRoutes::Table: Two routes with the same method match the same URLs"
+        );
+
+        // Order in which routes are tried, most specific first
+        static constexpr std::array<size_t, m_numRoutes> m_order = SpecificityOrder(m_patterns);
+
+        template <size_t Index>
+        static bool TryRoute(HttpRequest& req, HttpResponse& res, std::string_view url, uint16_t& methodMask) {
+            constexpr size_t routeIndex = m_order[Index];
+            constexpr const auto& route = std::get<routeIndex>(m_routes);
+
+            if (MatchPattern(route.pattern, url) == false) {
+                return false;
+            }
+
+            // Same bit as `SegmentHandlerFunctions::MethodBit()`
+            methodMask |= static_cast<uint16_t>(1u << static_cast<int>(route.method));
+            if (req.method != route.method) {
+                return false;
+            }
+
+            ExtractRouteParams(route.pattern, url, req);
+            route.handler(req, res);
+
+            return true;
+        }
+
+    public:
+        /*
+            @brief Find the route for `req` and run its handler
+            @param req Request, route parameters are added to it on a match
+            @param res Response for the handler to fill
+            @param methodMask If not null, gets bit `1 << method` set for every route whose URL
+            matched, complete whenever the result is `METHOD_NOT_ALLOWED`
+
+            @return Whether the request was handled, or why not
+        */
+        static MatchResult Dispatch(HttpRequest& req, HttpResponse& res, uint16_t* methodMask = nullptr) {
+
+            // Same treatment of trailing '/'s as the Router: "/users/" is "/users"
+            std::string_view url = req.requestUrl;
+            while (url.size() > 1 && url.back() == '/') {
+                url.remove_suffix(1);
+            }
+
+            uint16_t matchedMask = 0;
+            const bool handled = [&] <size_t... Indices> (std::index_sequence<Indices...>) {
+                return (TryRoute<Indices>(req, res, url, matchedMask) || ...);
+            } (std::make_index_sequence<m_numRoutes>{});
+
+            if (methodMask != nullptr) {
+                *methodMask |= matchedMask;
+            }
+
+            if (handled) {
+                return MatchResult::HANDLED;
+            }
+
+            return matchedMask != 0 ? MatchResult::METHOD_NOT_ALLOWED : MatchResult::NOT_FOUND;
+        }
+    };
+}
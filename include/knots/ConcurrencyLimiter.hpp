@@ -0,0 +1,139 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+
+/*
+    Limits how many requests may run their handlers at the same time
+
+    With a latency target, the limit adapts to the measured handler latency (AIMD):
+    - Every request that finishes within the target, while the limit was actually in use, raises
+      the limit by `1 / limit`, so about one more slot per "round" of requests
+    - A request that takes longer than the target cuts the limit by `decreaseFactor`, at most once
+      per round: only requests that started after the last cut can cut it again
+    The limit stays between `minLimit` and `maxLimit`. Without a latency target it stays fixed
+    at `maxLimit`
+
+    A request that finds every slot taken may wait up to `maxWait` for one to free up, as long
+    as no more than `maxWaiting` requests are already waiting
+*/
+class ConcurrencyLimiter {
+public:
+    static constexpr double decreaseFactor = 0.9;
+
+    using Clock = std::chrono::steady_clock;
+
+    /*
+        A slot held by a running request, handed back when the permit is released or destroyed
+        An empty permit, from a failed `Acquire()`, holds nothing
+    */
+    class Permit {
+    private:
+        ConcurrencyLimiter* m_limiter;
+        Clock::time_point m_startTime;
+
+        friend class ConcurrencyLimiter;
+        Permit(ConcurrencyLimiter* limiter, const Clock::time_point startTime) :
+            m_limiter(limiter),
+            m_startTime(startTime)
+        {}
+
+    public:
+        Permit() :
+            m_limiter(nullptr),
+            m_startTime{}
+        {}
+
+        Permit(const Permit&) = delete;
+        Permit& operator=(const Permit&) = delete;
+
+        Permit(Permit&& other) noexcept :
+            m_limiter(other.m_limiter),
+            m_startTime(other.m_startTime) {
+            other.m_limiter = nullptr;
+        }
+
+        Permit& operator=(Permit&& other) noexcept {
+            if (this != &other) {
+                Release();
+                m_limiter = other.m_limiter;
+                m_startTime = other.m_startTime;
+                other.m_limiter = nullptr;
+            }
+
+            return *this;
+        }
+
+        ~Permit() {
+            Release();
+        }
+
+        bool IsHeld() const {
+            return m_limiter != nullptr;
+        }
+
+        /*
+            @brief Hand the slot back, recording how long it was held
+        */
+        void Release() {
+            if (m_limiter != nullptr) {
+                m_limiter->Release(m_startTime, Clock::now());
+                m_limiter = nullptr;
+            }
+        }
+    };
+
+private:
+    const int m_minLimit;
+    const int m_maxLimit;
+    const Clock::duration m_latencyTarget;
+    const int m_maxWaiting;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_slotFreed;
+
+    double m_limit;
+    int m_inFlight;
+    int m_waiting;
+    Clock::time_point m_lastDecreaseTime;
+    uint64_t m_rejected;
+
+    void Release(const Clock::time_point startTime, const Clock::time_point endTime);
+
+public:
+    /*
+        @param minLimit Lowest the limit may go, at least 1
+        @param maxLimit Highest the limit may go, and where it starts
+        @param latencyTarget Handler latency to aim for, zero keeps the limit fixed at `maxLimit`
+        @param maxWaiting How many requests may wait for a slot at once, the rest are turned away
+    */
+    ConcurrencyLimiter(
+        const int minLimit,
+        const int maxLimit,
+        const Clock::duration latencyTarget,
+        const int maxWaiting = std::numeric_limits<int>::max()
+    );
+
+    ConcurrencyLimiter(const ConcurrencyLimiter&) = delete;
+    ConcurrencyLimiter& operator=(const ConcurrencyLimiter&) = delete;
+
+    /*
+        @brief Take a slot, waiting up to `maxWait` for one if all are taken
+        @param maxWait How long to wait, zero to not wait at all
+
+        @return A permit holding the slot, or an empty permit if none freed up in time, or
+        too many requests were waiting already
+    */
+    Permit Acquire(const Clock::duration maxWait);
+
+    int Limit() const;
+    int InFlight() const;
+
+    /*
+        @brief Number of requests turned away because no slot freed up in time
+    */
+    uint64_t RejectedCount() const;
+};
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+/*
+    Queues used by the ThreadPool to hand jobs between threads without a lock
+
+    Both have a fixed capacity chosen at construction, and report a full queue instead of
+    growing, so the caller decides what to do with the extra work
+*/
+
+/*
+    Round `value` up to the next power of two, so ring indices can be masked instead of divided
+*/
+constexpr size_t NextPowerOfTwo(const size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+
+    return result;
+}
+
+
+/*
+    Chase-Lev work-stealing deque
+
+    The owning thread pushes and pops at the bottom (LIFO, so it works on whatever is hot in
+    its cache), other threads steal from the top (FIFO, so they take the oldest work)
+
+    Jobs aren't trivially copyable, so a thief can't copy a slot and only then try to claim it
+    like the original algorithm does. Instead a thief claims the slot first by advancing `top`,
+    and then moves the job out. Each slot carries an `isFull` flag that stays set until the
+    job has been moved out, and the owner won't push into a slot that is still full
+
+    Reference: "Dynamic Circular Work-Stealing Deque", Chase & Lev, SPAA 2005
+*/
+template <typename T>
+class WorkStealingDeque {
+private:
+    struct Slot {
+        std::atomic<bool> isFull{false};
+        T value{};
+    };
+
+    const size_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+
+    // Kept on separate cache lines, thieves hammer `m_top` while the owner works on `m_bottom`
+    alignas(64) std::atomic<int64_t> m_top;
+    alignas(64) std::atomic<int64_t> m_bottom;
+
+public:
+    explicit WorkStealingDeque(const size_t capacity) :
+        m_mask(NextPowerOfTwo(capacity) - 1),
+        m_slots(std::make_unique<Slot[]>(m_mask + 1)),
+        m_top(0),
+        m_bottom(0)
+    {}
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    /*
+        @brief Push a value at the bottom, only the owning thread may call this
+        @param value Value to push, left untouched if the deque is full
+
+        @return `true` if pushed, `false` if the deque is full
+    */
+    bool Push(T& value) {
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        const int64_t top = m_top.load(std::memory_order_acquire);
+
+        if (bottom - top > static_cast<int64_t>(m_mask)) {
+            return false;
+        }
+
+        // A thief may have claimed this slot, but not finished moving out of it yet
+        Slot& slot = m_slots[bottom & m_mask];
+        if (slot.isFull.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        slot.value = std::move(value);
+        slot.isFull.store(true, std::memory_order_relaxed);
+        m_bottom.store(bottom + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /*
+        @brief Pop the most recently pushed value, only the owning thread may call this
+        @return The value, or `std::nullopt` if the deque is empty or a thief took the last one
+    */
+    std::optional<T> Pop() {
+        const int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = m_top.load(std::memory_order_relaxed);
+
+        if (top > bottom) {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+
+        // Last value, race the thieves for it
+        if (top == bottom) {
+            const bool won = m_top.compare_exchange_strong(
+                top, top + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed
+            );
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+
+            if (won == false) {
+                return std::nullopt;
+            }
+        }
+
+        return TakeFrom(m_slots[bottom & m_mask]);
+    }
+
+    /*
+        @brief Steal the oldest value, any thread may call this
+        @return The value, or `std::nullopt` if the deque is empty or another thread got there first
+    */
+    std::optional<T> Steal() {
+        int64_t top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = m_bottom.load(std::memory_order_acquire);
+
+        if (top >= bottom) {
+            return std::nullopt;
+        }
+
+        if (m_top.compare_exchange_strong(
+            top, top + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed
+        ) == false) {
+            return std::nullopt;
+        }
+
+        return TakeFrom(m_slots[top & m_mask]);
+    }
+
+    /*
+        @brief Approximate number of values in the deque
+    */
+    size_t Size() const {
+        const int64_t size = m_bottom.load(std::memory_order_relaxed) - m_top.load(std::memory_order_relaxed);
+        return size > 0 ? static_cast<size_t>(size) : 0;
+    }
+
+private:
+    static T TakeFrom(Slot& slot) {
+        T value = std::move(slot.value);
+        slot.value = T{};
+        slot.isFull.store(false, std::memory_order_release);
+
+        return value;
+    }
+};
+
+
+/*
+    Bounded multi-producer multi-consumer FIFO queue
+
+    Every slot has a sequence number that says whose turn it is: a producer may fill slot `i`
+    once its sequence is `i`, a consumer may empty it once its sequence is `i + 1`. Producers
+    and consumers only contend on their own position counter
+    That scheme needs at least two slots, smaller capacities are rounded up to two
+
+    Reference: Dmitry Vyukov's bounded MPMC queue
+*/
+template <typename T>
+class BoundedMpmcQueue {
+private:
+    struct Slot {
+        std::atomic<size_t> sequence{0};
+        T value{};
+    };
+
+    const size_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+
+    alignas(64) std::atomic<size_t> m_enqueuePosition;
+    alignas(64) std::atomic<size_t> m_dequeuePosition;
+
+public:
+    explicit BoundedMpmcQueue(const size_t capacity) :
+        m_mask(NextPowerOfTwo(capacity < 2 ? 2 : capacity) - 1),
+        m_slots(std::make_unique<Slot[]>(m_mask + 1)),
+        m_enqueuePosition(0),
+        m_dequeuePosition(0) {
+
+        for (size_t i = 0; i <= m_mask; i++) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedMpmcQueue(const BoundedMpmcQueue&) = delete;
+    BoundedMpmcQueue& operator=(const BoundedMpmcQueue&) = delete;
+
+    /*
+        @brief Add a value at the back of the queue
+        @param value Value to add, left untouched if the queue is full
+
+        @return `true` if added, `false` if the queue is full
+    */
+    bool TryPush(T& value) {
+        size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+
+        while (true) {
+            Slot& slot = m_slots[position & m_mask];
+            const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+            if (difference == 0) {
+                if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0) {
+                return false;
+            }
+            else {
+                position = m_enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /*
+        @brief Take the value at the front of the queue
+        @return The value, or `std::nullopt` if the queue is empty
+    */
+    std::optional<T> TryPop() {
+        size_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+
+        while (true) {
+            Slot& slot = m_slots[position & m_mask];
+            const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+
+            if (difference == 0) {
+                if (m_dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    T value = std::move(slot.value);
+                    slot.value = T{};
+                    slot.sequence.store(position + m_mask + 1, std::memory_order_release);
+                    return value;
+                }
+            }
+            else if (difference < 0) {
+                return std::nullopt;
+            }
+            else {
+                position = m_dequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /*
+        @brief Approximate number of values in the queue
+    */
+    size_t Size() const {
+        const size_t enqueued = m_enqueuePosition.load(std::memory_order_relaxed);
+        const size_t dequeued = m_dequeuePosition.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    size_t Capacity() const {
+        return m_mask + 1;
+    }
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <unordered_map>
+
+/*
+    Waits on sockets and timers for whoever has let go of their thread in the meantime, ex: a
+    suspended `Task`
+
+    One thread waits in epoll_wait() for every watched socket at once, with the nearest timer
+    as its timeout. Each watch and each timer is one-shot: its callback runs once, on the loop's
+    thread, so it must be short, ex: handing the work back to a thread pool
+
+    Callbacks get the epoll events that fired, or 0 for a timer, and for a watch cut short by
+    `Stop()`. Nothing that was waiting is dropped
+*/
+class EventLoop {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Callback = std::function<void (uint32_t events)>;
+
+private:
+    int m_epollFD;
+    int m_wakeupFD;
+
+    std::mutex m_mutex;
+    std::unordered_map<int, Callback> m_watchedSockets;
+    std::multimap<Clock::time_point, Callback> m_timers;
+    bool m_isRunning;
+
+    std::jthread m_thread;
+
+    void Wakeup();
+    void Run(std::stop_token stopToken);
+
+public:
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    /*
+        @brief Call `onReady` once the socket is ready for `events`, or has an error or hung up
+        @param socketFD The socket, one watch at a time per socket
+        @param events EPOLLIN, EPOLLOUT, or both
+        @param onReady Callback, gets the events that fired
+
+        @return `false` if the loop is stopped or the socket is already watched, `onReady`
+        is then never called
+    */
+    bool WatchSocket(const int socketFD, const uint32_t events, Callback onReady);
+
+    /*
+        @brief Call `onExpire` once `deadline` passes
+        @param deadline When
+        @param onExpire Callback
+
+        @return `false` if the loop is stopped, `onExpire` is then never called
+    */
+    bool AddTimer(const Clock::time_point deadline, Callback onExpire);
+
+    /*
+        @brief Stop the loop, calling back everything still waiting with 0, ex: on shutdown
+        May be called from a callback
+    */
+    void Stop();
+};
@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <format>
+#include <functional>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -61,6 +62,14 @@ struct CaseInsensitiveEqual {
 
 using Headers = std::unordered_map<std::string, std::string, CaseInsensitiveHash, CaseInsensitiveEqual>;
 
+class RequestReader;
+class ResponseWriter;
+
+/*
+    Writes a response body piece by piece, see `HttpResponse::Stream()`
+*/
+using BodyProducer = std::function<void (ResponseWriter&)>;
+
 struct HttpRequest {
 
     HttpMethod method;
@@ -70,18 +79,26 @@ struct HttpRequest {
     Headers headers;
 
     std::string body;
+
+    // Fields sent after a chunked body, kept apart so they can't pass for headers
+    Headers trailers;
     
     std::unordered_map<std::string, std::string> queryParams;
     std::unordered_map<std::string, std::string> routeParams;
 
+    // Set while the handler of a route with `RouteOptions::streamBody` runs, `body` is empty then
+    RequestReader* bodyReader;
+
     HttpRequest() : 
         method(HttpMethod::DEFAULT_INVALID),
         requestUrl{},
         version(HttpVersion::DEFAULT_INVALID),
         headers{},
         body{},
+        trailers{},
         queryParams{},
-        routeParams{}
+        routeParams{},
+        bodyReader(nullptr)
     {}
 
     HttpRequest(
@@ -98,8 +115,10 @@ struct HttpRequest {
         version(version),
         headers(headers),
         body(body),
+        trailers{},
         queryParams(queryParams),
-        routeParams(routeParams)
+        routeParams(routeParams),
+        bodyReader(nullptr)
     {}
 
     /*
@@ -131,6 +150,14 @@ struct HttpRequest {
     */
     bool ParseFrom(std::stringstream& ss);
 
+    /*
+        @brief Parse only the start line and headers of the HttpRequest message
+        @param ss Message in stringstream format, left positioned at the start of the body
+
+        @return `true` if parsed successfully, `false` otherwise
+    */
+    bool ParseHeadFrom(std::stringstream& ss);
+
     /*
         @brief Getter for header field
         @param key Key of the associated value to fetch
@@ -149,6 +176,15 @@ struct HttpRequest {
         @return The value associated with the key if found, else `std::nullopt`
     */
     std::optional<std::string> GetRouteParam(const std::string& key) const;
+
+    /*
+        @brief Whether the client wants the connection kept open after this request
+        HTTP/1.1 connections persist unless `Connection` lists `close`, HTTP/1.0 ones only
+        if it lists `keep-alive`
+
+        @return `true` if the connection should persist, `false` otherwise
+    */
+    bool IsKeepAlive() const;
 };
 
 
@@ -162,12 +198,16 @@ struct HttpResponse {
 
     std::string body;
 
+    // Set by `Stream()`, writes the body instead of `body`
+    BodyProducer bodyProducer;
+
     HttpResponse() :
         version(HttpVersion::HTTP_1_1),
         statusCode(200),
         statusText("OK"),
         headers{},
-        body{}
+        body{},
+        bodyProducer{}
     {}
 
     HttpResponse(
@@ -181,7 +221,8 @@ struct HttpResponse {
         statusCode(statusCode),
         statusText(statusText),
         headers(headers),
-        body(body)
+        body(body),
+        bodyProducer{}
     {}
 
     /*
@@ -238,6 +279,15 @@ struct HttpResponse {
     void SetBody(const std::string& body, const bool setContentLengthHeader = true);
     void SetBody(std::string&& body, const bool setContentLengthHeader = true);
 
+    /*
+        @brief Stream the body instead of holding all of it in `body`
+        @param producer Called once the handler has returned, to write the body in pieces with
+               `ResponseWriter::Write()`, each blocking while the client is behind on reading
+        @param contentLength Length of the whole body if known up front, sent as "Content-Length",
+               otherwise the body is sent with chunked encoding
+    */
+    void Stream(BodyProducer producer, const std::optional<size_t> contentLength = std::nullopt);
+
     /*
         @brief Serialize the object into a `std::string` according to the standard HTTP response format
     */
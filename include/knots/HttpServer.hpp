@@ -1,17 +1,38 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <netinet/in.h>
+#include <optional>
 #include <set>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
+#include "knots/ChunkedDecoder.hpp"
+#include "knots/ConcurrencyLimiter.hpp"
+#include "knots/EventLoop.hpp"
 #include "knots/HttpMessage.hpp"
+#include "knots/RequestReader.hpp"
+#include "knots/ResponseWriter.hpp"
 #include "knots/Router.hpp"
 #include "knots/Socket.hpp"
+#include "knots/Task.hpp"
 #include "knots/ThreadPool.hpp"
+#include "knots/TimingWheel.hpp"
 #include "knots/utils/Config.hpp"
 
+/*
+    Picks the thread pool priority for a new connection from its first request
+*/
+using PriorityClassifier = std::function<JobPriority(const HttpRequest&)>;
+
 class HttpServer {
 private:
     // Determine whether server is active or not
@@ -21,8 +42,6 @@ private:
     std::mutex m_activeClientSocketsMutex;
     std::set<int> m_activeClientSockets;
 
-    std::jthread m_consoleInputHandlerThread;
-
     // Server information
     sockaddr_in m_address;
     int m_addrlen;
@@ -35,28 +54,210 @@ private:
     Router m_router;
     std::unordered_map<short int, HandlerFunction> m_errorRouter;
 
-    // Thread Pool
+    PriorityClassifier m_priorityClassifier;
+
+    /*
+        Job for a connection that is waiting for a thread, newly accepted or kept alive
+        `requestsServed` counts the requests already answered on it, 0 for a new one
+
+        If a new one is destroyed without having run, ex: turned away by an overloaded thread
+        pool, the client is sent `m_overloadResponse` before the connection is closed
+    */
+    struct PendingConnection {
+        HttpServer* server;
+        Socket clientSocket;
+        sockaddr_in clientAddress;
+        int requestsServed;
+
+        PendingConnection(
+            HttpServer* server,
+            Socket clientSocket,
+            const sockaddr_in& clientAddress,
+            const int requestsServed = 0
+        );
+        PendingConnection(PendingConnection&& other) noexcept = default;
+        ~PendingConnection();
+
+        void operator()();
+    };
+
+    /*
+        Job for a request whose handler runs on the compute pool, see `HandlerExecution::OFFLOAD`
+
+        It sends the response itself, and hands a kept-alive connection back to the connection
+        pool. If it is destroyed without having run, the client is sent `m_overloadResponse`
+    */
+    struct OffloadedRequest {
+        HttpServer* server;
+        Socket clientSocket;
+        sockaddr_in clientAddress;
+        HttpRequest req;
+        const HandlerFunction* handler;
+        ConcurrencyLimiter::Permit permit;
+        int requestNumber;
+        bool hasRun;
+
+        OffloadedRequest(
+            HttpServer* server,
+            Socket clientSocket,
+            const sockaddr_in& clientAddress,
+            HttpRequest req,
+            const HandlerFunction* handler,
+            ConcurrencyLimiter::Permit permit,
+            const int requestNumber
+        );
+        OffloadedRequest(OffloadedRequest&& other) noexcept = default;
+        ~OffloadedRequest();
+
+        void operator()();
+    };
+
+    /*
+        A request whose handler is an `AsyncHandler`, see `m_eventLoop`
+
+        Its coroutine owns it from `Start()` on. Once the coroutine finishes, it sends the
+        response, hands a kept-alive connection back to the connection pool, and frees itself
+        Past `requestTimeoutMs` it is answered with a 504 and the connection closed instead,
+        whatever the coroutine still waits on
+    */
+    struct AsyncRequest {
+        HttpServer* server;
+        Socket clientSocket;
+        sockaddr_in clientAddress;
+        HttpRequest req;
+        HttpResponse res;
+        ConcurrencyLimiter::Permit permit;
+        int requestNumber;
+        Task<void> task;
+
+        // Set by whichever answers first, the coroutine finishing or the deadline
+        std::atomic<bool> isAnswered;
+
+        AsyncRequest(
+            HttpServer* server,
+            Socket clientSocket,
+            const sockaddr_in& clientAddress,
+            HttpRequest req,
+            HttpResponse res,
+            ConcurrencyLimiter::Permit permit,
+            const int requestNumber
+        );
+
+        static void Start(std::unique_ptr<AsyncRequest> request, const AsyncHandler& handler);
+        void Finish();
+        void TimeOut();
+    };
+
+    // Pre-serialized "503 Service Unavailable", sent when the thread pool is full
+    // Declared before the thread pool, so it outlives any job still in it
+    std::string m_overloadResponse;
+
+    // Caps requests running their handlers at once, null if `maxConcurrentRequests` is 0
+    std::unique_ptr<ConcurrencyLimiter> m_concurrencyLimiter;
+
+    /*
+        Kept-alive connections waiting for their next request, least recently used first
+        When every thread is taken, the oldest is closed to make room for a new connection
+        Each connection takes its own entry out, an evicted one is only flagged
+    */
+    struct IdleConnection {
+        int clientSocketFD;
+        bool isEvicted;
+    };
+    using IdleConnectionList = std::list<IdleConnection>;
+
+    std::mutex m_idleConnectionsMutex;
+    IdleConnectionList m_idleConnections;
+
+    IdleConnectionList::iterator MarkIdle(const Socket& clientSocket);
+    void MarkActive(const IdleConnectionList::iterator idleConnection);
+    void EvictIdleConnection();
+
+    // Read and request deadlines of every connection, see `HttpServerConfiguration`
+    static constexpr std::chrono::milliseconds connectionTimerTick{10};
+    static constexpr size_t connectionTimerSlots = 1024;
+    TimingWheel m_connectionTimers;
+
+    // Largest request buffered whole before its handler runs
+    static constexpr size_t maxRequestHeadSize = 65536;
+    static constexpr size_t maxBufferedRequestSize = 1 << 20;
+
+    // Most of a streamed body left unread by its handler that is read past to keep the connection
+    static constexpr size_t maxDiscardedBodySize = 65536;
+
+    // Responses to pipelined requests are written together, up to this many bytes at a time
+    static constexpr size_t maxBatchedResponseSize = 65536;
+
+    // Parks the requests of `AsyncHandler`s while they wait, they resume on `m_threadPool`
+    // Stopped before the thread pools, so no request is left parked
+    EventLoop m_eventLoop;
+
+    // Thread Pool, for connections, and for offloaded handlers if `computeThreads` is set
     ThreadPool m_threadPool;
-    std::mutex m_threadPoolMutex;
+    ThreadPool m_computePool;
 
     // Miscellaneous
     void SetServerSocketOptions();
     void ValidateServerConfiguration() const;
-    void HandleConsoleInput();
+    void ScheduleConsolePoll();
+    bool PollConsoleInput();
     
     // Handle client connection
     bool SetClientSocketOptions(const Socket& clientSocket) const;
-    void HandleConnection(Socket clientSocket, const sockaddr_in clientAddress);
+    JobPriority ClassifyConnection(const Socket& clientSocket) const;
+    int IncomingCpu(const Socket& clientSocket) const;
+    void HandleConnection(Socket clientSocket, const sockaddr_in clientAddress, const int requestsServed);
+
+    /*
+        How the body of a buffered request is delimited, worked out from its head alone
+        `errorStatus` is set if it can't be, ex: 501 for a transfer coding other than chunked
+    */
+    struct RequestFraming {
+        size_t headSize;
+        size_t contentLength;
+        bool isChunked;
+        short int errorStatus;
+    };
+    static std::optional<RequestFraming> FrameRequest(const std::string_view buffered);
+    BodyOptions FindBodyOptions(const std::string_view head) const;
     bool HandleRequest(
         std::stringstream& ss,
-        const Socket& clientSocketFD,
-        const sockaddr_in& clientAddress
+        Socket& clientSocket,
+        const sockaddr_in& clientAddress,
+        TimingWheel::Timer& requestDeadline,
+        const int requestNumber,
+        std::vector<std::string>& responses,
+        const bool canOffload,
+        RequestReader* bodyReader = nullptr
     );
+    bool SendResponse(
+        const HttpRequest& req,
+        HttpResponse& res,
+        const Socket& clientSocket,
+        const sockaddr_in& clientAddress,
+        const int requestNumber,
+        std::vector<std::string>* responses = nullptr
+    ) const;
+    bool SendStreamedResponse(
+        const HttpRequest& req,
+        HttpResponse& res,
+        const Socket& clientSocket,
+        const sockaddr_in& clientAddress,
+        bool isKeptAlive,
+        std::vector<std::string>* responses
+    ) const;
     void HandleError(
         const int statusCode,
         const HttpRequest& req,
         const Socket& clientSocket,
-        const sockaddr_in& clientAddress
+        const sockaddr_in& clientAddress,
+        const std::string_view allowedMethods = {},
+        std::vector<std::string>* responses = nullptr
+    ) const;
+    void SetOptionsResponse(
+        const HttpRequest& req,
+        const std::string& allowedMethods,
+        HttpResponse& res
     ) const;
     
 public:
@@ -70,4 +271,14 @@ public:
 
     void AddErrorRoute(short int responseStatusCode, HandlerFunction handler);
     const HandlerFunction* FetchErrorRoute(short int responseStatusCode) const;
+
+    /*
+        @brief Classify connections by their first request before they are queued for a thread
+        @param classifier Gets the request line and headers, returns the priority to queue with
+
+        Only the bytes already received when the connection is accepted are looked at, if the
+        request hasn't fully arrived by then the connection is queued as `JobPriority::NORMAL`
+        Set this before calling `AcceptConnections()`
+    */
+    void SetPriorityClassifier(PriorityClassifier classifier);
 };
\ No newline at end of file
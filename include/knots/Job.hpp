@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+    Move-only `void ()` callable for the ThreadPool
+
+    Unlike `std::function` it never copies the callable, so captures can own things like a
+    `Socket`, and it stores any callable of up to `inlineSize` bytes in place, so enqueueing
+    one doesn't allocate. Larger callables fall back to the heap
+
+    An empty Job does nothing when called
+*/
+class Job {
+public:
+    static constexpr size_t inlineSize = 64;
+
+    // Whether a callable of type `F` is held in place, so making a Job of it doesn't allocate
+    template <typename F>
+    static constexpr bool isStoredInline =
+        sizeof(F) <= inlineSize
+        && alignof(F) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible_v<F>;
+
+private:
+    // What a Job needs to know about the callable it holds, one static instance per type
+    struct Operations {
+        void (*invoke)(void* storage);
+        void (*moveTo)(void* from, void* to);
+        void (*destroy)(void* storage);
+    };
+
+    template <typename F>
+    static constexpr Operations inlineOperations = {
+        [] (void* storage) {
+            (*std::launder(static_cast<F*>(storage)))();
+        },
+        [] (void* from, void* to) {
+            F* source = std::launder(static_cast<F*>(from));
+            ::new (to) F(std::move(*source));
+            source->~F();
+        },
+        [] (void* storage) {
+            std::launder(static_cast<F*>(storage))->~F();
+        }
+    };
+
+    template <typename F>
+    static constexpr Operations heapOperations = {
+        [] (void* storage) {
+            (**static_cast<F**>(storage))();
+        },
+        [] (void* from, void* to) {
+            *static_cast<F**>(to) = *static_cast<F**>(from);
+        },
+        [] (void* storage) {
+            delete *static_cast<F**>(storage);
+        }
+    };
+
+    alignas(std::max_align_t) std::byte m_storage[inlineSize];
+    const Operations* m_operations;
+
+public:
+    Job() :
+        m_operations(nullptr)
+    {}
+
+    template <
+        typename F,
+        typename = std::enable_if_t<
+            std::is_same_v<std::decay_t<F>, Job> == false
+            && std::is_invocable_r_v<void, std::decay_t<F>&>
+        >
+    >
+    Job(F&& function) {
+        using Function = std::decay_t<F>;
+
+        if constexpr (isStoredInline<Function>) {
+            ::new (static_cast<void*>(m_storage)) Function(std::forward<F>(function));
+            m_operations = &inlineOperations<Function>;
+        }
+        else {
+            *reinterpret_cast<Function**>(m_storage) = new Function(std::forward<F>(function));
+            m_operations = &heapOperations<Function>;
+        }
+    }
+
+    Job(Job&& other) noexcept :
+        m_operations(other.m_operations) {
+
+        if (m_operations != nullptr) {
+            m_operations->moveTo(other.m_storage, m_storage);
+            other.m_operations = nullptr;
+        }
+    }
+
+    Job& operator=(Job&& other) noexcept {
+        if (this == &other) {
+            return *this;
+        }
+
+        Reset();
+
+        if (other.m_operations != nullptr) {
+            other.m_operations->moveTo(other.m_storage, m_storage);
+            m_operations = other.m_operations;
+            other.m_operations = nullptr;
+        }
+
+        return *this;
+    }
+
+    Job(const Job&) = delete;
+    Job& operator=(const Job&) = delete;
+
+    ~Job() {
+        Reset();
+    }
+
+    void operator()() {
+        if (m_operations != nullptr) {
+            m_operations->invoke(m_storage);
+        }
+    }
+
+    explicit operator bool() const {
+        return m_operations != nullptr;
+    }
+
+    /*
+        @brief Destroy the held callable, leaving the Job empty
+    */
+    void Reset() {
+        if (m_operations != nullptr) {
+            m_operations->destroy(m_storage);
+            m_operations = nullptr;
+        }
+    }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "knots/Socket.hpp"
@@ -25,4 +26,16 @@ namespace NetworkIO {
         @return `true` if message was sent successfully, `false` otherwise
     */
     bool Send(const Socket& socket, const std::vector<char>& buffer, const int flags);
+
+    /*
+        @brief Send several buffers back to back with as few system calls as possible, like
+        `writev()`, retrying until all of them are sent
+        @param socket Socket of the intended recipient
+        @param buffers The data to send, in order
+        @param flags Any flags to pass to `sendmsg()`
+
+        @return `true` if every buffer was sent successfully, `false` otherwise
+    */
+    bool Send(const Socket& socket, const std::vector<std::string>& buffers, const int flags);
+    bool Send(const Socket& socket, const std::vector<std::string_view>& buffers, const int flags);
 }
\ No newline at end of file
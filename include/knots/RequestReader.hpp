@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "knots/ChunkedDecoder.hpp"
+#include "knots/HttpMessage.hpp"
+#include "knots/Socket.hpp"
+
+/*
+    Reads a request body from the client as the handler asks for it, see `RouteOptions::streamBody`
+
+    The body is pulled off the socket one piece of up to `bufferSize` bytes at a time, so memory
+    stays bounded by that, and not by the size of the body. A client sending faster than the
+    handler reads is held back by its TCP window
+
+    The body is framed one of two ways:
+    - CONTENT_LENGTH: exactly that many bytes, nothing past them is read
+    - CHUNKED: decoded as it arrives, the trailers are there once it is complete
+*/
+class RequestReader {
+public:
+    enum class Framing {
+        CONTENT_LENGTH,
+        CHUNKED
+    };
+
+    static constexpr size_t bufferSize = 32768;
+    static constexpr size_t maxTrailerSize = 65536;
+
+private:
+    const Socket& m_socket;
+    const Framing m_framing;
+
+    // Bytes of a `CONTENT_LENGTH` body still to be read
+    size_t m_remaining;
+    ChunkedDecoder m_decoder;
+
+    // Raw bytes read from the socket and not yet handed out, and the last piece handed out
+    std::string m_buffer;
+    std::string m_piece;
+
+    std::function<void ()> m_onReceive;
+
+    size_t m_bytesRead;
+    short int m_errorStatus;
+    bool m_hasFailed;
+    bool m_isComplete;
+
+    bool Receive(const size_t maxSize);
+    void Fail(const short int errorStatus);
+
+public:
+    /*
+        @param socket Socket of the client, the request's head already read off it
+        @param buffered Bytes that came in after the head, before the reader was made
+        @param framing How the end of the body is marked
+        @param contentLength Length from the head, only used with `Framing::CONTENT_LENGTH`
+        @param maxBodySize Largest body accepted, more fails with a 413
+        @param onReceive Called each time more of the body comes in, ex: to push back a deadline
+    */
+    RequestReader(
+        const Socket& socket,
+        std::string buffered,
+        const Framing framing,
+        const size_t contentLength,
+        const size_t maxBodySize,
+        std::function<void ()> onReceive = {}
+    );
+
+    RequestReader(const RequestReader&) = delete;
+    RequestReader& operator=(const RequestReader&) = delete;
+
+    /*
+        @brief Wait for the next piece of the body
+        @return The piece, valid until the next call, or `std::nullopt` once the body has ended,
+        or can't be read any further, see `HasFailed()`
+    */
+    std::optional<std::string_view> Read();
+
+    /*
+        @brief Read the rest of the body and drop it, ex: what a handler left unread
+        @param maxSize Most bytes to drop, a longer body isn't worth waiting for
+
+        @return `true` if the body is now complete
+    */
+    bool Discard(const size_t maxSize);
+
+    /*
+        @brief Take whatever was read past the end of the body, the start of the next request
+        @return The bytes, empty if the body isn't complete
+    */
+    std::string TakeLeftover();
+
+    bool IsComplete() const;
+    bool HasFailed() const;
+
+    /*
+        @brief The status to answer a body that broke its framing or limits with, ex: 413
+        @return The status, 0 if there is none, ex: it is fine, or the client went away
+    */
+    short int ErrorStatus() const;
+
+    size_t BytesRead() const;
+
+    /*
+        @brief Trailer fields sent after a chunked body, once it is complete
+    */
+    const Headers& Trailers() const;
+};
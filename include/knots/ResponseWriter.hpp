@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include "knots/Socket.hpp"
+
+/*
+    Writes a streamed response body to the client as it is produced, see `HttpResponse::Stream()`
+
+    Small writes are gathered into a buffer of up to `bufferSize` bytes before being sent, so
+    memory stays bounded by that, and not by the size of the body. Sending blocks while the
+    client's receive window and the socket's send buffer are full, which holds the producer
+    back to the pace the client reads at
+
+    The body is framed one of three ways:
+    - CONTENT_LENGTH: the length was sent up front, writing more or fewer bytes fails
+    - CHUNKED: each flush is sent as one chunk, and `Finish()` sends the last, empty one
+    - UNTIL_CLOSE: raw bytes, the connection closing marks the end, for HTTP/1.0 clients
+*/
+class ResponseWriter {
+public:
+    enum class Framing {
+        CONTENT_LENGTH,
+        CHUNKED,
+        UNTIL_CLOSE
+    };
+
+    static constexpr size_t bufferSize = 16384;
+
+private:
+    const Socket& m_socket;
+    const Framing m_framing;
+    const size_t m_contentLength;
+
+    std::string m_buffer;
+    size_t m_bytesWritten;
+    bool m_hasFailed;
+    bool m_isFinished;
+
+    bool SendPiece(const std::string_view data);
+
+public:
+    /*
+        @param socket Socket of the client, the response head already sent on it
+        @param framing How the end of the body is marked
+        @param contentLength Length sent up front, only used with `Framing::CONTENT_LENGTH`
+    */
+    ResponseWriter(const Socket& socket, const Framing framing, const size_t contentLength = 0);
+
+    ResponseWriter(const ResponseWriter&) = delete;
+    ResponseWriter& operator=(const ResponseWriter&) = delete;
+
+    /*
+        @brief Add the next piece of the body, sending what has gathered once it passes `bufferSize`
+        @param data The piece
+
+        @return `false` if the client is gone or the body would pass its length, after which
+        every write fails and the producer should stop
+    */
+    bool Write(const std::string_view data);
+
+    /*
+        @brief Send what has gathered so far right away, ex: for events the client waits on
+
+        @return `false` if the client is gone
+    */
+    bool Flush();
+
+    /*
+        @brief End the body, called once the producer returns
+
+        @return `true` if the whole body was sent, and the connection can be reused
+    */
+    bool Finish();
+
+    bool HasFailed() const;
+    size_t BytesWritten() const;
+};
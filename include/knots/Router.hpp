@@ -1,10 +1,17 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "knots/CompiledRoutes.hpp"
 #include "knots/HttpMessage.hpp"
+#include "knots/Task.hpp"
 
 /*
     Alias for the handler functions
@@ -13,6 +20,127 @@ using HandlerFunction = std::function<
     void(const HttpRequest&, HttpResponse&)
 >;
 
+/*
+    Alias for middleware functions
+
+    Middleware runs around the handler of every route in a Router. Call `next(req, res)` to
+    continue down the chain to the route's handler; whatever runs before that call is a
+    pre-handler stage, whatever runs after is a post-handler stage. Not calling `next` at all
+    short-circuits the request, ex: for denied or cached responses
+*/
+using Middleware = std::function<
+    void(const HttpRequest&, HttpResponse&, const HandlerFunction& next)
+>;
+
+/*
+    Alias for the coroutines wrapped by `AsyncHandler`
+*/
+using AsyncHandlerFunction = std::function<
+    Task<void>(const HttpRequest&, HttpResponse&)
+>;
+
+/*
+    A handler written as a coroutine, for requests that spend most of their time waiting, ex:
+    long polling, or a call to another service
+
+    router.Get("/poll", AsyncHandler([] (const HttpRequest& req, HttpResponse& res) -> Task<void> {
+        co_await SleepFor(std::chrono::seconds(1));
+        res.SetBody("done");
+    }));
+
+    While it awaits, the request is parked on the server's event loop, and holds no thread. The
+    response is sent once the coroutine finishes, like any other
+
+    It is added to a route like any other handler, a route's concurrency limit included, which
+    holds its slot while parked. Wherever it is called as a plain handler instead, ex: from
+    middleware, it runs to completion on the calling thread, with its awaitables blocking that
+    thread. A warning is logged when middleware is composed around one
+*/
+class AsyncHandler {
+private:
+    AsyncHandlerFunction m_handler;
+
+public:
+    explicit AsyncHandler(AsyncHandlerFunction handler);
+
+    /*
+        @brief Create the coroutine for a request, not started yet
+        @param req The request, must outlive the coroutine
+        @param res The response, must outlive the coroutine
+    */
+    Task<void> MakeTask(const HttpRequest& req, HttpResponse& res) const;
+
+    /*
+        @brief Run the coroutine to completion on this thread, as a `HandlerFunction`
+    */
+    void operator()(const HttpRequest& req, HttpResponse& res) const;
+};
+
+/*
+    Where a route's handler runs
+    - INLINE
+        On the connection's own thread, right after the request is read. Best for handlers that
+        only compute, or answer from memory
+
+    - OFFLOAD
+        On the server's compute pool, see `computeThreads` in `HttpServerConfiguration`, so a
+        handler that blocks on disk or a database doesn't hold up a connection thread
+        Runs inline if the server has no compute pool
+*/
+enum class HandlerExecution {
+    INLINE,
+    OFFLOAD
+};
+
+/*
+    Options for a single route, given when it is added
+    - maxConcurrentRequests
+        How many requests for this route may run its handler at once, 0 for no limit
+        Caps how many threads a slow route can tie up, so it can't starve the other routes
+
+    - maxQueuedRequests
+        How many requests may wait for the route to free up once the limit is reached
+        A waiting request still holds its thread, so keep this small
+
+    - queueTimeoutMs
+        How long a request may wait, before it is answered with "503 Service Unavailable"
+
+    - execution
+        Where the handler runs, see `HandlerExecution`
+
+    - maxBodySize
+        Largest request body the route accepts, in bytes, 0 for the server's default
+        A larger one is answered with "413 Content Too Large" as soon as its headers show it,
+        before any of it is read. Buffered bodies can't go past the server's 1MiB limit,
+        streamed ones have no limit by default
+
+    - streamBody
+        Hand the body to the handler as it arrives, through `req.bodyReader`, instead of
+        reading all of it into `req.body` first, ex: for large uploads
+        The handler then runs inline, see `RequestReader`
+*/
+struct RouteOptions {
+    int maxConcurrentRequests = 0;
+    int maxQueuedRequests = 0;
+    int queueTimeoutMs = 0;
+    HandlerExecution execution = HandlerExecution::INLINE;
+    size_t maxBodySize = 0;
+    bool streamBody = false;
+};
+
+/*
+    What a route accepts as a request body, from its `RouteOptions`
+*/
+struct BodyOptions {
+    size_t maxBodySize = 0;
+    bool isStreamed = false;
+};
+
+/*
+    `Dispatch` function of a `CompiledRoutes::Table`
+*/
+using CompiledDispatchFunction = CompiledRoutes::MatchResult (*)(HttpRequest&, HttpResponse&, uint16_t*);
+
 /*
     A combination of a HTTP Method (GET, POST, etc.) and the request URL
     This will act as the key to the map in the router later on to fetch the
@@ -37,22 +165,151 @@ struct Route {
     }
 };
 
+/*
+    Owns every handler function added to a Router
+
+    Routes only keep pointers into this table, so a handler is stored once no matter how
+    many routes or methods use it. Plain function pointers are interned, adding the same
+    function twice returns the entry that already exists
+    Closures can't be compared, so each one added gets its own entry
+
+    Entries are never removed, and their addresses stay valid for the lifetime of the table
+*/
+class HandlerTable {
+private:
+    using HandlerFunctionPointer = void (*)(const HttpRequest&, HttpResponse&);
+
+    std::deque<HandlerFunction> m_handlers;
+    std::unordered_map<HandlerFunctionPointer, const HandlerFunction*> m_functionPointers;
+
+    // Tables of mounted routers, their entries are referenced by this router's routes
+    std::vector<std::shared_ptr<HandlerTable>> m_mountedTables;
+
+    // Sent as "Retry-After" by routes that are full, see `RouteOptions::maxConcurrentRequests`
+    std::atomic<int> m_retryAfterSeconds;
+
+public:
+    HandlerTable();
+
+    /*
+        @brief Store a handler, or find the identical one already stored
+        @param handler Handler to store
+
+        @return Pointer to the stored handler, valid for as long as the table lives
+    */
+    const HandlerFunction* Intern(const HandlerFunction& handler);
+
+    /*
+        @brief Keep another table alive, so its entries can be referenced from this one's routes
+        @param table Table to keep alive
+    */
+    void KeepAlive(std::shared_ptr<HandlerTable> table);
+
+    /*
+        @brief Set the "Retry-After" sent by full routes, in this table and the ones it keeps alive
+        @param retryAfterSeconds Value of the header
+    */
+    void SetRetryAfterSeconds(const int retryAfterSeconds);
+    int GetRetryAfterSeconds() const;
+
+    /*
+        @brief Number of handlers stored in this table, not counting mounted tables
+    */
+    size_t Size() const;
+};
+
+/*
+    The handlers registered for each method of one route
+
+    Only the methods that actually have a handler take up space; `m_methodMask` has bit
+    `1 << method` set for each of them, and `m_handlers` holds one pointer per set bit, in
+    bit order. The handlers themselves live in the Router's `HandlerTable`
+    `m_offloadMask` has the same bits set for the handlers that run as `HandlerExecution::OFFLOAD`,
+    and `m_streamBodyMask` for the ones whose body is streamed. `m_maxBodySizes` is laid out
+    like `m_handlers`, and stays empty while no handler has a limit
+*/
 struct SegmentHandlerFunctions {
 
-    HandlerFunction m_post;
-    HandlerFunction m_get;
-    HandlerFunction m_head;
-    HandlerFunction m_put;
-    HandlerFunction m_delete;
-    HandlerFunction m_connect;
-    HandlerFunction m_options;
-    HandlerFunction m_trace;
-    HandlerFunction m_patch;
+    uint16_t m_methodMask;
+    uint16_t m_offloadMask;
+    uint16_t m_streamBodyMask;
+    std::vector<const HandlerFunction*> m_handlers;
+    std::vector<size_t> m_maxBodySizes;
 
     SegmentHandlerFunctions();
 
+    /*
+        @brief Get the handler for `method`
+        @param method HTTP method of the request
+
+        @return The handler, or an empty `HandlerFunction` if none was set for this method
+    */
     const HandlerFunction& GetHandler(const HttpMethod method) const;
-    void SetHandler(const HttpMethod method, const HandlerFunction& handler);
+
+    /*
+        @brief Set the handler for `method`, replacing any existing one
+        @param method HTTP method
+        @param handler Handler interned in a `HandlerTable`
+        @param execution Where the handler runs
+        @param bodyOptions What the handler accepts as a request body
+    */
+    void SetHandler(
+        const HttpMethod method,
+        const HandlerFunction* handler,
+        const HandlerExecution execution = HandlerExecution::INLINE,
+        const BodyOptions& bodyOptions = {}
+    );
+
+    /*
+        @brief Get where the handler for `method` runs, `INLINE` if there is no handler
+    */
+    HandlerExecution GetExecution(const HttpMethod method) const;
+
+    /*
+        @brief Get what the handler for `method` accepts as a request body, the defaults if
+        there is no handler
+    */
+    BodyOptions GetBodyOptions(const HttpMethod method) const;
+
+    /*
+        @brief Check whether a handler has been set for `method`
+    */
+    bool HasHandler(const HttpMethod method) const;
+
+    /*
+        @brief Check whether no handler has been set for any method
+        @return `true` if every handler is empty, `false` otherwise
+    */
+    bool IsEmpty() const;
+
+    /*
+        @brief Get the methods this route answers, including the ones the server handles itself
+        @return `m_methodMask`, with HEAD added if GET is set, and OPTIONS always added
+    */
+    uint16_t AllowedMethodMask() const;
+
+    /*
+        @brief Same as `AllowedMethodMask()`, for a route with handlers for `methodMask`
+    */
+    static uint16_t AllowedMethodMaskFor(const uint16_t methodMask);
+
+    /*
+        @brief Get the value of the "Allow" header for this route, ex: "GET, HEAD, OPTIONS"
+        @return String shared by every route with the same `AllowedMethodMask()`
+    */
+    const std::string& AllowedMethods() const;
+
+    /*
+        @brief Same as `AllowedMethods()`, for a route whose `AllowedMethodMask()` is `allowedMask`
+    */
+    static const std::string& AllowedMethodsFor(const uint16_t allowedMask);
+
+    /*
+        @brief Get the bit for `method` as used in `m_methodMask`
+    */
+    static constexpr uint16_t MethodBit(const HttpMethod method) {
+        return static_cast<uint16_t>(1u << static_cast<int>(method));
+    }
 };
 
 struct UrlSegment {
@@ -73,25 +330,32 @@ struct UrlSegment {
         next{}
     {}
 
+    /*
+        A dynamic segment (`{name}`) matches exactly one path component
+    */
     bool isDynamic() const {
-        return value[0] == '{' && value.back() == '}';
+        return value[0] == '{' && value.back() == '}' && value[1] != '*';
+    }
+
+    /*
+        A wildcard segment (`{*name}`) matches the rest of the path, and can
+        only be the last segment of a route
+    */
+    bool isWildcard() const {
+        return value.size() > 2 && value[0] == '{' && value[1] == '*' && value.back() == '}';
+    }
+
+    /*
+        @brief Name of the route parameter for dynamic and wildcard segments
+        @return "userId" for `{userId}`, "rest" for `{*rest}`
+    */
+    std::string ParameterName() const {
+        const size_t start = isWildcard() ? 2 : 1;
+        return value.substr(start, value.size() - start - 1);
     }
 
     bool IsEndpoint(const HttpMethod& method) const {
-        switch (method) {
-            case HttpMethod::POST:            return handlers.m_post != nullptr;
-            case HttpMethod::GET:             return handlers.m_get != nullptr;
-            case HttpMethod::HEAD:            return handlers.m_head != nullptr;
-            case HttpMethod::PUT:             return handlers.m_put != nullptr;
-            case HttpMethod::DELETE:          return handlers.m_delete != nullptr;
-            case HttpMethod::CONNECT:         return handlers.m_connect != nullptr;
-            case HttpMethod::OPTIONS:         return handlers.m_options != nullptr;
-            case HttpMethod::TRACE:           return handlers.m_trace != nullptr;
-            case HttpMethod::PATCH:           return handlers.m_patch != nullptr;
-            case HttpMethod::DEFAULT_INVALID: break;
-        }
-
-        return false;
+        return handlers.HasHandler(method);
     }
 };
 
@@ -103,6 +367,15 @@ struct UrlSegment {
 
     Add routes to the router using `AddRoute()`, and get the handler function
     using `FetchRoute()`
+
+    Routes can contain three kinds of segments:
+        - static    `/users`     matches the segment exactly
+        - dynamic   `/{userId}`  matches any single segment
+        - wildcard  `/{*rest}`   matches all remaining segments (must be last)
+
+    When more than one segment could match, static beats dynamic, which beats wildcard
+    Lookup descends the tree once following that priority; if the descent dead-ends, the
+    nearest wildcard seen on the way down catches the remainder of the URL
 */
 class Router {
 private:
@@ -113,27 +386,109 @@ private:
 
     std::shared_ptr<UrlSegment> m_dynamicRoutesTreeRoot;
 
+    // Shared by copies of this router, the routes above point into it
+    std::shared_ptr<HandlerTable> m_handlerTable;
+
+    // Tried before the routes above, if set
+    CompiledDispatchFunction m_compiledRoutes;
+
+    // Applied to every handler when the router is frozen, first added runs outermost
+    std::vector<Middleware> m_middlewares;
+    bool m_isFrozen;
+
     const UrlSegment* FindSegmentForRoute(HttpRequest& req) const;
 
+    void AddRoute(
+        const HttpMethod& method,
+        std::string requestUrl,
+        const HandlerFunction* handler,
+        const HandlerExecution execution = HandlerExecution::INLINE,
+        const BodyOptions& bodyOptions = {}
+    );
+
 public:
     Router();
 
+    // Copies get their own route tree, the handlers themselves are shared
+    Router(const Router& other);
+    Router& operator=(const Router& other);
+
     void AddRoute(
         const HttpMethod& method,
         std::string requestUrl, 
-        const HandlerFunction& handler
+        const HandlerFunction& handler,
+        const RouteOptions& options = {}
     );
 
+    /*
+        @brief Add a middleware that runs around the handler of every route
+        @param middleware Middleware to add, see `Middleware` for how to write one
+
+        Middleware runs in the order it is added: the first one added sees the request first
+        and the response last
+        It does not run for routes from `UseCompiledRoutes()`, or for error responses
+    */
+    void Use(const Middleware& middleware);
+
+    /*
+        @brief Compose the middleware around every handler, so each route becomes a single callable
+        
+        `HttpServer` calls this on its own copy of the router. Calling it more than once does
+        nothing, and routes added afterwards are composed as they are added
+        @param retryAfterSeconds "Retry-After" of the 503 sent by routes that are full, the
+               server passes its own so every 503 it sends agrees
+    */
+    void Freeze(const int retryAfterSeconds = 1);
+
+    /*
+        @brief Add every route of `subRouter` under the given prefix
+        @param prefix URL prefix to mount at, ex: "/api/v2"
+        @param subRouter Router whose routes to add
+
+        Example: `/users/{id}` in `subRouter` mounted at "/api/v2" is served at `/api/v2/users/{id}`
+
+        @note The routes are copied when mounting, routes added to `subRouter` afterwards
+        are not picked up
+        Middleware added to `subRouter` applies only to its own routes, inside that of this router
+    */
+    void Mount(std::string prefix, const Router& subRouter);
+
     const SegmentHandlerFunctions* FetchFunctionsForRoute(HttpRequest& req) const;
 
-    // Individual functions for request types
-    void Post(const std::string& requestUrl, const HandlerFunction& handler);
-    void Get(const std::string& requestUrl, const HandlerFunction& handler);
-    void Head(const std::string& requestUrl, const HandlerFunction& handler);
-    void Put(const std::string& requestUrl, const HandlerFunction& handler);
-    void Delete(const std::string& requestUrl, const HandlerFunction& handler);
-    void Connect(const std::string& requestUrl, const HandlerFunction& handler);
-    void Options(const std::string& requestUrl, const HandlerFunction& handler);
-    void Trace(const std::string& requestUrl, const HandlerFunction& handler);
-    void Patch(const std::string& requestUrl, const HandlerFunction& handler);
+    /*
+        @brief Serve requests from a compile-time route table before looking at runtime routes
+        @tparam Table A `CompiledRoutes::Table`
+
+        Only one table can be in use at a time, calling this again replaces it
+    */
+    template <typename Table>
+    void UseCompiledRoutes() {
+        m_compiledRoutes = &Table::Dispatch;
+    }
+
+    /*
+        @brief Run the handler for `req` from the compiled route table, if there is one
+        @param req Request
+        @param res Response for the handler to fill
+        @param methodMask If not null, gets the methods of the matching URL's routes, see
+        `CompiledRoutes::Table::Dispatch()`
+
+        @return `NOT_FOUND` if no compiled routes are in use, or none matched
+    */
+    CompiledRoutes::MatchResult DispatchCompiledRoutes(
+        HttpRequest& req,
+        HttpResponse& res,
+        uint16_t* methodMask = nullptr
+    ) const;
+
+    // Individual functions for request types, see `RouteOptions` for `options`
+    void Post(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options = {});
+    void Get(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options = {});
+    void Head(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options = {});
+    void Put(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options = {});
+    void Delete(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options = {});
+    void Connect(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options = {});
+    void Options(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options = {});
+    void Trace(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options = {});
+    void Patch(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options = {});
 };
\ No newline at end of file
@@ -17,6 +17,25 @@ public:
     Socket(const Socket&) = delete;
     Socket& operator=(const Socket&) = delete;
 
+    // Moving hands over ownership, the moved-from socket no longer closes the fd
+    Socket(Socket&& other) noexcept :
+        m_fd(other.m_fd) {
+        other.m_fd = -1;
+    }
+
+    Socket& operator=(Socket&& other) noexcept {
+        if (this != &other) {
+            if (m_fd >= 0) {
+                close(m_fd);
+            }
+
+            m_fd = other.m_fd;
+            other.m_fd = -1;
+        }
+
+        return *this;
+    }
+
     int Get() const {
         return m_fd;
     }
@@ -7,6 +7,7 @@
 namespace StaticRoutes {
     /*
         @brief Add a file as the response of a GET request
+        HEAD requests for it are answered from the file size, without reading the file
         @param path Path of fie
         @param router Router to add to
         @param prefixToRemove The prefix to remove from `path` if it exists
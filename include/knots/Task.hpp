@@ -0,0 +1,354 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "knots/EventLoop.hpp"
+#include "knots/ThreadPool.hpp"
+
+/*
+    Where a task waits, and where it resumes once it is done waiting
+    Awaitables in a task without an event loop block its thread instead, ex: in `Task::Run()`
+*/
+struct TaskContext {
+    ThreadPool* pool = nullptr;
+    EventLoop* eventLoop = nullptr;
+};
+
+template <typename T>
+class Task;
+
+/*
+    @brief Resume a waiting task on `pool`, or on this thread if there is no pool or it turns
+    the job away, so a task is never left suspended
+    @param pool The pool, may be `nullptr`
+    @param handle The task
+*/
+inline void ResumeTask(ThreadPool* pool, const std::coroutine_handle<> handle) {
+
+    if (pool != nullptr && pool->EnqueueJob([handle] () { handle.resume(); }, JobPriority::CRITICAL)) {
+        return;
+    }
+
+    handle.resume();
+    return;
+}
+
+
+/*
+    What the promises of every `Task` have in common
+*/
+class TaskPromiseBase {
+public:
+    TaskContext context;
+
+    // The task awaiting this one, if any, otherwise `onComplete` is called when it finishes
+    std::coroutine_handle<> continuation;
+    std::function<void ()> onComplete;
+
+    std::exception_ptr error;
+
+    /*
+        Hands over to the awaiting task without growing the stack, or calls `onComplete`
+    */
+    struct FinalAwaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            TaskPromiseBase& promise = handle.promise();
+            if (promise.continuation) {
+                return promise.continuation;
+            }
+
+            // Moved out first, as it may destroy the task, and this promise with it
+            std::function<void ()> onComplete = std::move(promise.onComplete);
+            if (onComplete) {
+                onComplete();
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    // Nothing runs until the task is started or awaited
+    std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+
+    void unhandled_exception() noexcept {
+        error = std::current_exception();
+    }
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+public:
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U&& result) {
+        value.emplace(std::forward<U>(result));
+    }
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+    Task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+};
+
+
+/*
+    A coroutine, the body of an asynchronous handler, see `AsyncHandler`
+
+    Starts when it is awaited by another task, or started with `Start()`. Whenever it awaits
+    something that isn't ready, ex: `SleepFor`, `WaitReadable`, it lets go of its thread and
+    waits on the context's event loop, then carries on on the context's pool
+    Awaited tasks share the context of the task awaiting them
+
+    Destroying a task that was started and hasn't finished is undefined, keep it around until
+    it completes
+*/
+template <typename T = void>
+class [[nodiscard]] Task {
+public:
+    using promise_type = TaskPromise<T>;
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+
+public:
+    Task() :
+        m_handle(nullptr)
+    {}
+
+    explicit Task(const std::coroutine_handle<promise_type> handle) :
+        m_handle(handle)
+    {}
+
+    Task(Task&& other) noexcept :
+        m_handle(std::exchange(other.m_handle, nullptr))
+    {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    // Awaited from another task
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> awaiting) noexcept {
+        m_handle.promise().context = awaiting.promise().context;
+        m_handle.promise().continuation = awaiting;
+        return m_handle;
+    }
+
+    T await_resume() {
+        return Result();
+    }
+
+    /*
+        @brief Run the task until it first waits, or finishes
+        @param context Where it waits, and resumes
+        @param onComplete Called once it finishes, on whichever thread it finished on. The task
+        may be destroyed from here
+    */
+    void Start(const TaskContext& context, std::function<void ()> onComplete) {
+        m_handle.promise().context = context;
+        m_handle.promise().onComplete = std::move(onComplete);
+        m_handle.resume();
+        return;
+    }
+
+    /*
+        @brief Run the task to completion on this thread, blocking it while the task waits
+        @return What the task returned. Rethrows if it threw
+    */
+    T Run() {
+        // Shared, as the task may finish on another thread, and still be notifying once woken
+        const auto isDone = std::make_shared<std::atomic<bool>>(false);
+
+        Start(TaskContext{}, [isDone] () {
+            *isDone = true;
+            isDone->notify_one();
+        });
+        isDone->wait(false);
+
+        return Result();
+    }
+
+    bool IsDone() const {
+        return m_handle && m_handle.done();
+    }
+
+    bool HasFailed() const {
+        return IsDone() && m_handle.promise().error != nullptr;
+    }
+
+    /*
+        @brief Take the result of a finished task
+        @return What the task returned. Rethrows if it threw
+    */
+    T Result() {
+        if (m_handle.promise().error) {
+            std::rethrow_exception(m_handle.promise().error);
+        }
+
+        if constexpr (std::is_void_v<T> == false) {
+            return std::move(m_handle.promise().value.value());
+        }
+    }
+};
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+
+/*
+    Awaitable, suspends a task for `duration`
+    `co_await SleepFor(std::chrono::milliseconds(100));`
+
+    Doesn't wait out what is left once the event loop stops, ex: on shutdown
+*/
+class SleepFor {
+private:
+    const EventLoop::Clock::duration m_duration;
+
+public:
+    explicit SleepFor(const EventLoop::Clock::duration duration) :
+        m_duration(duration)
+    {}
+
+    bool await_ready() const noexcept {
+        return m_duration <= EventLoop::Clock::duration::zero();
+    }
+
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> handle) const {
+        const TaskContext context = handle.promise().context;
+
+        if (context.eventLoop == nullptr) {
+            std::this_thread::sleep_for(m_duration);
+            return false;
+        }
+
+        // Resumes right away if the loop has stopped
+        return context.eventLoop->AddTimer(
+            EventLoop::Clock::now() + m_duration,
+            [pool = context.pool, handle] (uint32_t) {
+                ResumeTask(pool, handle);
+            }
+        );
+    }
+
+    void await_resume() const noexcept {}
+};
+
+
+/*
+    Awaitable, suspends a task until a socket is ready
+    Use `WaitReadable()` or `WaitWritable()` to make one
+
+    `co_await` gives `true` once the socket is ready, or has an error or hung up, so the next
+    call on it won't block, and `false` if the event loop stopped first, ex: on shutdown, or
+    the socket is already being waited on
+*/
+class WaitForSocket {
+private:
+    const int m_socketFD;
+    const uint32_t m_events;
+    uint32_t m_firedEvents;
+
+public:
+    WaitForSocket(const int socketFD, const uint32_t events) :
+        m_socketFD(socketFD),
+        m_events(events),
+        m_firedEvents(0)
+    {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> handle) {
+        const TaskContext context = handle.promise().context;
+
+        // EPOLLIN and EPOLLOUT have the same values as POLLIN and POLLOUT
+        if (context.eventLoop == nullptr) {
+            pollfd socket{m_socketFD, static_cast<short>(m_events), 0};
+            while (poll(&socket, 1, -1) < 0 && errno == EINTR);
+            m_firedEvents = static_cast<uint32_t>(socket.revents);
+            return false;
+        }
+
+        return context.eventLoop->WatchSocket(
+            m_socketFD,
+            m_events,
+            [this, pool = context.pool, handle] (const uint32_t firedEvents) {
+                m_firedEvents = firedEvents;
+                ResumeTask(pool, handle);
+            }
+        );
+    }
+
+    bool await_resume() const noexcept {
+        return m_firedEvents != 0;
+    }
+};
+
+inline WaitForSocket WaitReadable(const int socketFD) {
+    return WaitForSocket(socketFD, EPOLLIN);
+}
+
+inline WaitForSocket WaitWritable(const int socketFD) {
+    return WaitForSocket(socketFD, EPOLLOUT);
+}
@@ -1,44 +1,691 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <exception>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <queue>
+#include <stdexcept>
+#include <stop_token>
+#include <string_view>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
 #include <vector>
 
+#include "knots/ConcurrentQueues.hpp"
+#include "knots/Job.hpp"
+#include "knots/utils/Config.hpp"
+
+/*
+    Priority class of a job enqueued from outside the pool
+    - CRITICAL
+        Never shed by queue delay admission control, ex: health checks, payment callbacks
+
+    - NORMAL
+        Default
+
+    - BACKGROUND
+        Bulk work that can wait, ex: exports
+*/
+enum class JobPriority {
+    CRITICAL,
+    NORMAL,
+    BACKGROUND
+};
+
+/*
+    Configuration for a ThreadPool
+    - threadCount
+        Number of threads to spin up in the pool, or the most it may grow to if
+        `minThreadCount` is set
+
+    - queueCapacity
+        Number of jobs each priority's shared queue can hold, rounded up to a power of two
+
+    - overloadPolicy
+        What to do with jobs that don't fit in the shared queue, see `OverloadPolicy`
+
+    - queueDelayTarget, queueDelayInterval
+        Queue delay based admission control (CoDel), disabled if the target is 0
+        If every job taken off the shared queue during `queueDelayInterval` had waited longer
+        than `queueDelayTarget`, the pool is overloaded: new jobs are turned away, and queued
+        jobs that have waited longer than `queueDelayInterval` are dropped instead of run
+        `JobPriority::CRITICAL` jobs are exempt from both
+        It stays overloaded until a job comes off the queue below the target again, or the
+        queue runs empty
+
+    - minThreadCount, idleTimeout
+        Unset, the pool keeps `threadCount` threads for its whole life
+        Set, the pool starts with this many threads, grows while jobs are left waiting with
+        no idle thread to take them, and lets threads go after `idleTimeout` without work
+
+    - affinity, cpus
+        How to place threads on CPUs, see `ThreadAffinity`
+        An empty `cpus` means every CPU the process may run on
+
+    - spinIterations
+        How many times an idle worker looks for work again, with a `pause` in between, before
+        it parks. A job enqueued meanwhile is picked up without a futex wake or a context
+        switch, at the cost of burning CPU while idle. 0 parks right away
+*/
+struct ThreadPoolConfiguration {
+    int threadCount;
+    size_t queueCapacity = 16384;
+    OverloadPolicy overloadPolicy = OverloadPolicy::REJECT;
+    std::chrono::microseconds queueDelayTarget{0};
+    std::chrono::microseconds queueDelayInterval{100000};
+    std::optional<int> minThreadCount = std::nullopt;
+    std::chrono::milliseconds idleTimeout{10000};
+    ThreadAffinity affinity = ThreadAffinity::NONE;
+    std::vector<int> cpus = {};
+    int spinIterations = 0;
+};
+
+/*
+    Completion state shared by the jobs of a `Future` or `TaskGroup` and whoever waits on them
+    `pending` counts the jobs that haven't finished, `error` keeps the first exception one threw
+*/
+struct TaskState {
+    std::atomic<uint32_t> pending{0};
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    template <typename F>
+    void Run(F& function) {
+        function();
+    }
+
+    void Fail(std::exception_ptr exception) {
+        std::scoped_lock<std::mutex> lock(errorMutex);
+        if (error == nullptr) {
+            error = std::move(exception);
+        }
+    }
+
+    void Finish() {
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            pending.notify_all();
+        }
+    }
+
+    // Hands the first exception over, so it is only rethrown once
+    std::exception_ptr TakeError() {
+        std::scoped_lock<std::mutex> lock(errorMutex);
+        return std::exchange(error, nullptr);
+    }
+};
+
+// A `TaskState` that also keeps what its one job returned
+template <typename T>
+struct FutureState : TaskState {
+    std::optional<std::conditional_t<std::is_void_v<T>, std::monostate, T>> value;
+
+    template <typename F>
+    void Run(F& function) {
+        if constexpr (std::is_void_v<T>) {
+            function();
+            value.emplace();
+        }
+        else {
+            value.emplace(function());
+        }
+    }
+};
+
+/*
+    Wraps a function so its `TaskState` hears about it finishing, throwing, or being dropped by
+    the pool without ever running
+*/
+template <typename F, typename State>
+class TrackedTask {
+private:
+    F m_function;
+    std::shared_ptr<State> m_state;
+
+public:
+    TrackedTask(F&& function, std::shared_ptr<State> state) :
+        m_function(std::move(function)),
+        m_state(std::move(state))
+    {}
+
+    TrackedTask(TrackedTask&&) = default;
+    TrackedTask& operator=(TrackedTask&&) = default;
+
+    ~TrackedTask() {
+        if (m_state != nullptr) {
+            m_state->Fail(std::make_exception_ptr(std::runtime_error("ThreadPool: Task was dropped before it ran")));
+            m_state->Finish();
+        }
+    }
+
+    void operator()() {
+        try {
+            m_state->Run(m_function);
+        }
+        catch (...) {
+            m_state->Fail(std::current_exception());
+        }
+
+        std::shared_ptr<State> state = std::move(m_state);
+        state->Finish();
+    }
+};
+
+template <typename T>
+class Future;
+
+class TaskGroup;
+
+/*
+    Work-stealing thread pool
+
+    Every worker owns a deque; jobs enqueued from inside a job go to the current worker's
+    deque, jobs enqueued from any other thread go to a shared injection queue
+    A worker looks for work in its own deque first, then the injection queue, and then
+    steals from the other workers. None of this takes a lock
+
+    Idle workers park on an atomic counter (a futex on Linux) and are only woken when
+    there is a job for them, optionally after spinning for a while in case one shows up
+
+    A worker's queues are allocated by its own thread when it first runs, after pinning it to
+    its CPUs if asked to, so they land on that thread's NUMA node. With `ThreadAffinity::CORE`
+    each worker also has a small inbox, for jobs that should preferably run on its CPU
+
+    A resizable pool keeps a slot, with its queues, for every thread it may grow to; only the
+    threads come and go. A monitor thread checks on the pool every `monitorInterval`, starts
+    threads when jobs are left waiting, and wakes parked ones now and then so those idle for
+    too long can exit
+
+    Each `JobPriority` has its own shared queue. Workers pick between them by weighted round
+    robin, `laneWeights` picks per round, so higher priorities get most of the picks while
+    lower ones still get a share and can't starve
+
+    The shared queues are bounded; what happens to jobs beyond their capacity is decided by the
+    pool's `OverloadPolicy`. Jobs that are turned away are destroyed without running, so a
+    job that needs to clean up when that happens can do it in its destructor
+
+    Jobs can also be scheduled to run later, or every so often. One timer thread, started with
+    the first of them, sleeps until the earliest is due and hands it to the workers
+
+    Besides fire-and-forget jobs, the pool runs fork-join work: `Submit()` returns a `Future`,
+    `TaskGroup` waits on several jobs at once, and `ParallelFor()` splits a loop across the
+    pool. A pool thread waiting on any of them runs other queued jobs instead of blocking,
+    so handlers can fan out without tying up a thread each or deadlocking a small pool
+*/
 class ThreadPool {
 private:
+    // Jobs in the shared queue remember when they were enqueued, to measure queue delay
+    struct QueuedJob {
+        Job job;
+        int64_t enqueueTimeNs = 0;
+    };
+
+    using InjectionQueue = BoundedMpmcQueue<QueuedJob>;
+
+    struct WorkerQueues {
+        WorkStealingDeque<Job> jobs;
+        std::unique_ptr<InjectionQueue> inbox;
+
+        WorkerQueues(const size_t capacity, const size_t inboxCapacity) :
+            jobs(capacity),
+            inbox(inboxCapacity > 0 ? std::make_unique<InjectionQueue>(inboxCapacity) : nullptr)
+        {}
+    };
+
+    struct alignas(64) Worker {
+        // Null until the worker's thread first runs, owned by the worker from then on
+        std::atomic<WorkerQueues*> queues;
+        std::jthread thread;
+        std::atomic<bool> isActive;
+
+        Worker() :
+            queues(nullptr),
+            thread{},
+            isActive(false)
+        {}
+
+        ~Worker() {
+            delete queues.load(std::memory_order_acquire);
+        }
+    };
+
     int m_threadCount;
     std::atomic<bool> m_isRunning;
 
-    // Container for functions that are considered "jobs"
-    std::queue<std::function<void()>> m_jobs;
+    // Thread count bounds, equal unless the pool is resizable
+    int m_minThreadCount;
+    int64_t m_idleTimeoutNs;
+    int m_spinIterations;
+    alignas(64) std::atomic<int> m_liveThreads;
+    std::jthread m_monitorThread;
+
+    static constexpr size_t priorityCount = 3;
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::array<std::unique_ptr<InjectionQueue>, priorityCount> m_injectionQueues;
+
+    // CPU placement, and which worker is pinned to each CPU for `ThreadAffinity::CORE`
+    ThreadAffinity m_affinity;
+    std::vector<int> m_cpus;
+    std::vector<int> m_cpuWorkers;
 
-    // The main thread pool
-    std::vector<std::jthread> m_threads;
+    OverloadPolicy m_overloadPolicy;
+    std::atomic<uint64_t> m_rejectedJobs;
 
-    // Allows threads to wait on new jobs, or for termination
-    std::condition_variable m_mutexCondition;
+    // Queue delay tracking, see `ThreadPoolConfiguration`
+    int64_t m_queueDelayTargetNs;
+    int64_t m_queueDelayIntervalNs;
+    alignas(64) std::atomic<int64_t> m_aboveTargetSinceNs;
+    std::atomic<bool> m_isOverloaded;
 
-    // Mutex for m_jobs
-    std::mutex m_jobsMutex;
+    // Parked workers wait on `m_wakeEpoch` to change
+    alignas(64) std::atomic<uint32_t> m_wakeEpoch;
+    alignas(64) std::atomic<int> m_parkedWorkers;
 
-    void ThreadLoop();
+    // Workers looking for a job before they park, see `ThreadPoolConfiguration::spinIterations`
+    alignas(64) std::atomic<int> m_spinningWorkers;
+
+    // Producers blocked on a full queue wait on `m_spaceEpoch` to change
+    alignas(64) std::atomic<uint32_t> m_spaceEpoch;
+    alignas(64) std::atomic<int> m_blockedProducers;
 
 public:
+    using TimerClock = std::chrono::steady_clock;
+    using TimerId = uint64_t;
+
+private:
+    struct Timer {
+        Job job;
+        TimerClock::duration interval;
+        JobPriority priority;
+    };
+
+    struct TimerEntry {
+        TimerClock::time_point deadline;
+        TimerId id;
+
+        bool operator>(const TimerEntry& other) const {
+            return deadline > other.deadline;
+        }
+    };
+
+    // Timers by when they are next due; cancelled ones are only removed from `m_timers`
+    std::mutex m_timerMutex;
+    std::condition_variable_any m_timerCondition;
+    std::priority_queue<TimerEntry, std::vector<TimerEntry>, std::greater<>> m_timerQueue;
+    std::unordered_map<TimerId, std::shared_ptr<Timer>> m_timers;
+    TimerId m_nextTimerId;
+    std::jthread m_timerThread;
+
+    void ThreadLoop(const size_t workerIndex);
+    void MonitorLoop(std::stop_token stopToken);
+    void StartWorkers(int count);
+    bool TryRetire();
+    size_t QueuedJobs() const;
+    std::optional<Job> FindJob(const size_t workerIndex);
+    void WakeWorker();
+    void PinCurrentThread(const size_t workerIndex) const;
+    std::optional<Job> PopInjectionQueue(InjectionQueue& queue, const bool isSheddable);
+    void WakeBlockedProducers();
+    void WaitForSpace(const InjectionQueue& queue);
+    void UpdateQueueDelay(const int64_t queueDelayNs, const int64_t nowNs);
+    bool Enqueue(Job& job, const JobPriority priority, const int preferredCpu);
+
+    void TimerLoop(std::stop_token stopToken);
+    TimerId AddTimer(Job& job, const TimerClock::duration delay, const TimerClock::duration interval, const JobPriority priority);
+    void RearmTimer(const TimerId id, const TimerClock::time_point previousDeadline);
+
+    friend class TaskGroup;
+    template <typename State, typename F>
+    void Spawn(const std::shared_ptr<State>& state, F&& function);
+
+public:
+    static constexpr size_t workerQueueCapacity = 1024;
+    static constexpr size_t workerInboxCapacity = 64;
+    static constexpr std::chrono::milliseconds monitorInterval{10};
+
+    // How soon a one-shot timer turned away by a full pool is enqueued again
+    static constexpr std::chrono::milliseconds timerRetryDelay{10};
+
+    // Picks per round of weighted round robin, indexed by `JobPriority`
+    static constexpr std::array<int, priorityCount> laneWeights = {8, 4, 1};
+
     ThreadPool() :
         m_threadCount(-1),
         m_isRunning(false),
-        m_jobs{},
-        m_threads{},
-        m_mutexCondition{},
-        m_jobsMutex{}
+        m_minThreadCount(0),
+        m_idleTimeoutNs(0),
+        m_spinIterations(0),
+        m_liveThreads(0),
+        m_monitorThread{},
+        m_workers{},
+        m_injectionQueues{},
+        m_affinity(ThreadAffinity::NONE),
+        m_cpus{},
+        m_cpuWorkers{},
+        m_overloadPolicy(OverloadPolicy::REJECT),
+        m_rejectedJobs(0),
+        m_queueDelayTargetNs(0),
+        m_queueDelayIntervalNs(0),
+        m_aboveTargetSinceNs(0),
+        m_isOverloaded(false),
+        m_wakeEpoch(0),
+        m_parkedWorkers(0),
+        m_spinningWorkers(0),
+        m_spaceEpoch(0),
+        m_blockedProducers(0),
+        m_timerMutex{},
+        m_timerCondition{},
+        m_timerQueue{},
+        m_timers{},
+        m_nextTimerId(1),
+        m_timerThread{}
     {};
 
-    void InitializeThreadPool(const int threadCount);
+    ~ThreadPool();
+
+    /*
+        @brief Startup the thread pool
+        @param config Configuration, see `ThreadPoolConfiguration`
+    */
+    void InitializeThreadPool(const ThreadPoolConfiguration& config);
+
+    /*
+        @brief Enqueue a job
+        @param function The function to execute, of signature `void ()`
+        It is moved into the pool, never copied, and stored without allocating if its
+        captures fit in `Job::inlineSize` bytes
+        @param priority Which shared queue the job goes in. Jobs enqueued from inside a job
+        stay on that worker's deque, and run before it picks anything new
+        @param preferredCpu With `ThreadAffinity::CORE`, queue a `NORMAL` job for the worker
+        pinned to this CPU if it has room. Any idle worker may still take it
+
+        @return `true` if enqueued, `false` if the pool is full, overloaded, or not running
+        With `OverloadPolicy::BLOCK` this waits for room instead, unless called from inside
+        a job, where waiting could deadlock the pool
+    */
+    template <typename F>
+    bool EnqueueJob(F&& function, const JobPriority priority = JobPriority::NORMAL, const int preferredCpu = -1) {
+        Job job(std::forward<F>(function));
+        return Enqueue(job, priority, preferredCpu);
+    }
+
+    /*
+        @brief Run a job once, after a delay
+        @param delay How long from now
+        @param function The function to execute, of signature `void ()`
+        @param priority Priority it is enqueued with once due, if the pool turns it away it
+               is retried every `timerRetryDelay` until it gets in or is cancelled
+
+        @return Id to cancel the timer with, 0 if the pool isn't running
+    */
+    template <typename F>
+    TimerId Schedule(const TimerClock::duration delay, F&& function, const JobPriority priority = JobPriority::NORMAL) {
+        Job job(std::forward<F>(function));
+        return AddTimer(job, delay, TimerClock::duration::zero(), priority);
+    }
+
+    /*
+        @brief Run a job every `interval`, starting one interval from now
+        @param interval Time between runs, more than 0
+        @param function The function to execute, of signature `void ()`
+        @param priority Priority it is enqueued with once due
+
+        @return Id to cancel the timer with, 0 if the pool isn't running or the interval is 0
+
+        @note Runs never overlap: the next one is only due once the last has finished, and
+        runs missed meanwhile are skipped rather than bunched up
+    */
+    template <typename F>
+    TimerId Every(const TimerClock::duration interval, F&& function, const JobPriority priority = JobPriority::NORMAL) {
+        if (interval <= TimerClock::duration::zero()) {
+            return 0;
+        }
+
+        Job job(std::forward<F>(function));
+        return AddTimer(job, interval, interval, priority);
+    }
+
+    /*
+        @brief Cancel a timer. A run that has already started still finishes
+        @param id Id returned by `Schedule()` or `Every()`
+
+        @return `true` if the timer was pending, `false` if it had already run or was cancelled
+    */
+    bool Cancel(const TimerId id);
+
+    /*
+        @brief Run a function on the pool, and get a handle to its result
+        @param function The function to execute, of signature `T ()`
+
+        @return A future for the result. If the pool turns the job away, it has already run
+        on the calling thread by the time this returns
+    */
+    template <typename F>
+    Future<std::invoke_result_t<std::decay_t<F>&>> Submit(F&& function);
+
+    /*
+        @brief Run `body(i)` for every `i` in [begin, end), split into chunks across the pool
+        @param begin First index
+        @param end One past the last index
+        @param body The function to execute, of signature `void (size_t)`
+        @param grainSize Indices per chunk, 0 to pick one that gives each thread a few chunks
+
+        @note The calling thread runs a chunk too, and returns once every chunk has run
+        Rethrows the first exception thrown by `body`
+    */
+    template <typename F>
+    void ParallelFor(const size_t begin, const size_t end, F&& body, size_t grainSize = 0);
+
+    /*
+        @brief Wait until every job of a task has finished
+        @param state The task's state
+        A pool thread runs other queued jobs meanwhile, any other thread just blocks
+    */
+    void Wait(const TaskState& state);
+
+    /*
+        @brief The pool the calling thread belongs to, ex: to fan out from a handler
+        @return The pool, or `nullptr` if not called from a pool thread
+    */
+    static ThreadPool* Current();
 
-    void EnqueueJob(const std::function<void()>& job);
     bool IsBusy();
 
+    /*
+        @brief Number of threads currently in the pool
+    */
+    int ThreadCount() const;
+
+    /*
+        @brief Number of threads that could pick up a job right now, parked or spinning ones and
+        ones that may still be started
+    */
+    int AvailableThreads() const;
+
+    /*
+        @brief Number of jobs turned away or dropped because the queue was full
+    */
+    uint64_t RejectedJobs() const;
+
+    /*
+        @brief Check whether queue delay has stayed above its target, see `ThreadPoolConfiguration`
+    */
+    bool IsOverloaded() const;
+
     void Stop();
-};
\ No newline at end of file
+
+    /*
+        @brief Parse a list of CPUs in the format `taskset -c` takes, ex: "0-3,8"
+        @param cpuList List to parse, empty for every CPU the process may run on
+
+        @return The CPUs, or `std::nullopt` if the list is malformed
+    */
+    static std::optional<std::vector<int>> ParseCpuList(const std::string_view cpuList);
+};
+
+
+/*
+    Handle to the result of a job run with `ThreadPool::Submit()`
+*/
+template <typename T>
+class Future {
+private:
+    ThreadPool* m_pool;
+    std::shared_ptr<FutureState<T>> m_state;
+
+public:
+    Future(ThreadPool* pool, std::shared_ptr<FutureState<T>> state) :
+        m_pool(pool),
+        m_state(std::move(state))
+    {}
+
+    bool IsReady() const {
+        return m_state->pending.load(std::memory_order_acquire) == 0;
+    }
+
+    /*
+        @brief Wait for the job, see `ThreadPool::Wait()`
+    */
+    void Wait() const {
+        m_pool->Wait(*m_state);
+        return;
+    }
+
+    /*
+        @brief Wait for the job, and take its result
+        @return What the job returned. Rethrows if it threw, or was dropped without running
+    */
+    T Get() {
+        Wait();
+
+        if (std::exception_ptr error = m_state->TakeError()) {
+            std::rethrow_exception(error);
+        }
+
+        if constexpr (std::is_void_v<T> == false) {
+            return std::move(m_state->value.value());
+        }
+    }
+};
+
+
+/*
+    A set of jobs to wait on together
+    The destructor waits for any jobs still running, `Wait()` also rethrows the first exception
+*/
+class TaskGroup {
+private:
+    ThreadPool& m_pool;
+    std::shared_ptr<TaskState> m_state;
+
+public:
+    explicit TaskGroup(ThreadPool& pool) :
+        m_pool(pool),
+        m_state(std::make_shared<TaskState>())
+    {}
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    ~TaskGroup() {
+        m_pool.Wait(*m_state);
+    }
+
+    /*
+        @brief Run a function on the pool as part of this group
+        @param function The function to execute, of signature `void ()`
+    */
+    template <typename F>
+    void Run(F&& function) {
+        m_pool.Spawn(m_state, std::forward<F>(function));
+        return;
+    }
+
+    /*
+        @brief Wait for every job run so far, see `ThreadPool::Wait()`
+        Rethrows the first exception thrown by one of them
+    */
+    void Wait() {
+        m_pool.Wait(*m_state);
+
+        if (std::exception_ptr error = m_state->TakeError()) {
+            std::rethrow_exception(error);
+        }
+
+        return;
+    }
+};
+
+
+/*
+    @brief Enqueue a job that reports to `state`, running it right here if the pool turns it away
+    @param state State of the task the job belongs to
+    @param function The function to execute
+*/
+template <typename State, typename F>
+void ThreadPool::Spawn(const std::shared_ptr<State>& state, F&& function) {
+
+    state->pending.fetch_add(1, std::memory_order_relaxed);
+
+    Job job(TrackedTask<std::decay_t<F>, State>(std::forward<F>(function), state));
+    if (Enqueue(job, JobPriority::NORMAL, -1) == false) {
+        job();
+    }
+
+    return;
+}
+
+
+template <typename F>
+Future<std::invoke_result_t<std::decay_t<F>&>> ThreadPool::Submit(F&& function) {
+
+    using T = std::invoke_result_t<std::decay_t<F>&>;
+
+    std::shared_ptr<FutureState<T>> state = std::make_shared<FutureState<T>>();
+    Spawn(state, std::forward<F>(function));
+
+    return Future<T>(this, std::move(state));
+}
+
+
+template <typename F>
+void ThreadPool::ParallelFor(const size_t begin, const size_t end, F&& body, size_t grainSize) {
+
+    if (begin >= end) {
+        return;
+    }
+
+    if (grainSize == 0) {
+        grainSize = std::max<size_t>((end - begin) / (std::max(m_threadCount, 1) * 4), 1);
+    }
+
+    TaskGroup group(*this);
+
+    size_t chunkBegin = begin;
+    for (; end - chunkBegin > grainSize; chunkBegin += grainSize) {
+        group.Run([&body, chunkBegin, chunkEnd = chunkBegin + grainSize] () {
+            for (size_t i = chunkBegin; i < chunkEnd; i++) {
+                body(i);
+            }
+        });
+    }
+
+    // The last chunk runs here, while the rest are picked up
+    for (size_t i = chunkBegin; i < end; i++) {
+        body(i);
+    }
+
+    group.Wait();
+    return;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+/*
+    Hashed timing wheel, for many timeouts that are mostly cancelled or pushed back before they
+    expire, ex: one per connection
+
+    Time is cut into ticks, and each slot of the wheel holds the timers expiring on one tick
+    Timeouts longer than a whole turn of the wheel wait out the extra turns in their slot
+    Arming, rearming and cancelling a timer are O(1): it is linked into or out of its slot, and
+    never allocates
+
+    One thread turns the wheel, and sleeps for as long as no timer is armed
+*/
+class TimingWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /*
+        A timeout that can be armed on a wheel, owned by whoever needs it
+        `onExpire` runs on the wheel's thread with the wheel locked, so it must be short and
+        must not touch the wheel. Destroying the timer cancels it, and waits out an `onExpire`
+        that is already running
+    */
+    class Timer {
+    private:
+        friend class TimingWheel;
+
+        TimingWheel& m_wheel;
+        std::function<void ()> m_onExpire;
+
+        // Links within its slot, only touched with the wheel locked
+        Timer* m_previous;
+        Timer* m_next;
+        size_t m_slot;
+        size_t m_rounds;
+        bool m_isArmed;
+
+    public:
+        Timer(TimingWheel& wheel, std::function<void ()> onExpire) :
+            m_wheel(wheel),
+            m_onExpire(std::move(onExpire)),
+            m_previous(nullptr),
+            m_next(nullptr),
+            m_slot(0),
+            m_rounds(0),
+            m_isArmed(false)
+        {}
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        ~Timer() {
+            m_wheel.Cancel(*this);
+        }
+
+        /*
+            @brief Expire after `timeout`, instead of whenever it was due before
+        */
+        void Arm(const Clock::duration timeout) {
+            m_wheel.Arm(*this, timeout);
+        }
+
+        void Cancel() {
+            m_wheel.Cancel(*this);
+        }
+    };
+
+private:
+    const Clock::duration m_tick;
+
+    std::mutex m_mutex;
+    std::condition_variable_any m_timerArmed;
+
+    // Each slot is the head of a list of timers
+    std::vector<Timer*> m_slots;
+    size_t m_currentSlot;
+    size_t m_armedCount;
+    Clock::time_point m_nextTick;
+
+    std::jthread m_thread;
+
+    void Link(Timer& timer, const size_t ticks);
+    void Unlink(Timer& timer);
+    void Run(std::stop_token stopToken);
+
+public:
+    /*
+        @param tick Resolution of the wheel, timers expire up to one tick late, never early
+        @param slotCount Ticks in one turn of the wheel
+    */
+    TimingWheel(const Clock::duration tick, const size_t slotCount);
+    ~TimingWheel();
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    /*
+        @brief Arm a timer, or push it back if it is already armed
+        @param timer The timer
+        @param timeout Time from now until it expires
+    */
+    void Arm(Timer& timer, const Clock::duration timeout);
+
+    /*
+        @brief Disarm a timer, if it is armed
+        @param timer The timer
+    */
+    void Cancel(Timer& timer);
+};
@@ -33,6 +33,48 @@ enum class RequestLoggingVerbosity {
     FULL
 };
 
+/*
+    What to do with a new connection when the queue of connections waiting for a thread is full
+
+    1. REJECT
+        Answer it with "503 Service Unavailable" and a "Retry-After" header, and close it
+
+    2. BLOCK
+        Stop accepting until there is room in the queue, new connections wait in the
+        kernel's listen backlog instead
+
+    3. DROP_OLDEST
+        Answer the connection that has waited the longest with a 503 instead, and queue the
+        new one; its client has most likely given up already
+*/
+enum class OverloadPolicy {
+    REJECT,
+    BLOCK,
+    DROP_OLDEST
+};
+
+/*
+    How the threads of a pool are placed on CPUs
+
+    1. NONE
+        Left to the scheduler
+
+    2. CORE
+        Each thread is pinned to one CPU of the list, round robin
+        Connections are queued for the thread pinned to the CPU their packets arrived on, when
+        it has room (see `SO_INCOMING_CPU`), so request buffers stay on the NIC queue's core
+
+    3. CORE_SET
+        Every thread may run on any CPU of the list, ex: the CPUs of one NUMA node
+
+    Pinned threads allocate their queues themselves, so the memory is local to their NUMA node
+*/
+enum class ThreadAffinity {
+    NONE,
+    CORE,
+    CORE_SET
+};
+
 /*
     Configuration object for the HTTP server
     - port
@@ -53,6 +95,82 @@ enum class RequestLoggingVerbosity {
         https://en.wikipedia.org/wiki/List_of_tz_database_time_zones
 
         Check "TZ Identifier" column in the wikipedia link to get your timezone
+
+    - corsAllowedOrigin
+        Origin allowed to make cross-origin requests, ex: "https://example.com", or "*" for any
+        When set, CORS preflight (OPTIONS) requests are answered automatically for every route
+        Left empty, no CORS headers are sent
+
+    - corsMaxAgeSeconds
+        How long browsers may cache a preflight response
+
+    - maxQueuedConnections
+        How many accepted connections may wait for a free thread, rounded up to a power of two
+
+    - overloadPolicy
+        What to do with connections beyond `maxQueuedConnections`, see `OverloadPolicy`
+
+    - retryAfterSeconds
+        Value of the "Retry-After" header sent with 503 responses when overloaded
+
+    - queueDelayTargetMs, queueDelayIntervalMs
+        Queue delay based admission control (CoDel), 0 to disable
+        If every connection picked up during `queueDelayIntervalMs` had waited longer than
+        `queueDelayTargetMs` for a thread, the server is overloaded, and sheds new connections
+        with a 503 until the queue drains
+
+    - maxConcurrentRequests, minConcurrentRequests
+        Bounds for how many requests may run their handlers at the same time, 0 for no limit
+        Unlike `maxConnections`, this doesn't change the number of threads
+
+    - concurrencyLatencyTargetMs
+        Handler latency to aim for: the limit is raised while requests finish within it, and cut
+        when they don't (AIMD). 0 keeps the limit fixed at `maxConcurrentRequests`
+
+    - concurrencyQueueTimeoutMs
+        How long a request may wait for a slot when the limit is reached, before it is answered
+        with a 503
+
+    - minThreads, threadIdleTimeoutMs
+        Let the pool of `maxConnections` threads shrink to `minThreads` while idle: it grows
+        again while connections wait with no idle thread to take them, and threads without a
+        connection for `threadIdleTimeoutMs` exit. 0 keeps all `maxConnections` threads running
+
+    - threadAffinity, cpuList
+        How to place the `maxConnections` threads on CPUs, see `ThreadAffinity`
+        `cpuList` takes the same format as `taskset -c`, ex: "0-15,32-47"; left empty, every
+        CPU the process may run on is used
+
+    - computeThreads
+        Size of a separate pool for handlers of routes added with `HandlerExecution::OFFLOAD`,
+        while the `maxConnections` threads only read requests and write responses
+        0 runs every handler on the connection's own thread
+
+    - workerSpinIterations
+        How many times an idle thread looks for a connection again, pausing in between, before
+        it goes to sleep. Trades CPU for faster handoff, 0 sleeps right away
+
+    - headerTimeoutMs, bodyTimeoutMs
+        How long a client may take to send a request's start line and headers, counted from
+        its first byte (or from being accepted, for a new connection), and then its body
+        A client trickling in bytes can't hold on to a thread past these, 0 for no limit
+
+    - keepAliveTimeoutMs
+        How long a kept-alive connection may sit idle waiting for its next request, 0 for no limit
+
+    - requestTimeoutMs
+        How long a request may take from its first byte until its response is sent, handler
+        included, 0 for no limit. Offloaded handlers are not covered, async ones are answered
+        with a 504 once they have been parked for this long
+
+    - maxRequestsPerConnection
+        How many requests a kept-alive connection may send before the server closes it, 0 for
+        no limit. When every thread is taken, the connection idle the longest is closed to
+        make room for a new one
+
+    - busyPollMicroseconds
+        `SO_BUSY_POLL` for client sockets: how long a read busy-polls the NIC queue before
+        sleeping, 0 to disable. Values above `net.core.busy_read` need `CAP_NET_ADMIN`
 */
 struct HttpServerConfiguration {
     int port;
@@ -60,4 +178,27 @@ struct HttpServerConfiguration {
     int inputPollingIntevalMs;
     RequestLoggingVerbosity requestLoggingVerbosity;
     std::string_view timeZone;
+    std::string_view corsAllowedOrigin = {};
+    int corsMaxAgeSeconds = 600;
+    int maxQueuedConnections = 1024;
+    OverloadPolicy overloadPolicy = OverloadPolicy::REJECT;
+    int retryAfterSeconds = 1;
+    int queueDelayTargetMs = 0;
+    int queueDelayIntervalMs = 100;
+    int maxConcurrentRequests = 0;
+    int minConcurrentRequests = 1;
+    int concurrencyLatencyTargetMs = 0;
+    int concurrencyQueueTimeoutMs = 0;
+    int computeThreads = 0;
+    int minThreads = 0;
+    int threadIdleTimeoutMs = 10000;
+    ThreadAffinity threadAffinity = ThreadAffinity::NONE;
+    std::string_view cpuList = {};
+    int workerSpinIterations = 0;
+    int busyPollMicroseconds = 0;
+    int headerTimeoutMs = 10000;
+    int bodyTimeoutMs = 30000;
+    int keepAliveTimeoutMs = 10000;
+    int requestTimeoutMs = 0;
+    int maxRequestsPerConnection = 1000;
 };
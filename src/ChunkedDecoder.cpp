@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <utility>
+
+#include "knots/ChunkedDecoder.hpp"
+
+ChunkedDecoder::ChunkedDecoder(const size_t maxBodySize, const size_t maxTrailerSize) :
+    m_maxBodySize(maxBodySize),
+    m_maxTrailerSize(maxTrailerSize),
+    m_state(State::SIZE),
+    m_status(Status::INCOMPLETE),
+    m_chunkSize(0),
+    m_lineLength(0),
+    m_trailerSize(0),
+    m_bodySize(0)
+{}
+
+
+/*
+    @brief Decode the next piece of the body
+    @param input Bytes following the ones fed before
+
+    @return How many bytes of `input` belong to the body, all of them unless it completed
+    or failed within `input`. Anything after the body is left alone, ex: a pipelined request
+*/
+size_t ChunkedDecoder::Feed(const std::string_view input) {
+
+    size_t position = 0;
+
+    while (position < input.size() && m_status == Status::INCOMPLETE) {
+        const char c = input[position];
+
+        switch (m_state) {
+            case State::SIZE:
+            case State::EXTENSION:
+                ParseSize(c);
+                position++;
+                break;
+
+            case State::SIZE_LF:
+                if (c != '\n') {
+                    m_status = Status::MALFORMED;
+                    break;
+                }
+                // The last chunk has size 0, the trailers follow it
+                m_state = (m_chunkSize == 0) ? State::TRAILER : State::DATA;
+                m_lineLength = 0;
+                position++;
+                break;
+
+            case State::DATA: {
+                // Copied in one go, not byte by byte
+                const size_t length = std::min(m_chunkSize, input.size() - position);
+                m_body.append(input.substr(position, length));
+                m_bodySize += length;
+                m_chunkSize -= length;
+                position += length;
+
+                if (m_chunkSize == 0) {
+                    m_state = State::DATA_CR;
+                }
+                break;
+            }
+
+            case State::DATA_CR:
+                if (c != '\r') {
+                    m_status = Status::MALFORMED;
+                    break;
+                }
+                m_state = State::DATA_LF;
+                position++;
+                break;
+
+            case State::DATA_LF:
+                if (c != '\n') {
+                    m_status = Status::MALFORMED;
+                    break;
+                }
+                m_state = State::SIZE;
+                position++;
+                break;
+
+            case State::TRAILER:
+                ParseTrailer(c);
+                position++;
+                break;
+        }
+    }
+
+    return position;
+}
+
+
+/*
+    @brief Take the next byte of a chunk size line, "1a;name=value\r"
+    @param c The byte
+*/
+void ChunkedDecoder::ParseSize(const char c) {
+
+    m_lineLength++;
+    if (m_lineLength > maxSizeLineLength) {
+        m_status = Status::MALFORMED;
+        return;
+    }
+
+    if (c == '\r') {
+        // At least one digit
+        m_status = (m_lineLength > 1) ? Status::INCOMPLETE : Status::MALFORMED;
+        m_state = State::SIZE_LF;
+        return;
+    }
+
+    // Extensions aren't used, only skipped
+    if (m_state == State::EXTENSION) {
+        return;
+    }
+
+    if (c == ';' || c == ' ' || c == '\t') {
+        m_status = (m_lineLength > 1) ? Status::INCOMPLETE : Status::MALFORMED;
+        m_state = State::EXTENSION;
+        return;
+    }
+
+    size_t digit;
+    if (c >= '0' && c <= '9') {
+        digit = c - '0';
+    }
+    else if (c >= 'a' && c <= 'f') {
+        digit = c - 'a' + 10;
+    }
+    else if (c >= 'A' && c <= 'F') {
+        digit = c - 'A' + 10;
+    }
+    else {
+        m_status = Status::MALFORMED;
+        return;
+    }
+
+    // Checked before it can overflow, and against what is left of the body limit
+    const size_t bodyRemaining = m_maxBodySize - m_bodySize;
+    if (m_chunkSize > bodyRemaining / 16 || m_chunkSize * 16 + digit > bodyRemaining) {
+        m_status = Status::BODY_TOO_LARGE;
+        return;
+    }
+
+    m_chunkSize = m_chunkSize * 16 + digit;
+    return;
+}
+
+
+/*
+    @brief Take the next byte of the trailer section, header lines ending with an empty line
+    @param c The byte
+*/
+void ChunkedDecoder::ParseTrailer(const char c) {
+
+    m_trailerSize++;
+    if (m_trailerSize > m_maxTrailerSize) {
+        m_status = Status::TRAILERS_TOO_LARGE;
+        return;
+    }
+
+    if (c != '\n') {
+        m_line.push_back(c);
+        return;
+    }
+
+    if (m_line.empty() || m_line.back() != '\r') {
+        m_status = Status::MALFORMED;
+        return;
+    }
+    m_line.pop_back();
+
+    // An empty line ends the trailers, and the body
+    if (m_line.empty()) {
+        m_status = Status::COMPLETE;
+        return;
+    }
+
+    const size_t colonPos = m_line.find(':');
+    if (colonPos == 0 || colonPos == std::string::npos) {
+        m_status = Status::MALFORMED;
+        return;
+    }
+
+    const size_t valueStart = m_line.find_first_not_of(" \t", colonPos + 1);
+    const size_t valueEnd = m_line.find_last_not_of(" \t");
+    std::string value = (valueStart == std::string::npos)
+        ? std::string()
+        : m_line.substr(valueStart, valueEnd - valueStart + 1);
+
+    m_trailers[m_line.substr(0, colonPos)] = std::move(value);
+    m_line.clear();
+
+    return;
+}
+
+
+bool ChunkedDecoder::IsChunked(const std::string_view transferEncoding) {
+
+    const size_t first = transferEncoding.find_first_not_of(" \t");
+    if (first == std::string_view::npos) {
+        return false;
+    }
+
+    const std::string_view coding = transferEncoding.substr(
+        first, transferEncoding.find_last_not_of(" \t") - first + 1
+    );
+    return CaseInsensitiveEqual{}(std::string(coding), "chunked");
+}
+
+ChunkedDecoder::Status ChunkedDecoder::GetStatus() const {
+    return m_status;
+}
+
+const std::string& ChunkedDecoder::Body() const {
+    return m_body;
+}
+
+std::string ChunkedDecoder::TakeBody() {
+    return std::exchange(m_body, std::string());
+}
+
+const Headers& ChunkedDecoder::Trailers() const {
+    return m_trailers;
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+
+#include "knots/ConcurrencyLimiter.hpp"
+
+ConcurrencyLimiter::ConcurrencyLimiter(
+    const int minLimit,
+    const int maxLimit,
+    const Clock::duration latencyTarget,
+    const int maxWaiting
+) :
+    m_minLimit(std::max(minLimit, 1)),
+    m_maxLimit(std::max(maxLimit, m_minLimit)),
+    m_latencyTarget(latencyTarget),
+    m_maxWaiting(maxWaiting),
+    m_limit(m_maxLimit),
+    m_inFlight(0),
+    m_waiting(0),
+    m_lastDecreaseTime{},
+    m_rejected(0)
+{}
+
+
+/*
+    @brief Take a slot, waiting up to `maxWait` for one if all are taken
+    @param maxWait How long to wait, zero to not wait at all
+
+    @return A permit holding the slot, or an empty permit if none freed up in time, or
+    too many requests were waiting already
+*/
+ConcurrencyLimiter::Permit ConcurrencyLimiter::Acquire(const Clock::duration maxWait) {
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    const auto hasFreeSlot = [this] () {
+        return m_inFlight < static_cast<int>(m_limit);
+    };
+
+    if (hasFreeSlot() == false) {
+        if (maxWait <= Clock::duration::zero() || m_waiting >= m_maxWaiting) {
+            m_rejected++;
+            return Permit();
+        }
+
+        m_waiting++;
+        const bool isSlotFree = m_slotFreed.wait_for(lock, maxWait, hasFreeSlot);
+        m_waiting--;
+
+        if (isSlotFree == false) {
+            m_rejected++;
+            return Permit();
+        }
+    }
+
+    m_inFlight++;
+    return Permit(this, Clock::now());
+}
+
+
+/*
+    @brief Hand a slot back, and adjust the limit by how long it was held
+    @param startTime When the slot was taken
+    @param endTime When the request finished
+*/
+void ConcurrencyLimiter::Release(const Clock::time_point startTime, const Clock::time_point endTime) {
+
+    {
+        std::scoped_lock<std::mutex> lock(m_mutex);
+
+        // Only count as using the limit if the request was competing for it
+        const bool isLimitInUse = m_inFlight * 2 >= static_cast<int>(m_limit);
+        m_inFlight--;
+
+        if (m_latencyTarget > Clock::duration::zero()) {
+            if (endTime - startTime > m_latencyTarget) {
+                // Requests admitted under the old limit don't get to cut it again
+                if (startTime >= m_lastDecreaseTime) {
+                    m_limit = std::max(m_limit * decreaseFactor, static_cast<double>(m_minLimit));
+                    m_lastDecreaseTime = endTime;
+                }
+            }
+            else if (isLimitInUse) {
+                m_limit = std::min(m_limit + 1.0 / m_limit, static_cast<double>(m_maxLimit));
+            }
+        }
+    }
+
+    m_slotFreed.notify_one();
+    return;
+}
+
+
+int ConcurrencyLimiter::Limit() const {
+    std::scoped_lock<std::mutex> lock(m_mutex);
+    return static_cast<int>(m_limit);
+}
+
+int ConcurrencyLimiter::InFlight() const {
+    std::scoped_lock<std::mutex> lock(m_mutex);
+    return m_inFlight;
+}
+
+uint64_t ConcurrencyLimiter::RejectedCount() const {
+    std::scoped_lock<std::mutex> lock(m_mutex);
+    return m_rejected;
+}
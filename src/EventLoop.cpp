@@ -0,0 +1,234 @@
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "knots/EventLoop.hpp"
+#include "knots/utils/Log.hpp"
+
+EventLoop::EventLoop() :
+    m_epollFD(epoll_create1(EPOLL_CLOEXEC)),
+    m_wakeupFD(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    m_isRunning(true) {
+
+    if (m_epollFD < 0 || m_wakeupFD < 0) {
+        const std::string error = strerror(errno);
+        close(m_epollFD);
+        close(m_wakeupFD);
+        throw std::runtime_error(Log::MakeErrorMessage(std::format(
+            "EventLoop: Failed to create epoll instance: {}",
+            error
+        )));
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = m_wakeupFD;
+    epoll_ctl(m_epollFD, EPOLL_CTL_ADD, m_wakeupFD, &event);
+
+    m_thread = std::jthread([this] (std::stop_token stopToken) {
+        Run(stopToken);
+    });
+}
+
+EventLoop::~EventLoop() {
+    Stop();
+    m_thread = std::jthread();
+    close(m_wakeupFD);
+    close(m_epollFD);
+}
+
+
+/*
+    @brief Call `onReady` once the socket is ready for `events`, or has an error or hung up
+    @param socketFD The socket, one watch at a time per socket
+    @param events EPOLLIN, EPOLLOUT, or both
+    @param onReady Callback, gets the events that fired
+
+    @return `false` if the loop is stopped or the socket is already watched, `onReady`
+    is then never called
+*/
+bool EventLoop::WatchSocket(const int socketFD, const uint32_t events, Callback onReady) {
+
+    std::scoped_lock<std::mutex> lock(m_mutex);
+
+    if (m_isRunning == false || m_watchedSockets.contains(socketFD)) {
+        return false;
+    }
+
+    // Registered while locked, so the loop can't see it fire before its callback is stored
+    epoll_event event{};
+    event.events = events | EPOLLONESHOT;
+    event.data.fd = socketFD;
+    if (epoll_ctl(m_epollFD, EPOLL_CTL_ADD, socketFD, &event) < 0) {
+        Log::Error(std::format(
+            "EventLoop::WatchSocket(): Failed to watch socket {}: {}",
+            socketFD,
+            strerror(errno)
+        ));
+        return false;
+    }
+
+    m_watchedSockets.emplace(socketFD, std::move(onReady));
+    return true;
+}
+
+
+/*
+    @brief Call `onExpire` once `deadline` passes
+    @param deadline When
+    @param onExpire Callback
+
+    @return `false` if the loop is stopped, `onExpire` is then never called
+*/
+bool EventLoop::AddTimer(const Clock::time_point deadline, Callback onExpire) {
+
+    std::scoped_lock<std::mutex> lock(m_mutex);
+
+    if (m_isRunning == false) {
+        return false;
+    }
+
+    // The loop only has to wake up early if this is now the nearest timer
+    const auto timer = m_timers.emplace(deadline, std::move(onExpire));
+    if (timer == m_timers.begin()) {
+        Wakeup();
+    }
+
+    return true;
+}
+
+
+/*
+    @brief Stop the loop, calling back everything still waiting with 0, ex: on shutdown
+    May be called from a callback
+*/
+void EventLoop::Stop() {
+
+    std::vector<Callback> cancelled;
+
+    {
+        std::scoped_lock<std::mutex> lock(m_mutex);
+
+        if (m_isRunning == false) {
+            return;
+        }
+        m_isRunning = false;
+
+        for (auto& [socketFD, onReady] : m_watchedSockets) {
+            epoll_ctl(m_epollFD, EPOLL_CTL_DEL, socketFD, nullptr);
+            cancelled.push_back(std::move(onReady));
+        }
+        m_watchedSockets.clear();
+
+        for (auto& [deadline, onExpire] : m_timers) {
+            cancelled.push_back(std::move(onExpire));
+        }
+        m_timers.clear();
+    }
+
+    m_thread.request_stop();
+    Wakeup();
+
+    // Stopped from one of its own callbacks, the loop is left to finish on its own
+    if (std::this_thread::get_id() != m_thread.get_id()) {
+        m_thread = std::jthread();
+    }
+
+    for (Callback& callback : cancelled) {
+        callback(0);
+    }
+
+    return;
+}
+
+
+/*
+    @brief Interrupt the loop's epoll_wait()
+*/
+void EventLoop::Wakeup() {
+
+    const uint64_t one = 1;
+    [[maybe_unused]] const ssize_t bytesWritten = write(m_wakeupFD, &one, sizeof(one));
+
+    return;
+}
+
+
+/*
+    @brief Wait for sockets and timers, and call back whatever is ready, until stopped
+    @param stopToken Requested by `Stop()`
+*/
+void EventLoop::Run(std::stop_token stopToken) {
+
+    constexpr int maxEvents = 64;
+    epoll_event events[maxEvents];
+
+    std::vector<std::pair<Callback, uint32_t>> ready;
+
+    while (stopToken.stop_requested() == false) {
+
+        // Sleep until the nearest timer, or until woken up if there is none
+        int timeoutMs = -1;
+        {
+            std::scoped_lock<std::mutex> lock(m_mutex);
+            if (m_timers.empty() == false) {
+                const auto untilNearest = std::chrono::ceil<std::chrono::milliseconds>(
+                    m_timers.begin()->first - Clock::now()
+                );
+                timeoutMs = static_cast<int>(std::max<int64_t>(untilNearest.count(), 0));
+            }
+        }
+
+        const int eventCount = epoll_wait(m_epollFD, events, maxEvents, timeoutMs);
+        if (eventCount < 0 && errno != EINTR) {
+            Log::Error(std::format(
+                "EventLoop::Run(): epoll_wait() failed: {}",
+                strerror(errno)
+            ));
+        }
+
+        {
+            std::scoped_lock<std::mutex> lock(m_mutex);
+
+            for (int i = 0; i < eventCount; i++) {
+                const int fd = events[i].data.fd;
+
+                if (fd == m_wakeupFD) {
+                    uint64_t count;
+                    [[maybe_unused]] const ssize_t bytesRead = read(m_wakeupFD, &count, sizeof(count));
+                    continue;
+                }
+
+                // One-shot, the socket can be watched again from its callback
+                const auto watch = m_watchedSockets.find(fd);
+                if (watch == m_watchedSockets.end()) {
+                    continue;
+                }
+                epoll_ctl(m_epollFD, EPOLL_CTL_DEL, fd, nullptr);
+                const uint32_t firedEvents = events[i].events;
+                ready.emplace_back(std::move(watch->second), firedEvents);
+                m_watchedSockets.erase(watch);
+            }
+
+            const Clock::time_point now = Clock::now();
+            while (m_timers.empty() == false && m_timers.begin()->first <= now) {
+                ready.emplace_back(std::move(m_timers.begin()->second), 0);
+                m_timers.erase(m_timers.begin());
+            }
+        }
+
+        // Called unlocked, so callbacks may watch sockets or add timers
+        for (auto& [callback, firedEvents] : ready) {
+            callback(firedEvents);
+        }
+        ready.clear();
+    }
+
+    return;
+}
@@ -1,7 +1,10 @@
+#include <algorithm>
+#include <charconv>
 #include <iostream>
 #include <map>
 #include <sstream>
 
+#include "knots/ChunkedDecoder.hpp"
 #include "knots/HttpMessage.hpp"
 #include "knots/utils/Log.hpp"
 
@@ -239,6 +242,17 @@ bool ParseHeaders(std::stringstream& ss, HttpRequest& req) {
         const std::string name  = line.substr(0, colonPos);
         const std::string value = line.substr(colonPos + 2);
 
+        // Repeated lengths that disagree leave the end of the body ambiguous
+        const auto existing = req.headers.find(name);
+        if (existing != req.headers.end() && existing->second != value &&
+            CaseInsensitiveEqual{}(name, "Content-Length")) {
+            Log::Error(std::format(
+                "ParseHeaders(): Conflicting {} values",
+                name
+            ));
+            return false;
+        }
+
         // HTTP Headers are case-insensitive
         req.headers[name] = value;
     }
@@ -247,6 +261,54 @@ bool ParseHeaders(std::stringstream& ss, HttpRequest& req) {
 }
 
 
+/*
+    @brief Parse a body sent with `Transfer-Encoding: chunked`, trailer fields go into
+    `req.trailers`
+    @param ss Message in stringstream format
+    @param req The HttpRequest structure
+*/
+bool ParseChunkedBody(std::stringstream& ss, HttpRequest& req) {
+
+    // Chunked is the only transfer coding understood, and with it the length is in the body
+    if (ChunkedDecoder::IsChunked(req.GetHeader("Transfer-Encoding").value()) == false) {
+        Log::Error(std::format(
+            "ParseChunkedBody(): Unsupported transfer coding \"{}\"",
+            req.GetHeader("Transfer-Encoding").value()
+        ));
+        return false;
+    }
+
+    if (req.GetHeader("Content-Length").has_value()) {
+        Log::Error(
+            "ParseChunkedBody(): Both Content-Length and Transfer-Encoding are set"
+        );
+        return false;
+    }
+
+    // Rest of the stream, whatever follows the body is left in it
+    const std::streampos bodyStart = ss.tellg();
+    const std::string_view remaining = ss.view().substr(static_cast<size_t>(bodyStart));
+
+    ChunkedDecoder decoder;
+    const size_t bodySize = decoder.Feed(remaining);
+
+    if (decoder.GetStatus() != ChunkedDecoder::Status::COMPLETE) {
+        Log::Error(std::format(
+            "ParseChunkedBody(): Malformed or incomplete chunked body of {} bytes",
+            remaining.size()
+        ));
+        return false;
+    }
+
+    ss.seekg(bodyStart + static_cast<std::streamoff>(bodySize));
+
+    req.trailers = decoder.Trailers();
+    req.body = decoder.TakeBody();
+
+    return true;
+}
+
+
 /*
     @brief Parse the body of an HTTP Request
     @param ss Message in stringstream format
@@ -261,12 +323,46 @@ bool ParseBody(std::stringstream& ss, HttpRequest& req) {
         return false;
     }
 
+    if (req.GetHeader("Transfer-Encoding").has_value()) {
+        return ParseChunkedBody(ss, req);
+    }
+
     std::optional<std::string> res = req.GetHeader("Content-Length");
     if (res.has_value() == false) {
         return true;
     }
 
-    size_t contentLength = std::stoul(res.value());
+    // Digits only, a malformed length is a bad request rather than an exception
+    std::string_view value = res.value();
+    value.remove_prefix(std::min(value.find_first_not_of(" \t"), value.size()));
+    value.remove_suffix(value.size() - std::min(value.find_last_not_of(" \t") + 1, value.size()));
+
+    size_t contentLength = 0;
+    const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), contentLength);
+
+    if (value.empty() || error != std::errc() || end != value.data() + value.size()) {
+        Log::Error(std::format(
+            "ParseBody(): Invalid Content-Length: {}",
+            res.value()
+        ));
+        return false;
+    }
+
+    // Not trusted for an allocation up front, only what is actually there is read
+    const std::streampos bodyStart = ss.tellg();
+    ss.seekg(0, std::ios::end);
+    const size_t bytesAvailable = static_cast<size_t>(ss.tellg() - bodyStart);
+    ss.seekg(bodyStart);
+
+    if (contentLength > bytesAvailable) {
+        Log::Error(std::format(
+            "ParseBody(): Incomplete body read, got {} bytes, expected {} from header",
+            bytesAvailable,
+            contentLength
+        ));
+        return false;
+    }
+
     std::string body(contentLength, 0);
 
     // Read `contentLength` bytes of data from the stream to body
@@ -375,6 +471,15 @@ bool HttpRequest::ParseFrom(std::stringstream& ss) {
     return true;
 }
 
+bool HttpRequest::ParseHeadFrom(std::stringstream& ss) {
+
+    if (ss.good() == false) {
+        return false;
+    }
+
+    return ParseStartLine(ss, *this) && ParseHeaders(ss, *this);
+}
+
 std::optional<std::string> HttpRequest::GetHeader(const std::string& key) const {
 
     auto it = this->headers.find(key);
@@ -385,6 +490,43 @@ std::optional<std::string> HttpRequest::GetHeader(const std::string& key) const
     return it->second;
 }
 
+bool HttpRequest::IsKeepAlive() const {
+
+    bool hasClose = false;
+    bool hasKeepAlive = false;
+
+    const std::optional<std::string> connection = GetHeader("Connection");
+    if (connection.has_value()) {
+        // Comma separated list of options, ex: "keep-alive, Upgrade"
+        std::string_view options = connection.value();
+        while (options.empty() == false) {
+            const size_t comma = options.find(',');
+            std::string_view option = options.substr(0, comma);
+            options = (comma == std::string_view::npos) ? std::string_view() : options.substr(comma + 1);
+
+            const size_t first = option.find_first_not_of(" \t");
+            if (first == std::string_view::npos) {
+                continue;
+            }
+            option = option.substr(first, option.find_last_not_of(" \t") - first + 1);
+
+            const CaseInsensitiveEqual isEqual;
+            hasClose = hasClose || isEqual(std::string(option), "close");
+            hasKeepAlive = hasKeepAlive || isEqual(std::string(option), "keep-alive");
+        }
+    }
+
+    if (hasClose) {
+        return false;
+    }
+
+    if (version == HttpVersion::HTTP_1_0) {
+        return hasKeepAlive;
+    }
+
+    return version == HttpVersion::HTTP_1_1;
+}
+
 std::optional<std::string> HttpRequest::GetQueryParam(const std::string& key) const {
 
     auto it = this->queryParams.find(key);
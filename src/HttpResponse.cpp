@@ -139,6 +139,21 @@ void HttpResponse::SetBody(std::string&& body, const bool setContentLengthHeader
     return;
 }
 
+void HttpResponse::Stream(BodyProducer producer, const std::optional<size_t> contentLength) {
+
+    this->bodyProducer = std::move(producer);
+    this->body.clear();
+
+    if (contentLength.has_value()) {
+        this->SetHeader("Content-Length", std::to_string(contentLength.value()));
+    }
+    else {
+        this->DeleteHeader("Content-Length");
+    }
+
+    return;
+}
+
 
 /*
     @brief Serialize `res` into a std::string, with the standard HTTP response format
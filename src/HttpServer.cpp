@@ -1,7 +1,12 @@
+#include <algorithm>
 #include <arpa/inet.h>
+#include <array>
+#include <cctype>
+#include <charconv>
 #include <chrono>
 #include <format>
 #include <iostream>
+#include <limits>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <poll.h>
@@ -17,6 +22,7 @@
 #include "knots/HttpServer.hpp"
 #include "knots/HttpMessage.hpp"
 #include "knots/NetworkIO.hpp"
+#include "knots/ResponseWriter.hpp"
 #include "knots/ThreadPool.hpp"
 #include "knots/utils/Config.hpp"
 #include "knots/utils/Log.hpp"
@@ -35,7 +41,8 @@ HttpServer::HttpServer(const HttpServerConfiguration config, const Router& route
     m_isRunning(false),
     m_serverSocket(socket(AF_INET, SOCK_STREAM, 0)),
     m_config(config),
-    m_router(router) {
+    m_router(router),
+    m_connectionTimers(connectionTimerTick, connectionTimerSlots) {
 
     // Check if the socket was created successfully
     if (m_serverSocket.Get() < 0) {
@@ -46,6 +53,9 @@ HttpServer::HttpServer(const HttpServerConfiguration config, const Router& route
 
     ValidateServerConfiguration();
 
+    // Bake the middleware into the routes once, instead of walking it on every request
+    m_router.Freeze(m_config.retryAfterSeconds);
+
     Log::Info(std::format(
         "Attempting to start server on port {}",
         m_config.port
@@ -75,19 +85,53 @@ HttpServer::HttpServer(const HttpServerConfiguration config, const Router& route
         ));
     }
 
-    // Start the thread pool
-    m_threadPool.InitializeThreadPool(m_config.maxConnections);
-
-    // Spin up a thread to listen to console input
-    m_consoleInputHandlerThread = std::jthread(
-        [this] () {
-            this->HandleConsoleInput();
-        }
+    m_overloadResponse = std::format(
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Retry-After: {}\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n"
+        "\r\n",
+        m_config.retryAfterSeconds
     );
 
+    if (m_config.maxConcurrentRequests > 0) {
+        m_concurrencyLimiter = std::make_unique<ConcurrencyLimiter>(
+            m_config.minConcurrentRequests,
+            m_config.maxConcurrentRequests,
+            std::chrono::milliseconds(m_config.concurrencyLatencyTargetMs)
+        );
+    }
+
+    // Start the thread pool
+    m_threadPool.InitializeThreadPool(ThreadPoolConfiguration{
+        .threadCount = m_config.maxConnections,
+        .queueCapacity = static_cast<size_t>(m_config.maxQueuedConnections),
+        .overloadPolicy = m_config.overloadPolicy,
+        .queueDelayTarget = std::chrono::milliseconds(m_config.queueDelayTargetMs),
+        .queueDelayInterval = std::chrono::milliseconds(m_config.queueDelayIntervalMs),
+        .minThreadCount = m_config.minThreads > 0 ? std::optional<int>(m_config.minThreads) : std::nullopt,
+        .idleTimeout = std::chrono::milliseconds(m_config.threadIdleTimeoutMs),
+        .affinity = m_config.threadAffinity,
+        .cpus = ThreadPool::ParseCpuList(m_config.cpuList).value_or(std::vector<int>{}),
+        .spinIterations = m_config.workerSpinIterations
+    });
+
+    // Offloaded handlers never wait for room, a full compute pool answers with a 503 instead
+    if (m_config.computeThreads > 0) {
+        m_computePool.InitializeThreadPool(ThreadPoolConfiguration{
+            .threadCount = m_config.computeThreads,
+            .queueCapacity = static_cast<size_t>(m_config.maxQueuedConnections),
+            .overloadPolicy = OverloadPolicy::REJECT
+        });
+    }
+
     // Mark server as running
     m_isRunning = true;
 
+    // Check for console input every so often, on the event loop's thread, which a busy pool
+    // can't hold up
+    ScheduleConsolePoll();
+
     // Ready to go
     Log::Info(
         std::format("HttpServer(): Server listening on port {}, max {} connections\n",
@@ -102,6 +146,8 @@ HttpServer::HttpServer(const HttpServerConfiguration config, const Router& route
     @brief Destructor for HttpServer, handles thread pool cleanup
 */
 HttpServer::~HttpServer() {
+    m_eventLoop.Stop();
+    m_computePool.Stop();
     m_threadPool.Stop();
 }
 
@@ -139,6 +185,15 @@ void HttpServer::SetServerSocketOptions() {
         throw std::runtime_error(Log::MakeErrorMessage("Failed to set SO_KEEPALIVE"));
     }
 
+    // Client sockets get it too, but a missing capability is better caught here than per connection
+    if (m_config.busyPollMicroseconds > 0
+        && setsockopt(m_serverSocket.Get(), SOL_SOCKET, SO_BUSY_POLL, &m_config.busyPollMicroseconds, sizeof(m_config.busyPollMicroseconds)) < 0) {
+        throw std::runtime_error(Log::MakeErrorMessage(std::format(
+            "Failed to set SO_BUSY_POLL: {}",
+            strerror(errno)
+        )));
+    }
+
     return;
 }
 
@@ -162,6 +217,113 @@ void HttpServer::ValidateServerConfiguration() const {
         )));
     }
 
+    if (m_config.maxQueuedConnections <= 0) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid max queued connections: {} | Allowed range: > 0",
+            m_config.maxQueuedConnections
+        )));
+    }
+
+    if (m_config.retryAfterSeconds < 0) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid Retry-After: {} s | Allowed range: >= 0s",
+            m_config.retryAfterSeconds
+        )));
+    }
+
+    if (m_config.queueDelayTargetMs < 0) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid queue delay target: {} ms | Allowed range: >= 0ms",
+            m_config.queueDelayTargetMs
+        )));
+    }
+
+    if (m_config.queueDelayIntervalMs <= 0) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid queue delay interval: {} ms | Allowed range: > 0ms",
+            m_config.queueDelayIntervalMs
+        )));
+    }
+
+    if (m_config.maxConcurrentRequests < 0) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid max concurrent requests: {} | Allowed range: >= 0",
+            m_config.maxConcurrentRequests
+        )));
+    }
+
+    if (m_config.minConcurrentRequests <= 0 ||
+        (m_config.maxConcurrentRequests > 0 && m_config.minConcurrentRequests > m_config.maxConcurrentRequests)) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid min concurrent requests: {} | Allowed range: 1 to maxConcurrentRequests",
+            m_config.minConcurrentRequests
+        )));
+    }
+
+    if (m_config.concurrencyLatencyTargetMs < 0 || m_config.concurrencyQueueTimeoutMs < 0) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid concurrency latency target / queue timeout: {} ms / {} ms | Allowed range: >= 0ms",
+            m_config.concurrencyLatencyTargetMs,
+            m_config.concurrencyQueueTimeoutMs
+        )));
+    }
+
+    if (m_config.minThreads < 0 || m_config.minThreads > m_config.maxConnections) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid min threads: {} | Allowed range: 0 to maxConnections",
+            m_config.minThreads
+        )));
+    }
+
+    if (m_config.threadIdleTimeoutMs <= 0) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid thread idle timeout: {} ms | Allowed range: > 0ms",
+            m_config.threadIdleTimeoutMs
+        )));
+    }
+
+    if (m_config.computeThreads < 0) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid compute threads: {} | Allowed range: >= 0",
+            m_config.computeThreads
+        )));
+    }
+
+    if (m_config.workerSpinIterations < 0 || m_config.busyPollMicroseconds < 0) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid worker spin iterations / busy poll: {} / {} us | Allowed range: >= 0",
+            m_config.workerSpinIterations,
+            m_config.busyPollMicroseconds
+        )));
+    }
+
+    if (ThreadPool::ParseCpuList(m_config.cpuList).has_value() == false) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid CPU list: \"{}\" | Expected format: \"0-3,8\"",
+            m_config.cpuList
+        )));
+    }
+
+    if (m_config.headerTimeoutMs < 0
+        || m_config.bodyTimeoutMs < 0
+        || m_config.keepAliveTimeoutMs < 0
+        || m_config.requestTimeoutMs < 0) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid header / body / keep-alive / request timeout: {} / {} / {} / {} ms | Allowed range: >= 0ms",
+            m_config.headerTimeoutMs,
+            m_config.bodyTimeoutMs,
+            m_config.keepAliveTimeoutMs,
+            m_config.requestTimeoutMs
+        )));
+    }
+
+    if (m_config.maxRequestsPerConnection < 0) {
+        throw std::invalid_argument(Log::MakeErrorMessage(std::format(
+            "HttpServer(): Invalid max requests per connection: {} | Allowed range: >= 0",
+            m_config.maxRequestsPerConnection
+        )));
+    }
+
     if (m_config.inputPollingIntevalMs < 0) {
         throw std::invalid_argument(Log::MakeErrorMessage(std::format(
             "HttpServer(): Invalid input polling timeout: {} ms | Allowed range: > 0ms",
@@ -173,49 +335,67 @@ void HttpServer::ValidateServerConfiguration() const {
 }
 
 /*
-    @brief Listen for console input
+    @brief Poll the console again in `inputPollingIntevalMs`, on the event loop
 */
-void HttpServer::HandleConsoleInput() {
+void HttpServer::ScheduleConsolePoll() {
 
-    std::string buffer;
+    const std::chrono::milliseconds interval = std::max(
+        std::chrono::milliseconds(m_config.inputPollingIntevalMs),
+        std::chrono::milliseconds(1)
+    );
 
-    std::set<std::string> stopCommands = {
+    // Called with 0 either way, a stopped loop just isn't polled again
+    m_eventLoop.AddTimer(EventLoop::Clock::now() + interval, [this] (uint32_t) {
+        if (this->PollConsoleInput()) {
+            this->ScheduleConsolePoll();
+        }
+    });
+
+    return;
+}
+
+
+/*
+    @brief Check for a command on the console, see `ScheduleConsolePoll()`
+    @return `false` once there is no point polling again, ex: the console was closed
+*/
+bool HttpServer::PollConsoleInput() {
+
+    static const std::set<std::string> stopCommands = {
         "q", "quit", "stop", "exit"
     };
 
-    auto consoleInputReady = [] () {
-        pollfd pfd {
-            .fd = STDIN_FILENO,
-            .events = POLLIN,
-            .revents{}
-        };
+    if (m_isRunning == false) {
+        return false;
+    }
 
-        return poll(&pfd, 1, 0) > 0;
+    pollfd pfd {
+        .fd = STDIN_FILENO,
+        .events = POLLIN,
+        .revents{}
     };
 
-    // Check input once every while (defined in config) if it's not a test build
-    const std::chrono::milliseconds pollingInterval{m_config.inputPollingIntevalMs};
-
-    while (m_isRunning) {
-        if (consoleInputReady()) {
-            std::cin >> buffer;
+    if (poll(&pfd, 1, 0) <= 0) {
+        return true;
+    }
 
-            if (stopCommands.contains(buffer)) {
-                Shutdown();
-                return;
-            }
-            else {
-                Log::Error(std::format(
-                    "'{}' is not a valid command",
-                    buffer
-                ));
-            }
-        }
+    // Nothing more will ever come from a closed console
+    std::string buffer;
+    if ((std::cin >> buffer).fail()) {
+        return false;
+    }
 
-        std::this_thread::sleep_for(pollingInterval);
+    if (stopCommands.contains(buffer)) {
+        Shutdown();
+        return false;
     }
 
-    return;
+    Log::Error(std::format(
+        "'{}' is not a valid command",
+        buffer
+    ));
+
+    return true;
 }
 
 
@@ -238,6 +418,9 @@ void HttpServer::Shutdown() {
     // Shutdown the server socket
     shutdown(m_serverSocket.Get(), SHUT_RD);
 
+    // Parked requests stop waiting, and are answered right away
+    m_eventLoop.Stop();
+
     return;
 }
 
@@ -260,7 +443,7 @@ bool HttpServer::IsReady() const {
 */
 bool HttpServer::SetClientSocketOptions(const Socket& clientSocket) const {
 
-    // Set receive timeout
+    // Set send and receive timeouts, a streamed response stops if the client stops reading
     constexpr struct timeval timeout{
         .tv_sec = 10,
         .tv_usec = 0
@@ -283,6 +466,7 @@ bool HttpServer::SetClientSocketOptions(const Socket& clientSocket) const {
         socklen_t len;
     } options[] = {
         {SOL_SOCKET,  SO_RCVTIMEO,   (void*)&timeout,             sizeof(timeout)},
+        {SOL_SOCKET,  SO_SNDTIMEO,   (void*)&timeout,             sizeof(timeout)},
         {SOL_SOCKET,  SO_KEEPALIVE,  (void*)&tcpKeepAlive,        sizeof(tcpKeepAlive)},
         {IPPROTO_TCP, TCP_KEEPIDLE,  (void*)&startProbingAfter,   sizeof(startProbingAfter)},
         {IPPROTO_TCP, TCP_KEEPINTVL, (void*)&sendProbeInterval,   sizeof(sendProbeInterval)},
@@ -299,6 +483,15 @@ bool HttpServer::SetClientSocketOptions(const Socket& clientSocket) const {
         }
     }
 
+    if (m_config.busyPollMicroseconds > 0
+        && setsockopt(clientSocket.Get(), SOL_SOCKET, SO_BUSY_POLL, &m_config.busyPollMicroseconds, sizeof(m_config.busyPollMicroseconds)) < 0) {
+        Log::Error(std::format(
+            "SetClientSocketOptions(): Could not set SO_BUSY_POLL for socket {}",
+            clientSocket.Get()
+        ));
+        return false;
+    }
+
     return true;
 }
 
@@ -350,15 +543,20 @@ void HttpServer::AcceptConnections() {
         }
 
         // Enqueue a job in the thread pool
-        {
-            std::scoped_lock<std::mutex> lock(m_threadPoolMutex);
-            m_threadPool.EnqueueJob(
-                [this, clientSocketFD, clientAddress] () {
-                    HandleConnection(Socket(clientSocketFD), clientAddress);
-                }
-            );
+        // The job owns the socket from here on, if the pool turns it away the client gets a 503
+        Socket clientSocket(clientSocketFD);
+        // Every thread is taken, at least one of them may only be holding an idle connection
+        if (m_threadPool.AvailableThreads() == 0) {
+            EvictIdleConnection();
         }
 
+        // Held in place by the pool's job slots, so accepting a connection doesn't allocate
+        static_assert(Job::isStoredInline<PendingConnection>, "PendingConnection outgrew Job::inlineSize");
+
+        const JobPriority priority = ClassifyConnection(clientSocket);
+        const int incomingCpu = IncomingCpu(clientSocket);
+        m_threadPool.EnqueueJob(PendingConnection(this, std::move(clientSocket), clientAddress), priority, incomingCpu);
+
         {
             std::scoped_lock<std::mutex> lock(m_activeClientSocketsMutex);
             m_activeClientSockets.erase(clientSocketFD);
@@ -369,12 +567,243 @@ void HttpServer::AcceptConnections() {
 }
 
 
+/*
+    @brief Pick the thread pool priority for a newly accepted connection
+    @param clientSocket The socket for the client
+
+    @return What the priority classifier picks for the first request, or `JobPriority::NORMAL`
+    if there is no classifier, or the request line and headers haven't all arrived yet
+
+    @note The request is only peeked at, the connection's thread reads it as usual
+*/
+JobPriority HttpServer::ClassifyConnection(const Socket& clientSocket) const {
+
+    if (m_priorityClassifier == nullptr) {
+        return JobPriority::NORMAL;
+    }
+
+    // On the stack, the accept loop only allocates for the head it hands the classifier
+    constexpr size_t peekSize = 4096;
+    std::array<char, peekSize> buffer;
+
+    const ssize_t bytesPeeked = recv(clientSocket.Get(), buffer.data(), buffer.size(), MSG_PEEK | MSG_DONTWAIT);
+    if (bytesPeeked <= 0) {
+        return JobPriority::NORMAL;
+    }
+    const std::string_view peeked(buffer.data(), static_cast<size_t>(bytesPeeked));
+
+    const size_t headEnd = peeked.find("\r\n\r\n");
+    if (headEnd == std::string_view::npos) {
+        return JobPriority::NORMAL;
+    }
+
+    std::stringstream ss{std::string(peeked.substr(0, headEnd + 4))};
+    HttpRequest req;
+    if (req.ParseHeadFrom(ss) == false) {
+        return JobPriority::NORMAL;
+    }
+
+    return m_priorityClassifier(req);
+}
+
+
+/*
+    @brief Find the CPU that handled the connection's packets, to run it on the worker pinned there
+    @param clientSocket The socket for the client
+
+    @return The CPU, or -1 if workers aren't pinned to cores, or the kernel didn't say
+*/
+int HttpServer::IncomingCpu(const Socket& clientSocket) const {
+
+    if (m_config.threadAffinity != ThreadAffinity::CORE) {
+        return -1;
+    }
+
+    int cpu = -1;
+    socklen_t length = sizeof(cpu);
+    if (getsockopt(clientSocket.Get(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, &length) < 0) {
+        return -1;
+    }
+
+    return cpu;
+}
+
+
+HttpServer::PendingConnection::PendingConnection(
+    HttpServer* server,
+    Socket clientSocket,
+    const sockaddr_in& clientAddress,
+    const int requestsServed
+) :
+    server(server),
+    clientSocket(std::move(clientSocket)),
+    clientAddress(clientAddress),
+    requestsServed(requestsServed)
+{}
+
+HttpServer::PendingConnection::~PendingConnection() {
+    // Still owning the socket means this never ran, a kept-alive client has no request waiting
+    if (clientSocket.Get() >= 0 && requestsServed == 0) {
+        NetworkIO::Send(clientSocket, server->m_overloadResponse, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+}
+
+void HttpServer::PendingConnection::operator()() {
+    server->HandleConnection(std::move(clientSocket), clientAddress, requestsServed);
+    return;
+}
+
+
+HttpServer::OffloadedRequest::OffloadedRequest(
+    HttpServer* server,
+    Socket clientSocket,
+    const sockaddr_in& clientAddress,
+    HttpRequest req,
+    const HandlerFunction* handler,
+    ConcurrencyLimiter::Permit permit,
+    const int requestNumber
+) :
+    server(server),
+    clientSocket(std::move(clientSocket)),
+    clientAddress(clientAddress),
+    req(std::move(req)),
+    handler(handler),
+    permit(std::move(permit)),
+    requestNumber(requestNumber),
+    hasRun(false)
+{}
+
+HttpServer::OffloadedRequest::~OffloadedRequest() {
+    if (clientSocket.Get() >= 0 && hasRun == false) {
+        NetworkIO::Send(clientSocket, server->m_overloadResponse, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+}
+
+void HttpServer::OffloadedRequest::operator()() {
+
+    hasRun = true;
+
+    HttpResponse res;
+    res.SetStatus(200);
+    (*handler)(req, res);
+    permit.Release();
+
+    if (server->SendResponse(req, res, clientSocket, clientAddress, requestNumber)) {
+        server->m_threadPool.EnqueueJob(PendingConnection(server, std::move(clientSocket), clientAddress, requestNumber));
+    }
+
+    return;
+}
+
+/*
+    @brief Answer a request still parked past `requestTimeoutMs` with a 504, on the event loop
+    The coroutine is left to finish whenever what it waits on is ready, or the loop stops
+*/
+void HttpServer::AsyncRequest::TimeOut() {
+
+    // Already answered, or the loop stopped for shutdown and is waking the coroutine anyway
+    if (server->m_isRunning == false || isAnswered.exchange(true)) {
+        return;
+    }
+
+    permit.Release();
+
+    // HTTP 504 - Gateway Timeout
+    server->HandleError(504, req, clientSocket, clientAddress);
+
+    // Closed for the client now, the socket itself only once the coroutine lets go of it
+    shutdown(clientSocket.Get(), SHUT_RDWR);
+
+    return;
+}
+
+
+HttpServer::AsyncRequest::AsyncRequest(
+    HttpServer* server,
+    Socket clientSocket,
+    const sockaddr_in& clientAddress,
+    HttpRequest req,
+    HttpResponse res,
+    ConcurrencyLimiter::Permit permit,
+    const int requestNumber
+) :
+    server(server),
+    clientSocket(std::move(clientSocket)),
+    clientAddress(clientAddress),
+    req(std::move(req)),
+    res(std::move(res)),
+    permit(std::move(permit)),
+    requestNumber(requestNumber),
+    isAnswered(false)
+{}
+
+/*
+    @brief Run the handler's coroutine on this thread until it first waits, or finishes
+    @param request The request, owned by the coroutine from here on
+    @param handler The handler
+*/
+void HttpServer::AsyncRequest::Start(std::unique_ptr<AsyncRequest> request, const AsyncHandler& handler) {
+
+    const std::shared_ptr<AsyncRequest> parked(std::move(request));
+    HttpServer* server = parked->server;
+
+    // The connection's own deadline can't follow it here, the event loop keeps time instead
+    if (server->m_config.requestTimeoutMs > 0) {
+        server->m_eventLoop.AddTimer(
+            EventLoop::Clock::now() + std::chrono::milliseconds(server->m_config.requestTimeoutMs),
+            [weakParked = std::weak_ptr<AsyncRequest>(parked)] (uint32_t) {
+                if (const std::shared_ptr<AsyncRequest> expired = weakParked.lock()) {
+                    expired->TimeOut();
+                }
+            }
+        );
+    }
+
+    parked->task = handler.MakeTask(parked->req, parked->res);
+    parked->task.Start(TaskContext{&server->m_threadPool, &server->m_eventLoop}, [parked] () {
+        parked->Finish();
+    });
+
+    return;
+}
+
+/*
+    @brief Send the response once the coroutine has finished, on whichever thread it finished on
+*/
+void HttpServer::AsyncRequest::Finish() {
+
+    // Already answered by the deadline
+    if (isAnswered.exchange(true)) {
+        return;
+    }
+
+    permit.Release();
+
+    // HTTP 500 - Internal Server Error
+    if (task.HasFailed()) {
+        Log::Error(std::format(
+            "Async handler for {} threw an exception",
+            req.requestUrl
+        ));
+        server->HandleError(500, req, clientSocket, clientAddress);
+        return;
+    }
+
+    if (server->SendResponse(req, res, clientSocket, clientAddress, requestNumber)) {
+        server->m_threadPool.EnqueueJob(PendingConnection(server, std::move(clientSocket), clientAddress, requestNumber));
+    }
+
+    return;
+}
+
+
 /*
     @brief Handle incoming connections
     @param clientSocketFD The socket file descriptor for the client connection
     @param clientAddress The address of the client
+    @param requestsServed Requests already answered on the connection, 0 for a new one
 */
-void HttpServer::HandleConnection(Socket clientSocket, const sockaddr_in clientAddress) {
+void HttpServer::HandleConnection(Socket clientSocket, const sockaddr_in clientAddress, int requestsServed) {
 
     /*
         If the options could not be set, don't process the request further, as it
@@ -391,8 +820,57 @@ void HttpServer::HandleConnection(Socket clientSocket, const sockaddr_in clientA
         return;
     }
 
+    /*
+        Deadlines close the connection from the timing wheel's thread, the read below then
+        returns 0. One covers the current phase: reading the head, reading the body, or
+        waiting for the next request; the other the request as a whole
+    */
+    const int clientSocketFD = clientSocket.Get();
+    const auto closeConnection = [clientSocketFD] () {
+        shutdown(clientSocketFD, SHUT_RDWR);
+    };
+    TimingWheel::Timer phaseDeadline(m_connectionTimers, closeConnection);
+    TimingWheel::Timer requestDeadline(m_connectionTimers, closeConnection);
+
+    const auto armDeadline = [] (TimingWheel::Timer& deadline, const int timeoutMs) {
+        if (timeoutMs > 0) {
+            deadline.Arm(std::chrono::milliseconds(timeoutMs));
+        }
+        else {
+            deadline.Cancel();
+        }
+    };
+
+    // A new connection has `headerTimeoutMs` from being accepted to send its first request
+    std::optional<IdleConnectionList::iterator> idleConnection;
+    if (requestsServed == 0) {
+        armDeadline(phaseDeadline, m_config.headerTimeoutMs);
+    }
+    else {
+        armDeadline(phaseDeadline, m_config.keepAliveTimeoutMs);
+        idleConnection = MarkIdle(clientSocket);
+    }
+    bool isReadingBody = false;
+
+    // Bytes of the requests being read, each handed over once all of it is in
+    std::string pending;
     std::stringstream ss;
 
+    // A chunked body is decoded as it arrives, only to find where it ends and check its size
+    std::optional<ChunkedDecoder> chunkedBody;
+    size_t chunkedBodyRead = 0;
+
+    // What the route of the request being read accepts as a body, looked up once its head is in
+    std::optional<BodyOptions> bodyOptions;
+
+    // Answers to the requests read so far, written together once every buffered one is handled
+    std::vector<std::string> responses;
+    const auto sendResponses = [&responses, &clientSocket] () {
+        const bool isSent = NetworkIO::Send(clientSocket, responses, MSG_NOSIGNAL);
+        responses.clear();
+        return isSent;
+    };
+
     constexpr int bufferSize = 32768;
     std::vector<char> buffer(bufferSize);
 
@@ -416,22 +894,360 @@ void HttpServer::HandleConnection(Socket clientSocket, const sockaddr_in clientA
             }
         }
 
-        ss.write(buffer.data(), bytesRead);
-        buffer.clear();
+        // First bytes of a request
+        if (pending.empty()) {
+            armDeadline(requestDeadline, m_config.requestTimeoutMs);
+            if (idleConnection.has_value()) {
+                MarkActive(idleConnection.value());
+                idleConnection.reset();
+                armDeadline(phaseDeadline, m_config.headerTimeoutMs);
+            }
+        }
+        pending.append(buffer.data(), bytesRead);
+
+        // Handle every complete request buffered, a client may pipeline several in one go
+        size_t consumed = 0;
+        size_t batchedSize = 0;
+        bool isKeptAlive = true;
+        while (isKeptAlive) {
+            const std::string_view unread = std::string_view(pending).substr(consumed);
+
+            const std::optional<RequestFraming> framing = FrameRequest(unread);
+            if (framing.has_value() == false) {
+                if (unread.size() > maxRequestHeadSize) {
+                    HandleError(431, {}, clientSocket, clientAddress, {}, &responses);
+                    isKeptAlive = false;
+                }
+                break;
+            }
+
+            if (framing->errorStatus != 0) {
+                HandleError(framing->errorStatus, {}, clientSocket, clientAddress, {}, &responses);
+                isKeptAlive = false;
+                break;
+            }
+
+            // Requests without a body can't be turned away for it, and skip the lookup
+            if (bodyOptions.has_value() == false && (framing->isChunked || framing->contentLength > 0)) {
+                bodyOptions = FindBodyOptions(unread.substr(0, framing->headSize));
+            }
+            const size_t maxBodySize = bodyOptions.has_value() ? bodyOptions->maxBodySize : maxBufferedRequestSize;
+
+            // HTTP 413 - Content Too Large, before any of the body is read
+            if (framing->contentLength > maxBodySize) {
+                HandleError(413, {}, clientSocket, clientAddress, {}, &responses);
+                isKeptAlive = false;
+                break;
+            }
+
+            size_t requestSize = framing->headSize + framing->contentLength;
+            bool isComplete = (unread.size() >= requestSize);
+            short int errorStatus = 0;
+
+            // A streamed body is read by the handler as it goes, the request is ready at its head
+            std::optional<RequestReader> bodyReader;
+            if (bodyOptions.has_value() && bodyOptions->isStreamed) {
+                bodyReader.emplace(
+                    clientSocket,
+                    std::string(unread.substr(framing->headSize)),
+                    framing->isChunked ? RequestReader::Framing::CHUNKED : RequestReader::Framing::CONTENT_LENGTH,
+                    framing->contentLength,
+                    maxBodySize,
+                    [&armDeadline, &phaseDeadline, this] () {
+                        armDeadline(phaseDeadline, m_config.bodyTimeoutMs);
+                    }
+                );
+                requestSize = framing->headSize;
+                isComplete = true;
+            }
+            else if (framing->isChunked) {
+                if (chunkedBody.has_value() == false) {
+                    chunkedBody.emplace(maxBodySize, maxRequestHeadSize);
+                    chunkedBodyRead = 0;
+                }
+
+                // Only the bytes that arrived since the last read are decoded
+                chunkedBodyRead += chunkedBody->Feed(unread.substr(framing->headSize + chunkedBodyRead));
+                requestSize = framing->headSize + chunkedBodyRead;
+                isComplete = false;
+
+                switch (chunkedBody->GetStatus()) {
+                    case ChunkedDecoder::Status::INCOMPLETE:
+                        break;
+                    case ChunkedDecoder::Status::COMPLETE:
+                        chunkedBody.reset();
+                        isComplete = true;
+                        break;
+                    case ChunkedDecoder::Status::MALFORMED:
+                        errorStatus = 400;
+                        break;
+                    case ChunkedDecoder::Status::BODY_TOO_LARGE:
+                        errorStatus = 413;
+                        break;
+                    case ChunkedDecoder::Status::TRAILERS_TOO_LARGE:
+                        errorStatus = 431;
+                        break;
+                }
+            }
+
+            // The raw request is buffered whole, chunk framing included
+            if (errorStatus == 0 && requestSize > maxBufferedRequestSize) {
+                errorStatus = 413;
+            }
+
+            if (errorStatus != 0) {
+                HandleError(errorStatus, {}, clientSocket, clientAddress, {}, &responses);
+                isKeptAlive = false;
+                break;
+            }
+
+            if (isComplete == false) {
+                if (isReadingBody == false) {
+                    armDeadline(phaseDeadline, m_config.bodyTimeoutMs);
+                    isReadingBody = true;
+                }
+                break;
+            }
+
+            // A streamed body has `bodyTimeoutMs` for each wait for more of it instead
+            if (bodyReader.has_value()) {
+                armDeadline(phaseDeadline, m_config.bodyTimeoutMs);
+            }
+            else {
+                phaseDeadline.Cancel();
+            }
+            isReadingBody = false;
+            bodyOptions.reset();
+
+            ss.clear();
+            ss.str(std::string(unread.substr(0, requestSize)));
+            consumed += requestSize;
+
+            // Only the last buffered request may take the connection to the compute pool
+            const bool isLastBuffered = (consumed == pending.size()) && bodyReader.has_value() == false;
+
+            /*
+                HandleRequest() returns whether or not to keep a connection alive
+                If false, stop here, requests pipelined after it are dropped
+            */
+            requestsServed++;
+            isKeptAlive = HandleRequest(
+                ss, clientSocket, clientAddress, requestDeadline, requestsServed, responses, isLastBuffered,
+                bodyReader.has_value() ? &bodyReader.value() : nullptr
+            );
+            requestDeadline.Cancel();
+
+            // The body was copied into the reader, what it read past the body comes next
+            if (bodyReader.has_value()) {
+                phaseDeadline.Cancel();
+                pending.resize(consumed);
+                pending += bodyReader->TakeLeftover();
+            }
+
+            // Large responses aren't held back, and don't pile up in memory
+            batchedSize = responses.empty() ? 0 : batchedSize + responses.back().size();
+            if (batchedSize >= maxBatchedResponseSize) {
+                isKeptAlive = sendResponses() && isKeptAlive;
+                batchedSize = 0;
+            }
+
+            // The next pipelined request has already started arriving
+            if (isKeptAlive && consumed < pending.size()) {
+                armDeadline(requestDeadline, m_config.requestTimeoutMs);
+                armDeadline(phaseDeadline, m_config.headerTimeoutMs);
+            }
+        }
+        pending.erase(0, consumed);
 
-        /*
-            HandleRequest() returns whether or not to keep a connection alive
-            If false, break the loop here and stop this connection
-        */
-        if (HandleRequest(ss, clientSocket, clientAddress) == false) {
+        if (sendResponses() == false || isKeptAlive == false) {
             break;
         }
+
+        if (consumed > 0 && pending.empty()) {
+            armDeadline(phaseDeadline, m_config.keepAliveTimeoutMs);
+            idleConnection = MarkIdle(clientSocket);
+        }
+    }
+
+    if (idleConnection.has_value()) {
+        MarkActive(idleConnection.value());
     }
 
     return;
 }
 
 
+/*
+    @brief Add a kept-alive connection to the idle list, as the most recently used
+    @param clientSocket The socket for the client
+
+    @return Its entry, to hand to `MarkActive()` once it has a request or is closed
+*/
+HttpServer::IdleConnectionList::iterator HttpServer::MarkIdle(const Socket& clientSocket) {
+    std::scoped_lock<std::mutex> lock(m_idleConnectionsMutex);
+    return m_idleConnections.insert(m_idleConnections.end(), IdleConnection{clientSocket.Get(), false});
+}
+
+/*
+    @brief Take a connection off the idle list
+    @param idleConnection Its entry, from `MarkIdle()`
+*/
+void HttpServer::MarkActive(const IdleConnectionList::iterator idleConnection) {
+    std::scoped_lock<std::mutex> lock(m_idleConnectionsMutex);
+    m_idleConnections.erase(idleConnection);
+    return;
+}
+
+/*
+    @brief Close the least recently used idle connection, if there is one, freeing its thread
+*/
+void HttpServer::EvictIdleConnection() {
+
+    std::scoped_lock<std::mutex> lock(m_idleConnectionsMutex);
+
+    for (IdleConnection& idleConnection : m_idleConnections) {
+        if (idleConnection.isEvicted == false) {
+            // Its thread sees the connection closed and takes the entry out
+            shutdown(idleConnection.clientSocketFD, SHUT_RDWR);
+            idleConnection.isEvicted = true;
+            return;
+        }
+    }
+
+    return;
+}
+
+
+/*
+    @brief Find a header's value in a raw request head
+    @param head Start line and headers, up to and including the empty line
+    @param name Header name, lower-case, ex: "\r\ncontent-length:"
+    @param from Where in `head` to start looking, ex: past a previous value
+
+    @return The value, without surrounding whitespace, or `std::nullopt` if it isn't there
+*/
+static std::optional<std::string_view> FindHeaderValue(
+    const std::string_view head,
+    const std::string_view name,
+    const size_t from = 0
+) {
+
+    // Header names are case-insensitive
+    const auto found = std::search(
+        head.begin() + std::min(from, head.size()), head.end(),
+        name.begin(), name.end(),
+        [] (const char a, const char b) {
+            return std::tolower(static_cast<unsigned char>(a)) == b;
+        }
+    );
+    if (found == head.end()) {
+        return std::nullopt;
+    }
+
+    const size_t valueStart = (found - head.begin()) + name.size();
+    const size_t valueEnd = head.find("\r\n", valueStart);
+
+    std::string_view value = head.substr(valueStart, valueEnd - valueStart);
+    while (value.empty() == false && (value.front() == ' ' || value.front() == '\t')) {
+        value.remove_prefix(1);
+    }
+    while (value.empty() == false && (value.back() == ' ' || value.back() == '\t')) {
+        value.remove_suffix(1);
+    }
+
+    return value;
+}
+
+/*
+    @brief Work out how the request at the start of a buffer is delimited, from its head
+    @param buffered Bytes read so far
+
+    @return Length of the head, and of the body if it has a `Content-Length`, or
+    `std::nullopt` if the head hasn't all arrived yet
+*/
+std::optional<HttpServer::RequestFraming> HttpServer::FrameRequest(const std::string_view buffered) {
+
+    const size_t headEnd = buffered.find("\r\n\r\n");
+    if (headEnd == std::string_view::npos) {
+        return std::nullopt;
+    }
+
+    RequestFraming framing{headEnd + 4, 0, false, 0};
+    const std::string_view head = buffered.substr(0, framing.headSize);
+
+    const std::optional<std::string_view> contentLength = FindHeaderValue(head, "\r\ncontent-length:");
+    const std::optional<std::string_view> transferEncoding = FindHeaderValue(head, "\r\ntransfer-encoding:");
+
+    if (transferEncoding.has_value()) {
+        if (ChunkedDecoder::IsChunked(transferEncoding.value()) == false) {
+            framing.errorStatus = 501;
+        }
+        // Both at once is how requests get smuggled past proxies
+        else if (contentLength.has_value()) {
+            framing.errorStatus = 400;
+        }
+        framing.isChunked = true;
+        return framing;
+    }
+
+    // Digits only, anything else can't be trusted to say where the body ends
+    if (contentLength.has_value()) {
+        const std::string_view value = contentLength.value();
+        const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), framing.contentLength);
+        if (value.empty() || error != std::errc() || end != value.data() + value.size()) {
+            framing.errorStatus = 400;
+            return framing;
+        }
+    }
+
+    // Repeats must all agree, the parser keeps the last one and framing would go by the first
+    std::optional<std::string_view> repeated = contentLength;
+    while (repeated.has_value()) {
+        const size_t from = (repeated->data() + repeated->size()) - head.data();
+        repeated = FindHeaderValue(head, "\r\ncontent-length:", from);
+        if (repeated.has_value() && repeated.value() != contentLength.value()) {
+            framing.errorStatus = 400;
+            break;
+        }
+    }
+
+    return framing;
+}
+
+
+/*
+    @brief Look up what a request's route accepts as a body, from the request's head alone
+    @param head Start line and headers of the request
+
+    @return The route's options, with the server's default limit if the route has none
+*/
+BodyOptions HttpServer::FindBodyOptions(const std::string_view head) const {
+
+    BodyOptions options;
+
+    std::stringstream ss{std::string(head)};
+    HttpRequest req;
+    if (req.ParseHeadFrom(ss)) {
+        const SegmentHandlerFunctions* handlers = m_router.FetchFunctionsForRoute(req);
+        if (handlers != nullptr) {
+            options = handlers->GetBodyOptions(req.method);
+        }
+    }
+
+    // Streamed bodies aren't held in memory, so only the route can limit them
+    if (options.isStreamed == false) {
+        options.maxBodySize = (options.maxBodySize == 0)
+            ? maxBufferedRequestSize
+            : std::min(options.maxBodySize, maxBufferedRequestSize);
+    }
+    else if (options.maxBodySize == 0) {
+        options.maxBodySize = std::numeric_limits<size_t>::max();
+    }
+
+    return options;
+}
+
+
 /*
     @brief Log the request and its corresponding response code
     @param req Incoming request
@@ -530,12 +1346,16 @@ void LogRequestResponse(
     @param statusCode Status code of the response
     @param req Request object
     @param clientSocket Socket object corresponding to the client
+    @param allowedMethods Value for the "Allow" header, sent with 405 responses
+    @param responses If set, the response is added here to be sent later instead of right away
 */
 void HttpServer::HandleError(
     const int statusCode,
     const HttpRequest& req,
     const Socket& clientSocket,
-    const sockaddr_in& clientAddress
+    const sockaddr_in& clientAddress,
+    const std::string_view allowedMethods,
+    std::vector<std::string>* responses
 ) const {
 
     HttpResponse res;
@@ -547,7 +1367,15 @@ void HttpServer::HandleError(
     }
 
     res.SetStatus(statusCode);
-    NetworkIO::Send(clientSocket, res.Serialize(), 0);
+    if (allowedMethods.empty() == false) {
+        res.SetHeader("Allow", std::string(allowedMethods));
+    }
+    if (responses != nullptr) {
+        responses->push_back(res.Serialize());
+    }
+    else {
+        NetworkIO::Send(clientSocket, res.Serialize(), 0);
+    }
 
     LogRequestResponse(req, res.statusCode, clientAddress, m_config);
 
@@ -559,6 +1387,11 @@ void HttpServer::AddErrorRoute(short int responseStatusCode, HandlerFunction han
     return;
 }
 
+void HttpServer::SetPriorityClassifier(PriorityClassifier classifier) {
+    m_priorityClassifier = std::move(classifier);
+    return;
+}
+
 const HandlerFunction* HttpServer::FetchErrorRoute(short int responseStatusCode) const {
     auto it = m_errorRouter.find(responseStatusCode);
     if (it == m_errorRouter.end()) {
@@ -569,56 +1402,361 @@ const HandlerFunction* HttpServer::FetchErrorRoute(short int responseStatusCode)
 }
 
 
+/*
+    @brief Answer an OPTIONS request for a route that has no OPTIONS handler of its own
+    @param req Request
+    @param allowedMethods Methods the route answers, see `SegmentHandlerFunctions::AllowedMethods()`
+    @param res Response to fill
+
+    Answers CORS preflight requests too, if `corsAllowedOrigin` is configured
+*/
+void HttpServer::SetOptionsResponse(
+    const HttpRequest& req,
+    const std::string& allowedMethods,
+    HttpResponse& res
+) const {
+
+    res.SetStatus(204);
+    res.SetHeader("Allow", allowedMethods);
+
+    if (m_config.corsAllowedOrigin.empty() || req.GetHeader("Origin").has_value() == false) {
+        return;
+    }
+
+    res.SetHeader("Access-Control-Allow-Origin", std::string(m_config.corsAllowedOrigin));
+    res.SetHeader("Access-Control-Allow-Methods", allowedMethods);
+    res.SetHeader("Access-Control-Max-Age", std::to_string(m_config.corsMaxAgeSeconds));
+
+    const std::optional<std::string> requestedHeaders = req.GetHeader("Access-Control-Request-Headers");
+    if (requestedHeaders.has_value()) {
+        res.SetHeader("Access-Control-Allow-Headers", requestedHeaders.value());
+    }
+
+    // The allowed origin depends on the request's origin unless it's "*"
+    if (m_config.corsAllowedOrigin != "*") {
+        res.SetHeader("Vary", "Origin");
+    }
+
+    return;
+}
+
+
 
 /*
     @brief Processes one HTTP request and sends the appropriate response
     @param ss The stringstream containing the raw request
-    @param clientSocketFD The socketFD for the client
-
-    @return `true` if connection is to be kept alive, `false` if not
+    @param clientSocket The socket for the client, moved from if the request is offloaded
+    @param clientAddress The address of the client
+    @param requestDeadline Deadline of the whole request, cancelled if the request is offloaded
+    @param requestNumber How many requests the connection has sent, this one included
+    @param responses Responses waiting to be sent on the connection, this one's is added
+    @param canOffload Whether the connection may be handed over to the compute pool, after
+    sending `responses`
+    @param bodyReader Reader for a streamed body, `ss` then holds only the head. `nullptr` if the
+    body, if any, is in `ss`
+
+    @return `true` if connection is to be kept alive, `false` if not, or if it was handed over
+    to the compute pool
 */
 bool HttpServer::HandleRequest(
     std::stringstream& ss,
-    const Socket& clientSocket,
-    const sockaddr_in& clientAddress
+    Socket& clientSocket,
+    const sockaddr_in& clientAddress,
+    TimingWheel::Timer& requestDeadline,
+    const int requestNumber,
+    std::vector<std::string>& responses,
+    const bool canOffload,
+    RequestReader* bodyReader
 ) {
     HttpRequest req;
-    const bool parseResult = req.ParseFrom(ss);
+    const bool parseResult = (bodyReader == nullptr) ? req.ParseFrom(ss) : req.ParseHeadFrom(ss);
+    req.bodyReader = bodyReader;
 
     // HTTP 400 - Bad Request
     if (parseResult == false) {
-        HandleError(400, req, clientSocket, clientAddress);
+        HandleError(400, req, clientSocket, clientAddress, {}, &responses);
         return false;
     }
 
-    const SegmentHandlerFunctions* handlers = m_router.FetchFunctionsForRoute(req);
-    // If a segment could not be found for the request, or if
-    if (handlers == nullptr) {
-        // HTTP 404 - Not Found
-        HandleError(404, req, clientSocket, clientAddress);
-        return false;
-    }
+    // Hold a slot for as long as the handler runs, or turn the request away if none frees up
+    ConcurrencyLimiter::Permit permit;
+    if (m_concurrencyLimiter != nullptr) {
+        permit = m_concurrencyLimiter->Acquire(std::chrono::milliseconds(m_config.concurrencyQueueTimeoutMs));
 
-    const HandlerFunction& handler = handlers->GetHandler(req.method);
-    if (handler == nullptr) {
-        // HTTP 405 - Method not allowed
-        HandleError(405, req, clientSocket, clientAddress);
-        return false;
+        if (permit.IsHeld() == false) {
+            responses.push_back(m_overloadResponse);
+            LogRequestResponse(req, 503, clientAddress, m_config);
+            return false;
+        }
     }
 
     HttpResponse res;
     res.SetStatus(200);
-    handler(req, res);
 
-    const std::optional<std::string> requestConnectionHeader = req.GetHeader("Connection");
-    res.SetHeader("Connection", requestConnectionHeader.value_or("close"));
+    std::optional<RequestReader> emptyBody;
+
+    // Routes from a compile-time table take precedence over the runtime ones
+    uint16_t compiledMethodMask = 0;
+    CompiledRoutes::MatchResult compiledMatch = m_router.DispatchCompiledRoutes(req, res, &compiledMethodMask);
+
+    // HEAD falls back to the GET route, the body is dropped before sending
+    if (compiledMatch == CompiledRoutes::MatchResult::METHOD_NOT_ALLOWED && req.method == HttpMethod::HEAD) {
+        req.method = HttpMethod::GET;
+        compiledMatch = m_router.DispatchCompiledRoutes(req, res);
+        req.method = HttpMethod::HEAD;
+    }
+
+    if (compiledMatch == CompiledRoutes::MatchResult::METHOD_NOT_ALLOWED) {
+        const std::string& allowedMethods = SegmentHandlerFunctions::AllowedMethodsFor(
+            SegmentHandlerFunctions::AllowedMethodMaskFor(compiledMethodMask)
+        );
+
+        if (req.method != HttpMethod::OPTIONS) {
+            // HTTP 405 - Method not allowed
+            HandleError(405, req, clientSocket, clientAddress, allowedMethods, &responses);
+            return false;
+        }
+
+        SetOptionsResponse(req, allowedMethods, res);
+    }
+
+    if (compiledMatch == CompiledRoutes::MatchResult::NOT_FOUND) {
+        const SegmentHandlerFunctions* handlers = m_router.FetchFunctionsForRoute(req);
+        // If a segment could not be found for the request, or if
+        if (handlers == nullptr) {
+            // HTTP 404 - Not Found
+            HandleError(404, req, clientSocket, clientAddress, {}, &responses);
+            return false;
+        }
+
+        HttpMethod handlerMethod = req.method;
+
+        // HEAD falls back to the GET handler, the body is dropped before sending
+        if (handlers->HasHandler(handlerMethod) == false && req.method == HttpMethod::HEAD) {
+            handlerMethod = HttpMethod::GET;
+        }
+
+        const HandlerFunction* handler = &handlers->GetHandler(handlerMethod);
+
+        // A streamed body is read on this thread, a request without one gets an empty reader
+        const bool isStreamed = handlers->GetBodyOptions(handlerMethod).isStreamed;
+        if (isStreamed && req.bodyReader == nullptr) {
+            emptyBody.emplace(clientSocket, std::string(), RequestReader::Framing::CONTENT_LENGTH, 0, 0);
+            req.bodyReader = &emptyBody.value();
+        }
+
+        // The compute pool runs the handler and sends the response, the connection goes with it
+        if (*handler != nullptr
+            && canOffload
+            && isStreamed == false
+            && m_config.computeThreads > 0
+            && handlers->GetExecution(handlerMethod) == HandlerExecution::OFFLOAD) {
+            // Earlier responses go first, the compute pool sends this one's once it's ready
+            if (NetworkIO::Send(clientSocket, responses, MSG_NOSIGNAL) == false) {
+                return false;
+            }
+            responses.clear();
+
+            // The deadline would close the socket by its number, which is about to be handed over
+            requestDeadline.Cancel();
+            m_computePool.EnqueueJob(OffloadedRequest(
+                this,
+                std::move(clientSocket),
+                clientAddress,
+                std::move(req),
+                handler,
+                std::move(permit),
+                requestNumber
+            ));
+            return false;
+        }
+
+        // A coroutine handler parks the request whenever it waits, the connection goes with it
+        const AsyncHandler* asyncHandler = (*handler != nullptr) ? handler->target<AsyncHandler>() : nullptr;
+        if (asyncHandler != nullptr && canOffload && isStreamed == false) {
+            // Earlier responses go first, this one's is sent once the coroutine finishes
+            if (NetworkIO::Send(clientSocket, responses, MSG_NOSIGNAL) == false) {
+                return false;
+            }
+            responses.clear();
+
+            requestDeadline.Cancel();
+            AsyncRequest::Start(
+                std::make_unique<AsyncRequest>(
+                    this,
+                    std::move(clientSocket),
+                    clientAddress,
+                    std::move(req),
+                    std::move(res),
+                    std::move(permit),
+                    requestNumber
+                ),
+                *asyncHandler
+            );
+            return false;
+        }
+
+        if (*handler != nullptr) {
+            (*handler)(req, res);
+        }
+        else if (req.method == HttpMethod::OPTIONS) {
+            SetOptionsResponse(req, handlers->AllowedMethods(), res);
+        }
+        else {
+            // HTTP 405 - Method not allowed
+            HandleError(405, req, clientSocket, clientAddress, handlers->AllowedMethods(), &responses);
+            return false;
+        }
+    }
+
+    // Sending the response isn't part of the handler's latency
+    permit.Release();
+
+    // The rest of a streamed body has to be read past before the next request can be
+    if (bodyReader != nullptr) {
+        if (bodyReader->ErrorStatus() != 0) {
+            HandleError(bodyReader->ErrorStatus(), req, clientSocket, clientAddress, {}, &responses);
+            return false;
+        }
+
+        // Answered as if the client had asked to close
+        if (bodyReader->Discard(maxDiscardedBodySize) == false) {
+            req.headers["Connection"] = "close";
+        }
+    }
 
-    const std::string resStr = res.Serialize();
-    NetworkIO::Send(clientSocket, resStr, 0);
+    return SendResponse(req, res, clientSocket, clientAddress, requestNumber, &responses);
+}
+
+
+/*
+    @brief Send the response to a request, once its handler has run
+    @param req Request
+    @param res Response filled in by the handler
+    @param clientSocket The socket for the client
+    @param clientAddress The address of the client
+    @param requestNumber How many requests the connection has sent, this one included
+    @param responses If set, the response is added here to be sent later instead of right away
+
+    @return `true` if the connection should be kept alive, `false` otherwise
+*/
+bool HttpServer::SendResponse(
+    const HttpRequest& req,
+    HttpResponse& res,
+    const Socket& clientSocket,
+    const sockaddr_in& clientAddress,
+    const int requestNumber,
+    std::vector<std::string>* responses
+) const {
+
+    const int maxRequests = m_config.maxRequestsPerConnection;
+    bool isKeptAlive = m_isRunning
+        && req.IsKeepAlive()
+        && (maxRequests == 0 || requestNumber < maxRequests);
+
+    if (res.bodyProducer != nullptr) {
+        return SendStreamedResponse(req, res, clientSocket, clientAddress, isKeptAlive, responses);
+    }
+
+    // Only the connection closing could mark the end of the body otherwise, and the next
+    // response would be read as part of it
+    if (isKeptAlive && res.GetHeader("Content-Length").has_value() == false) {
+        res.SetHeader("Content-Length", std::to_string(res.body.size()));
+    }
+
+    // Content-Length is left as the handler set it, a HEAD response describes the GET one
+    if (req.method == HttpMethod::HEAD) {
+        res.body.clear();
+    }
+
+    // Always explicit, an HTTP/1.0 client assumes close and an HTTP/1.1 one keep-alive
+    res.SetHeader("Connection", isKeptAlive ? "keep-alive" : "close");
+
+    std::string resStr = res.Serialize();
+    if (responses != nullptr) {
+        responses->push_back(std::move(resStr));
+    }
+    else {
+        NetworkIO::Send(clientSocket, resStr, 0);
+    }
 
     LogRequestResponse(req, res.statusCode, clientAddress, m_config);
 
     // `HttpServer::HandleConnection` keeps the connection alive based on this value
-    // Returns accordingly
-    return requestConnectionHeader.value_or("close") == "keep-alive";
-}
\ No newline at end of file
+    return isKeptAlive;
+}
+
+
+/*
+    @brief Send a response whose body is written by `res.bodyProducer`, see `HttpResponse::Stream()`
+    @param req Request
+    @param res Response filled in by the handler
+    @param clientSocket The socket for the client
+    @param clientAddress The address of the client
+    @param isKeptAlive Whether the connection would be kept alive, if the body is sent whole
+    @param responses If set, responses to earlier requests, sent ahead of this one's head
+
+    @return `true` if the connection should be kept alive, `false` otherwise
+*/
+bool HttpServer::SendStreamedResponse(
+    const HttpRequest& req,
+    HttpResponse& res,
+    const Socket& clientSocket,
+    const sockaddr_in& clientAddress,
+    bool isKeptAlive,
+    std::vector<std::string>* responses
+) const {
+
+    // A known length is sent as is, otherwise HTTP/1.1 clients get chunks, HTTP/1.0 ones
+    // read until the connection closes
+    ResponseWriter::Framing framing = ResponseWriter::Framing::UNTIL_CLOSE;
+    size_t contentLength = 0;
+
+    // Digits only, a length the body can't be held to is dropped for one of the others
+    const std::optional<std::string> contentLengthHeader = res.GetHeader("Content-Length");
+    if (contentLengthHeader.has_value()) {
+        const std::string& value = contentLengthHeader.value();
+        const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), contentLength);
+        if (value.empty() || error != std::errc() || end != value.data() + value.size()) {
+            Log::Error(std::format(
+                "HttpServer::SendStreamedResponse(): Invalid Content-Length \"{}\", dropped",
+                value
+            ));
+            res.DeleteHeader("Content-Length");
+        }
+        else {
+            framing = ResponseWriter::Framing::CONTENT_LENGTH;
+        }
+    }
+
+    if (framing == ResponseWriter::Framing::UNTIL_CLOSE && req.version == HttpVersion::HTTP_1_1) {
+        res.SetHeader("Transfer-Encoding", "chunked");
+        framing = ResponseWriter::Framing::CHUNKED;
+    }
+    else if (framing == ResponseWriter::Framing::UNTIL_CLOSE) {
+        isKeptAlive = false;
+    }
+
+    res.SetHeader("Connection", isKeptAlive ? "keep-alive" : "close");
+
+    // The head goes out along with anything batched before it, the body follows as it's written
+    std::vector<std::string> head;
+    if (responses != nullptr) {
+        head = std::move(*responses);
+        responses->clear();
+    }
+    head.push_back(res.Serialize());
+
+    bool isSent = NetworkIO::Send(clientSocket, head, MSG_NOSIGNAL);
+
+    LogRequestResponse(req, res.statusCode, clientAddress, m_config);
+
+    // Like any HEAD response, only describes the body
+    if (isSent && req.method != HttpMethod::HEAD) {
+        ResponseWriter writer(clientSocket, framing, contentLength);
+        res.bodyProducer(writer);
+        isSent = writer.Finish();
+    }
+
+    return isSent && isKeptAlive;
+}
@@ -1,7 +1,10 @@
+#include <algorithm>
+#include <climits>
 #include <format>
 #include <string.h>
 #include <string_view>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "knots/NetworkIO.hpp"
 #include "knots/utils/Log.hpp"
@@ -58,3 +61,62 @@ bool NetworkIO::Send(const Socket& socket, const std::vector<char>& buffer, cons
 
     return true;
 }
+
+/*
+    @brief Send several buffers back to back with as few system calls as possible, like
+    `writev()`, retrying until all of them are sent
+    @param socket Socket of the intended recipient
+    @param buffers The data to send, in order
+    @param flags Any flags to pass to `sendmsg()`
+
+    @return `true` if every buffer was sent successfully, `false` otherwise
+*/
+bool NetworkIO::Send(const Socket& socket, const std::vector<std::string>& buffers, const int flags) {
+    return Send(socket, std::vector<std::string_view>(buffers.begin(), buffers.end()), flags);
+}
+
+bool NetworkIO::Send(const Socket& socket, const std::vector<std::string_view>& buffers, const int flags) {
+
+    std::vector<iovec> chunks;
+    chunks.reserve(buffers.size());
+    for (const std::string_view buffer : buffers) {
+        if (buffer.empty() == false) {
+            chunks.push_back(iovec{const_cast<char*>(buffer.data()), buffer.size()});
+        }
+    }
+
+    // `sendmsg()` rather than `writev()` for the flags, ex: `MSG_NOSIGNAL`
+    size_t next = 0;
+    while (next < chunks.size()) {
+        msghdr message{};
+        message.msg_iov = chunks.data() + next;
+        message.msg_iovlen = std::min<size_t>(chunks.size() - next, IOV_MAX);
+
+        ssize_t bytesSent = sendmsg(socket.Get(), &message, flags);
+        if (bytesSent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            Log::Error(std::format(
+                "NetworkIO::Send(): Error sending {} buffers to socket {} : {}\n",
+                chunks.size() - next,
+                socket.Get(),
+                strerror(errno)
+            ));
+            return false;
+        }
+
+        // Skip past what was sent, a partial send leaves the rest of a chunk for the next round
+        while (next < chunks.size() && static_cast<size_t>(bytesSent) >= chunks[next].iov_len) {
+            bytesSent -= chunks[next].iov_len;
+            next++;
+        }
+        if (next < chunks.size()) {
+            chunks[next].iov_base = static_cast<char*>(chunks[next].iov_base) + bytesSent;
+            chunks[next].iov_len -= bytesSent;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cerrno>
+#include <sys/socket.h>
+#include <utility>
+
+#include "knots/RequestReader.hpp"
+
+RequestReader::RequestReader(
+    const Socket& socket,
+    std::string buffered,
+    const Framing framing,
+    const size_t contentLength,
+    const size_t maxBodySize,
+    std::function<void ()> onReceive
+) :
+    m_socket(socket),
+    m_framing(framing),
+    m_remaining(contentLength),
+    m_decoder(maxBodySize, maxTrailerSize),
+    m_buffer(std::move(buffered)),
+    m_onReceive(std::move(onReceive)),
+    m_bytesRead(0),
+    m_errorStatus(0),
+    m_hasFailed(false),
+    m_isComplete(false) {
+
+    // HTTP 413 - Content Too Large, known from the head alone
+    if (framing == Framing::CONTENT_LENGTH && contentLength > maxBodySize) {
+        Fail(413);
+    }
+}
+
+
+/*
+    @brief Wait for the next piece of the body
+    @return The piece, valid until the next call, or `std::nullopt` once the body has ended,
+    or can't be read any further, see `HasFailed()`
+*/
+std::optional<std::string_view> RequestReader::Read() {
+
+    while (m_isComplete == false && m_hasFailed == false) {
+
+        if (m_framing == Framing::CONTENT_LENGTH) {
+            if (m_remaining == 0) {
+                m_isComplete = true;
+                break;
+            }
+
+            // Never more than the body, so the next request stays on the socket
+            if (m_buffer.empty() && Receive(std::min(m_remaining, bufferSize)) == false) {
+                break;
+            }
+
+            const size_t length = std::min(m_remaining, m_buffer.size());
+            if (length == m_buffer.size()) {
+                m_piece.swap(m_buffer);
+                m_buffer.clear();
+            }
+            else {
+                m_piece.assign(m_buffer, 0, length);
+                m_buffer.erase(0, length);
+            }
+
+            m_remaining -= length;
+            m_bytesRead += length;
+            return m_piece;
+        }
+
+        // Anything past the end of a chunked body stays in the buffer
+        m_buffer.erase(0, m_decoder.Feed(m_buffer));
+        m_piece = m_decoder.TakeBody();
+
+        switch (m_decoder.GetStatus()) {
+            case ChunkedDecoder::Status::INCOMPLETE:
+                break;
+            case ChunkedDecoder::Status::COMPLETE:
+                m_isComplete = true;
+                break;
+            case ChunkedDecoder::Status::MALFORMED:
+                Fail(400);
+                break;
+            case ChunkedDecoder::Status::BODY_TOO_LARGE:
+                Fail(413);
+                break;
+            case ChunkedDecoder::Status::TRAILERS_TOO_LARGE:
+                Fail(431);
+                break;
+        }
+
+        if (m_hasFailed) {
+            break;
+        }
+
+        if (m_piece.empty() == false) {
+            m_bytesRead += m_piece.size();
+            return m_piece;
+        }
+
+        if (m_isComplete == false && Receive(bufferSize) == false) {
+            break;
+        }
+    }
+
+    return std::nullopt;
+}
+
+
+/*
+    @brief Read the rest of the body and drop it, ex: what a handler left unread
+    @param maxSize Most bytes to drop, a longer body isn't worth waiting for
+
+    @return `true` if the body is now complete
+*/
+bool RequestReader::Discard(const size_t maxSize) {
+
+    if (m_framing == Framing::CONTENT_LENGTH && m_remaining > maxSize) {
+        return false;
+    }
+
+    size_t discarded = 0;
+    while (discarded <= maxSize) {
+        const std::optional<std::string_view> piece = Read();
+        if (piece.has_value() == false) {
+            return m_isComplete;
+        }
+        discarded += piece->size();
+    }
+
+    return false;
+}
+
+
+/*
+    @brief Take whatever was read past the end of the body, the start of the next request
+    @return The bytes, empty if the body isn't complete
+*/
+std::string RequestReader::TakeLeftover() {
+
+    if (m_isComplete == false) {
+        return std::string();
+    }
+
+    return std::exchange(m_buffer, std::string());
+}
+
+
+/*
+    @brief Read more of the body off the socket, into the buffer
+    @param maxSize Most bytes to read
+
+    @return `false` if the client is gone, or the connection was closed by a deadline
+*/
+bool RequestReader::Receive(const size_t maxSize) {
+
+    const size_t bufferedSize = m_buffer.size();
+    m_buffer.resize(bufferedSize + maxSize);
+
+    // Timeouts on the socket only mean the client is slow, deadlines close it for good
+    ssize_t bytesReceived;
+    do {
+        bytesReceived = recv(m_socket.Get(), m_buffer.data() + bufferedSize, maxSize, 0);
+    } while (bytesReceived < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK));
+
+    m_buffer.resize(bufferedSize + std::max<ssize_t>(bytesReceived, 0));
+
+    if (bytesReceived <= 0) {
+        Fail(0);
+        return false;
+    }
+
+    if (m_onReceive) {
+        m_onReceive();
+    }
+
+    return true;
+}
+
+void RequestReader::Fail(const short int errorStatus) {
+    m_errorStatus = errorStatus;
+    m_hasFailed = true;
+    return;
+}
+
+bool RequestReader::IsComplete() const {
+    return m_isComplete;
+}
+
+bool RequestReader::HasFailed() const {
+    return m_hasFailed;
+}
+
+short int RequestReader::ErrorStatus() const {
+    return m_errorStatus;
+}
+
+size_t RequestReader::BytesRead() const {
+    return m_bytesRead;
+}
+
+const Headers& RequestReader::Trailers() const {
+    return m_decoder.Trailers();
+}
@@ -0,0 +1,154 @@
+#include <format>
+#include <sys/socket.h>
+#include <vector>
+
+#include "knots/NetworkIO.hpp"
+#include "knots/ResponseWriter.hpp"
+#include "knots/utils/Log.hpp"
+
+ResponseWriter::ResponseWriter(const Socket& socket, const Framing framing, const size_t contentLength) :
+    m_socket(socket),
+    m_framing(framing),
+    m_contentLength(contentLength),
+    m_bytesWritten(0),
+    m_hasFailed(false),
+    m_isFinished(false) {
+
+    m_buffer.reserve(bufferSize);
+}
+
+
+/*
+    @brief Add the next piece of the body, sending what has gathered once it passes `bufferSize`
+    @param data The piece
+
+    @return `false` if the client is gone or the body would pass its length, after which
+    every write fails and the producer should stop
+*/
+bool ResponseWriter::Write(const std::string_view data) {
+
+    if (m_hasFailed || m_isFinished) {
+        return false;
+    }
+
+    if (m_framing == Framing::CONTENT_LENGTH && m_bytesWritten + data.size() > m_contentLength) {
+        Log::Error(std::format(
+            "ResponseWriter::Write(): Body passes its Content-Length of {} bytes",
+            m_contentLength
+        ));
+        m_hasFailed = true;
+        return false;
+    }
+
+    m_bytesWritten += data.size();
+
+    // A piece too large for the buffer goes out as it is, right after what gathered before it
+    if (m_buffer.size() + data.size() > bufferSize) {
+        if (SendPiece(m_buffer) == false) {
+            return false;
+        }
+        m_buffer.clear();
+
+        if (data.size() >= bufferSize) {
+            return SendPiece(data);
+        }
+    }
+
+    m_buffer.append(data);
+    return true;
+}
+
+/*
+    @brief Send what has gathered so far right away, ex: for events the client waits on
+
+    @return `false` if the client is gone
+*/
+bool ResponseWriter::Flush() {
+
+    if (m_hasFailed || m_isFinished) {
+        return false;
+    }
+
+    const bool isSent = SendPiece(m_buffer);
+    m_buffer.clear();
+    return isSent;
+}
+
+
+/*
+    @brief End the body, called once the producer returns
+
+    @return `true` if the whole body was sent, and the connection can be reused
+*/
+bool ResponseWriter::Finish() {
+
+    if (m_hasFailed || m_isFinished) {
+        return false;
+    }
+
+    if (Flush() == false) {
+        return false;
+    }
+    m_isFinished = true;
+
+    if (m_framing == Framing::CONTENT_LENGTH && m_bytesWritten != m_contentLength) {
+        Log::Error(std::format(
+            "ResponseWriter::Finish(): Body ended after {} of its {} bytes",
+            m_bytesWritten,
+            m_contentLength
+        ));
+        m_hasFailed = true;
+        return false;
+    }
+
+    if (m_framing == Framing::CHUNKED) {
+        // The last chunk, with no trailers
+        m_hasFailed = (NetworkIO::Send(m_socket, std::string("0\r\n\r\n"), MSG_NOSIGNAL) == false);
+    }
+
+    // Only the connection closing can end the body
+    if (m_framing == Framing::UNTIL_CLOSE) {
+        return false;
+    }
+
+    return m_hasFailed == false;
+}
+
+
+/*
+    @brief Send a piece of the body, as one chunk when chunked
+    @param data The piece
+
+    @return `false` if the client is gone
+*/
+bool ResponseWriter::SendPiece(const std::string_view data) {
+
+    if (data.empty()) {
+        return true;
+    }
+
+    const std::string chunkSize = std::format("{:x}\r\n", data.size());
+
+    std::vector<std::string_view> pieces;
+    if (m_framing == Framing::CHUNKED) {
+        pieces = {chunkSize, data, "\r\n"};
+    }
+    else {
+        pieces = {data};
+    }
+
+    // Blocks while the client is behind on reading, holding the producer back
+    if (NetworkIO::Send(m_socket, pieces, MSG_NOSIGNAL) == false) {
+        m_hasFailed = true;
+    }
+
+    return m_hasFailed == false;
+}
+
+bool ResponseWriter::HasFailed() const {
+    return m_hasFailed;
+}
+
+size_t ResponseWriter::BytesWritten() const {
+    return m_bytesWritten;
+}
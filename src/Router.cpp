@@ -1,56 +1,347 @@
+#include <bit>
+
+#include "knots/ConcurrencyLimiter.hpp"
 #include "knots/Router.hpp"
 #include "knots/utils/Log.hpp"
 
+AsyncHandler::AsyncHandler(AsyncHandlerFunction handler) :
+    m_handler(std::move(handler))
+{}
+
+Task<void> AsyncHandler::MakeTask(const HttpRequest& req, HttpResponse& res) const {
+    return m_handler(req, res);
+}
+
+void AsyncHandler::operator()(const HttpRequest& req, HttpResponse& res) const {
+    MakeTask(req, res).Run();
+    return;
+}
+
+
+HandlerTable::HandlerTable() :
+    m_handlers{},
+    m_functionPointers{},
+    m_mountedTables{},
+    m_retryAfterSeconds(1)
+{}
+
+const HandlerFunction* HandlerTable::Intern(const HandlerFunction& handler) {
+
+    const HandlerFunctionPointer* functionPointer = handler.target<HandlerFunctionPointer>();
+
+    if (functionPointer != nullptr) {
+        const auto it = m_functionPointers.find(*functionPointer);
+        if (it != m_functionPointers.end()) {
+            return it->second;
+        }
+    }
+
+    const HandlerFunction* interned = &m_handlers.emplace_back(handler);
+
+    if (functionPointer != nullptr) {
+        m_functionPointers.insert(std::make_pair(*functionPointer, interned));
+    }
+
+    return interned;
+}
+
+void HandlerTable::KeepAlive(std::shared_ptr<HandlerTable> table) {
+    m_mountedTables.push_back(std::move(table));
+    return;
+}
+
+void HandlerTable::SetRetryAfterSeconds(const int retryAfterSeconds) {
+
+    m_retryAfterSeconds = retryAfterSeconds;
+
+    // Routes of mounted routers read it from their own table
+    for (const std::shared_ptr<HandlerTable>& table : m_mountedTables) {
+        table->SetRetryAfterSeconds(retryAfterSeconds);
+    }
+
+    return;
+}
+
+int HandlerTable::GetRetryAfterSeconds() const {
+    return m_retryAfterSeconds;
+}
+
+size_t HandlerTable::Size() const {
+    return m_handlers.size();
+}
+
+
 SegmentHandlerFunctions::SegmentHandlerFunctions() :
-    m_post(nullptr),
-    m_get(nullptr),
-    m_head(nullptr),
-    m_put(nullptr),
-    m_delete(nullptr),
-    m_connect(nullptr),
-    m_options(nullptr),
-    m_trace(nullptr),
-    m_patch(nullptr)
+    m_methodMask(0),
+    m_offloadMask(0),
+    m_streamBodyMask(0),
+    m_handlers{},
+    m_maxBodySizes{}
 {}
 
 const HandlerFunction& SegmentHandlerFunctions::GetHandler(const HttpMethod method) const {
-    switch (method) {
-        case HttpMethod::POST:            return m_post;
-        case HttpMethod::GET:             return m_get;
-        case HttpMethod::HEAD:            return m_head;
-        case HttpMethod::PUT:             return m_put;
-        case HttpMethod::DELETE:          return m_delete;
-        case HttpMethod::CONNECT:         return m_connect;
-        case HttpMethod::OPTIONS:         return m_options;
-        case HttpMethod::TRACE:           return m_trace;
-        case HttpMethod::PATCH:           return m_patch;
-        case HttpMethod::DEFAULT_INVALID: break;
-    }
-
-    throw std::invalid_argument(Log::MakeErrorMessage(
-        "Invalid HttpMethod passed when querying segment for handler function")
-    );
+
+    if (method == HttpMethod::DEFAULT_INVALID) {
+        throw std::invalid_argument(Log::MakeErrorMessage(
+            "Invalid HttpMethod passed when querying segment for handler function")
+        );
+    }
+
+    static const HandlerFunction noHandler = nullptr;
+
+    const uint16_t bit = MethodBit(method);
+    if ((m_methodMask & bit) == 0) {
+        return noHandler;
+    }
+
+    // Handlers are stored in bit order, so the index is the number of set bits below this one
+    return *m_handlers[std::popcount(static_cast<uint16_t>(m_methodMask & (bit - 1)))];
 }
 
-void SegmentHandlerFunctions::SetHandler(const HttpMethod method, const HandlerFunction& handler) {
+void SegmentHandlerFunctions::SetHandler(
+    const HttpMethod method,
+    const HandlerFunction* handler,
+    const HandlerExecution execution,
+    const BodyOptions& bodyOptions
+) {
+
+    if (method == HttpMethod::DEFAULT_INVALID || handler == nullptr) {
+        return;
+    }
+
+    const uint16_t bit = MethodBit(method);
+    const size_t index = std::popcount(static_cast<uint16_t>(m_methodMask & (bit - 1)));
+
+    if (execution == HandlerExecution::OFFLOAD) {
+        m_offloadMask |= bit;
+    }
+    else {
+        m_offloadMask &= ~bit;
+    }
+
+    if (bodyOptions.isStreamed) {
+        m_streamBodyMask |= bit;
+    }
+    else {
+        m_streamBodyMask &= ~bit;
+    }
 
-    switch (method) {
-        case HttpMethod::POST:            m_post = handler;    break;
-        case HttpMethod::GET:             m_get = handler;     break;
-        case HttpMethod::HEAD:            m_head = handler;    break;
-        case HttpMethod::PUT:             m_put = handler;     break;
-        case HttpMethod::DELETE:          m_delete = handler;  break;
-        case HttpMethod::CONNECT:         m_connect = handler; break;
-        case HttpMethod::OPTIONS:         m_options = handler; break;
-        case HttpMethod::TRACE:           m_trace = handler;   break;
-        case HttpMethod::PATCH:           m_patch = handler;   break;
-        case HttpMethod::DEFAULT_INVALID: break;
+    const bool isReplaced = (m_methodMask & bit) != 0;
+    if (isReplaced) {
+        m_handlers[index] = handler;
+    }
+    else {
+        m_handlers.insert(m_handlers.begin() + index, handler);
+        m_methodMask |= bit;
+    }
+
+    // Only laid out once some handler has a limit
+    if (m_maxBodySizes.empty() && bodyOptions.maxBodySize == 0) {
+        return;
+    }
+    if (m_maxBodySizes.empty()) {
+        m_maxBodySizes.resize(m_handlers.size() - 1, 0);
+        m_maxBodySizes.insert(m_maxBodySizes.begin() + index, bodyOptions.maxBodySize);
+    }
+    else if (isReplaced) {
+        m_maxBodySizes[index] = bodyOptions.maxBodySize;
+    }
+    else {
+        m_maxBodySizes.insert(m_maxBodySizes.begin() + index, bodyOptions.maxBodySize);
     }
 
     return;
 }
 
-Router::Router() {
+HandlerExecution SegmentHandlerFunctions::GetExecution(const HttpMethod method) const {
+    return (m_offloadMask & MethodBit(method)) ? HandlerExecution::OFFLOAD : HandlerExecution::INLINE;
+}
+
+BodyOptions SegmentHandlerFunctions::GetBodyOptions(const HttpMethod method) const {
+
+    const uint16_t bit = MethodBit(method);
+    if ((m_methodMask & bit) == 0) {
+        return {};
+    }
+
+    BodyOptions options;
+    options.isStreamed = (m_streamBodyMask & bit) != 0;
+    if (m_maxBodySizes.empty() == false) {
+        options.maxBodySize = m_maxBodySizes[std::popcount(static_cast<uint16_t>(m_methodMask & (bit - 1)))];
+    }
+
+    return options;
+}
+
+bool SegmentHandlerFunctions::HasHandler(const HttpMethod method) const {
+    return (m_methodMask & MethodBit(method)) != 0;
+}
+
+bool SegmentHandlerFunctions::IsEmpty() const {
+    return m_methodMask == 0;
+}
+
+uint16_t SegmentHandlerFunctions::AllowedMethodMask() const {
+    return AllowedMethodMaskFor(m_methodMask);
+}
+
+uint16_t SegmentHandlerFunctions::AllowedMethodMaskFor(const uint16_t methodMask) {
+
+    uint16_t mask = methodMask | MethodBit(HttpMethod::OPTIONS);
+
+    // HEAD is answered by the GET handler if there's no HEAD handler of its own
+    if (methodMask & MethodBit(HttpMethod::GET)) {
+        mask |= MethodBit(HttpMethod::HEAD);
+    }
+
+    return mask;
+}
+
+const std::string& SegmentHandlerFunctions::AllowedMethods() const {
+    return AllowedMethodsFor(AllowedMethodMask());
+}
+
+const std::string& SegmentHandlerFunctions::AllowedMethodsFor(const uint16_t allowedMask) {
+
+    // One string for every possible mask, built the first time any is asked for
+    static const std::vector<std::string> allowedMethods = [] () {
+        const size_t maskCount = MethodBit(HttpMethod::DEFAULT_INVALID);
+        std::vector<std::string> result(maskCount);
+
+        for (size_t mask = 0; mask < maskCount; mask++) {
+            for (int i = static_cast<int>(HttpMethod::GET); i < static_cast<int>(HttpMethod::DEFAULT_INVALID); i++) {
+                const HttpMethod method = static_cast<HttpMethod>(i);
+                if ((mask & MethodBit(method)) == 0) {
+                    continue;
+                }
+
+                if (result[mask].empty() == false) {
+                    result[mask] += ", ";
+                }
+                result[mask] += std::format("{}", method);
+            }
+        }
+
+        return result;
+    } ();
+
+    return allowedMethods[allowedMask];
+}
+
+
+/*
+    @brief Wrap `handler` in `middlewares`, so calling the result runs the whole chain
+    @param middlewares Middleware to wrap with, the first one ends up outermost
+    @param handler Handler at the end of the chain
+
+    @return The composed handler
+*/
+HandlerFunction ComposeMiddleware(const std::vector<Middleware>& middlewares, HandlerFunction handler) {
+
+    // Middleware calls `next` and waits for it, so there is nowhere to park the coroutine
+    if (middlewares.empty() == false && handler.target<AsyncHandler>() != nullptr) {
+        Log::Warning(
+            "Router: An AsyncHandler behind middleware runs to completion on its thread, "
+            "its awaits block that thread instead of parking the request"
+        );
+    }
+
+    for (auto it = middlewares.rbegin(); it != middlewares.rend(); it++) {
+        handler = [middleware = *it, next = std::move(handler)] (
+            const HttpRequest& req,
+            HttpResponse& res
+        ) {
+            middleware(req, res, next);
+        };
+    }
+
+    return handler;
+}
+
+/*
+    @brief Wrap a handler so only `options.maxConcurrentRequests` requests run it at once
+    @param options Options of the route
+    @param table Table the wrapped handler goes into, holds the "Retry-After" to send
+    @param handler Handler to wrap
+
+    @return Handler that runs `handler`, or answers with a 503 if the route stays full
+    for longer than `options.queueTimeoutMs`
+*/
+HandlerFunction LimitConcurrency(const RouteOptions& options, const HandlerTable& table, HandlerFunction handler) {
+
+    std::shared_ptr<ConcurrencyLimiter> limiter = std::make_shared<ConcurrencyLimiter>(
+        options.maxConcurrentRequests,
+        options.maxConcurrentRequests,
+        ConcurrencyLimiter::Clock::duration::zero(),
+        options.maxQueuedRequests
+    );
+    const std::chrono::milliseconds queueTimeout(options.queueTimeoutMs);
+
+    // Same as the server's own 503 when overloaded, the table outlives its entries, this one included
+    const auto rejectFull = [&table] (HttpResponse& res) {
+        res.SetStatus(503);
+        res.SetHeader("Retry-After", std::to_string(table.GetRetryAfterSeconds()));
+        res.SetBody(std::string());
+    };
+
+    // A coroutine stays one, holding its slot while it is parked, so the server can still park it
+    const AsyncHandler* asyncHandler = handler.target<AsyncHandler>();
+    if (asyncHandler != nullptr) {
+        return AsyncHandler([limiter, queueTimeout, rejectFull, inner = *asyncHandler] (
+            const HttpRequest& req,
+            HttpResponse& res
+        ) -> Task<void> {
+            const ConcurrencyLimiter::Permit permit = limiter->Acquire(queueTimeout);
+
+            if (permit.IsHeld() == false) {
+                rejectFull(res);
+                co_return;
+            }
+
+            co_await inner.MakeTask(req, res);
+        });
+    }
+
+    return [limiter, queueTimeout, rejectFull, handler = std::move(handler)] (
+        const HttpRequest& req,
+        HttpResponse& res
+    ) {
+        const ConcurrencyLimiter::Permit permit = limiter->Acquire(queueTimeout);
+
+        if (permit.IsHeld() == false) {
+            rejectFull(res);
+            return;
+        }
+
+        handler(req, res);
+    };
+}
+
+/*
+    @brief Deep copy a route tree
+    @param node Root of the tree to copy
+
+    @return Root of the copy
+*/
+std::shared_ptr<UrlSegment> CloneTree(const UrlSegment& node) {
+
+    std::shared_ptr<UrlSegment> copy = std::make_shared<UrlSegment>(node.value);
+    copy->handlers = node.handlers;
+
+    copy->next.reserve(node.next.size());
+    for (const std::shared_ptr<UrlSegment>& nextNode : node.next) {
+        copy->next.push_back(CloneTree(*nextNode));
+    }
+
+    return copy;
+}
+
+
+Router::Router() :
+    m_handlerTable(std::make_shared<HandlerTable>()),
+    m_compiledRoutes(nullptr),
+    m_middlewares{},
+    m_isFrozen(false) {
     // Make an empty root segment
     m_dynamicRoutesTreeRoot = std::make_shared<UrlSegment>(
         "/"
@@ -59,15 +350,46 @@ Router::Router() {
     return;
 };
 
-std::vector<UrlSegment> BreakRouteIntoSegments(const std::string& requestUrl) {
+Router::Router(const Router& other) :
+    m_staticRoutes(other.m_staticRoutes),
+    m_dynamicRoutesTreeRoot(CloneTree(*other.m_dynamicRoutesTreeRoot)),
+    m_handlerTable(other.m_handlerTable),
+    m_compiledRoutes(other.m_compiledRoutes),
+    m_middlewares(other.m_middlewares),
+    m_isFrozen(other.m_isFrozen)
+{}
+
+Router& Router::operator=(const Router& other) {
 
-    std::vector<UrlSegment> res;
+    if (this == &other) {
+        return *this;
+    }
+
+    m_staticRoutes = other.m_staticRoutes;
+    m_dynamicRoutesTreeRoot = CloneTree(*other.m_dynamicRoutesTreeRoot);
+    m_handlerTable = other.m_handlerTable;
+    m_compiledRoutes = other.m_compiledRoutes;
+    m_middlewares = other.m_middlewares;
+    m_isFrozen = other.m_isFrozen;
+
+    return *this;
+}
+
+/*
+    @brief Split a URL into its segments, ex: "/users/100" -> {"/", "users", "100"}
+    @param requestUrl URL to split
+
+    @return Views into `requestUrl`, valid only as long as it is
+*/
+std::vector<std::string_view> BreakRouteIntoSegments(const std::string& requestUrl) {
+
+    std::vector<std::string_view> res;
 
     size_t findFromPosition = 0;
     const size_t urlLength = requestUrl.size();
 
     // The root endpoint should be before everything
-    res.push_back(UrlSegment("/"));
+    res.push_back("/");
 
     if (requestUrl.size() == 1) {
         return res;
@@ -85,13 +407,13 @@ std::vector<UrlSegment> BreakRouteIntoSegments(const std::string& requestUrl) {
             );
         } ();
 
-        res.push_back(UrlSegment(requestUrl.substr(left + 1, right - left)));
+        res.push_back(std::string_view(requestUrl).substr(left + 1, right - left));
 
         findFromPosition = right + 1;
     }
 
     // In case of trailing `/`s in the URL, a blank segment is inserted
-    if (res.back().value == "") {
+    if (res.back().empty()) {
         res.pop_back();
     }
 
@@ -112,13 +434,99 @@ bool IsRouteStatic(const std::string& requestUrl) {
     return requestUrl.find('{') == std::string::npos;
 }
 
+/*
+    @brief Find a dynamic or wildcard segment already in the tree that would shadow the route's
+    @param root Root of the dynamic routes tree
+    @param routeSegments Segments of the route being added
+
+    @return The existing segment with a different parameter name at the same position, or nullptr
+*/
+const UrlSegment* FindConflictingSegment(
+    const UrlSegment& root,
+    const std::vector<std::string_view>& routeSegments
+) {
+
+    const UrlSegment* currNode = &root;
+
+    for (size_t i = 1; i < routeSegments.size(); i++) {
+        const UrlSegment segmentToAdd{std::string(routeSegments[i])};
+        const UrlSegment* nextNode = nullptr;
+
+        for (const std::shared_ptr<UrlSegment>& sibling : currNode->next) {
+            if (sibling->value == segmentToAdd.value) {
+                nextNode = sibling.get();
+            }
+            else if (
+                (segmentToAdd.isDynamic() && sibling->isDynamic()) ||
+                (segmentToAdd.isWildcard() && sibling->isWildcard())
+            ) {
+                return sibling.get();
+            }
+        }
+
+        // Nothing below a new segment can conflict
+        if (nextNode == nullptr) {
+            return nullptr;
+        }
+
+        currNode = nextNode;
+    }
+
+    return nullptr;
+}
+
+void Router::AddRoute(
+    const HttpMethod& method,
+    std::string requestUrl,
+    const HandlerFunction& handler,
+    const RouteOptions& options
+) {
+
+    if (options.maxConcurrentRequests < 0 || options.maxQueuedRequests < 0 || options.queueTimeoutMs < 0) {
+        Log::Error(std::format(
+            "Router::AddRoute(): Route options cannot be negative: {}",
+            requestUrl
+        ));
+
+        return;
+    }
+
+    const BodyOptions bodyOptions{options.maxBodySize, options.streamBody};
+
+    // The limit sits closest to the handler, middleware runs outside of it
+    const HandlerFunction limited = options.maxConcurrentRequests > 0
+        ? LimitConcurrency(options, *m_handlerTable, handler)
+        : handler;
+
+    // Once frozen, handlers get their middleware as they come in
+    if (m_isFrozen && m_middlewares.empty() == false) {
+        AddRoute(method, std::move(requestUrl), m_handlerTable->Intern(
+            ComposeMiddleware(m_middlewares, limited)
+        ), options.execution, bodyOptions);
+        return;
+    }
+
+    AddRoute(method, std::move(requestUrl), m_handlerTable->Intern(limited), options.execution, bodyOptions);
+    return;
+}
+
+/*
+    @brief Add a route whose handler has already been interned
+    @param method HTTP method
+    @param requestUrl URL of the route
+    @param handler Handler stored in `m_handlerTable`, or in a table it keeps alive
+    @param execution Where the handler runs
+    @param bodyOptions What the handler accepts as a request body
+*/
 void Router::AddRoute(
     const HttpMethod& method,
     std::string requestUrl,
-    const HandlerFunction& handler
+    const HandlerFunction* handler,
+    const HandlerExecution execution,
+    const BodyOptions& bodyOptions
 ) {
 
-    if (requestUrl[0] != '/') {
+    if (requestUrl.empty() || requestUrl[0] != '/') {
         Log::Error(std::format(
             "Router::AddRoute(): Illegal URL start, route URLs must start with a slash (/): {}",
             requestUrl
@@ -131,19 +539,40 @@ void Router::AddRoute(
 
     const Route routeToAdd(method, requestUrl);
 
-    const std::vector<UrlSegment> routeSegments = BreakRouteIntoSegments(routeToAdd.requestUrl);
+    const std::vector<std::string_view> routeSegments = BreakRouteIntoSegments(routeToAdd.requestUrl);
     const size_t numSegments = routeSegments.size();
 
+    // A wildcard swallows the rest of the URL, nothing can come after it
+    for (size_t i = 1; i + 1 < numSegments; i++) {
+        if (routeSegments[i].starts_with("{*")) {
+            Log::Error(std::format(
+                "Router::AddRoute(): Wildcard segment `{}` must be the last segment of the route: {}",
+                routeSegments[i],
+                requestUrl
+            ));
+
+            return;
+        }
+    }
+
     if (IsRouteStatic(routeToAdd.requestUrl)) {
         // Insert it into the static table
-        m_staticRoutes.insert(std::make_pair(
-            routeToAdd.requestUrl,
-            SegmentHandlerFunctions()
-        ));
-
         m_staticRoutes
-            .at(routeToAdd.requestUrl)
-            .SetHandler(routeToAdd.method, handler);
+            .try_emplace(routeToAdd.requestUrl)
+            .first->second
+            .SetHandler(routeToAdd.method, handler, execution, bodyOptions);
+
+        return;
+    }
+
+    // Two differently named parameters at the same position could never both match
+    const UrlSegment* conflictingSegment = FindConflictingSegment(*m_dynamicRoutesTreeRoot, routeSegments);
+    if (conflictingSegment != nullptr) {
+        Log::Error(std::format(
+            "Router::AddRoute(): Route conflicts with the existing segment `{}` at the same position: {}",
+            conflictingSegment->value,
+            requestUrl
+        ));
 
         return;
     }
@@ -160,13 +589,13 @@ void Router::AddRoute(
     */
     for (size_t i = 1; i < numSegments - 1; i++) {
 
-        const UrlSegment& segmentToSearchFor = routeSegments[i];
+        const std::string_view segmentToSearchFor = routeSegments[i];
         bool nextSegmentAlreadyExists = false;
 
         // Search for this segment that might be the child of the current node
         for (const std::shared_ptr<UrlSegment>& nextNode : currNode->next) {
             // If the segment already exists, just navigate to that
-            if (nextNode->value == segmentToSearchFor.value) {
+            if (nextNode->value == segmentToSearchFor) {
                 prevNode = currNode;
                 currNode = nextNode;
                 nextSegmentAlreadyExists = true;
@@ -177,7 +606,7 @@ void Router::AddRoute(
         // The segment does not exist yet, so create it
         if (nextSegmentAlreadyExists == false) {
             currNode->next.emplace_back(std::make_shared<UrlSegment>(
-                segmentToSearchFor.value
+                std::string(segmentToSearchFor)
             ));
 
             prevNode = currNode;
@@ -191,13 +620,13 @@ void Router::AddRoute(
         If it exists, just add the handler to the appropriate method
         If it does not, create a new node and add it to `currNode->next`
     */
-    const std::string& segmentValueToAdd = routeSegments.back().value;
+    const std::string_view segmentValueToAdd = routeSegments.back();
 
     bool segmentAlreadyExists = false;
     for (const std::shared_ptr<UrlSegment>& nextNode : currNode->next) {
         if (nextNode->value == segmentValueToAdd) {
             segmentAlreadyExists = true;
-            nextNode->handlers.SetHandler(routeToAdd.method, handler);
+            nextNode->handlers.SetHandler(routeToAdd.method, handler, execution, bodyOptions);
             break;
         }
     }
@@ -205,9 +634,9 @@ void Router::AddRoute(
     // If the segment doesn't exist yet, create a new one
     if (segmentAlreadyExists == false) {
         const std::shared_ptr<UrlSegment> newNode = std::make_shared<UrlSegment>(
-            segmentValueToAdd
+            std::string(segmentValueToAdd)
         );
-        newNode->handlers.SetHandler(routeToAdd.method, handler);
+        newNode->handlers.SetHandler(routeToAdd.method, handler, execution, bodyOptions);
         currNode->next.push_back(newNode);
     }
 
@@ -217,62 +646,97 @@ void Router::AddRoute(
 
 const UrlSegment* Router::FindSegmentForRoute(HttpRequest& req) const {
 
-    const Route routeToFind(req.method, req.requestUrl);
-    const std::vector<UrlSegment> segmentedRoute = BreakRouteIntoSegments(routeToFind.requestUrl);
+    const std::vector<std::string_view> segmentedRoute = BreakRouteIntoSegments(req.requestUrl);
     const size_t numSegments = segmentedRoute.size();
 
-    // Handle case for root ("/") query
-    if (numSegments == 1) {
-        if (segmentedRoute[0].value == "/") {
-            return m_dynamicRoutesTreeRoot.get();
-        }
-        return nullptr;
-    }
+    /*
+        Route parameters picked up on the way down
+        These are only written to `req` once the match is final, since falling back to a
+        wildcard discards whatever was captured below it
+    */
+    std::vector<std::pair<std::string, std::string>> routeParams;
 
-    std::shared_ptr<UrlSegment> parent = m_dynamicRoutesTreeRoot;
+    // Nearest wildcard seen so far, and the segment it would start matching from
+    const UrlSegment* fallbackWildcard = nullptr;
+    size_t fallbackSegmentIndex = 0;
+    size_t fallbackParamCount = 0;
 
-    bool nextStaticNodeFound  = false;
-    bool nextDynamicNodeFound = false;
+    const UrlSegment* parent = m_dynamicRoutesTreeRoot.get();
+    bool reachedLastSegment = true;
 
     // `parent` will be pointing to the potential parent of whatever segment we're searching for
     for (size_t i = 1; i < numSegments; i++) {
+        const UrlSegment* staticNode = nullptr;
+        const UrlSegment* dynamicNode = nullptr;
+        const UrlSegment* wildcardNode = nullptr;
+
+        // AddRoute() rejects a second parameter name at the same position, the first one found is kept
         for (const std::shared_ptr<UrlSegment>& nextNode : parent->next) {
-            if (nextNode->value == segmentedRoute[i].value) {
-                nextStaticNodeFound = true;
-                parent = nextNode;
-                continue;
+            if (nextNode->isWildcard()) {
+                wildcardNode = wildcardNode == nullptr ? nextNode.get() : wildcardNode;
+            }
+            else if (nextNode->isDynamic()) {
+                dynamicNode = dynamicNode == nullptr ? nextNode.get() : dynamicNode;
+            }
+            else if (nextNode->value == segmentedRoute[i]) {
+                staticNode = nextNode.get();
             }
         }
 
-        if (nextStaticNodeFound == false) {
-            for (const std::shared_ptr<UrlSegment>& nextNode : parent->next) {
-                if (nextNode->isDynamic()) {
-                    nextDynamicNodeFound = true;
-                    parent = nextNode;
+        if (wildcardNode != nullptr) {
+            fallbackWildcard = wildcardNode;
+            fallbackSegmentIndex = i;
+            fallbackParamCount = routeParams.size();
+        }
 
-                    std::string routeParameterKey = nextNode->value.substr(1);
-                    routeParameterKey.pop_back();
+        // Static over dynamic, the wildcard is only used as a fallback
+        if (staticNode != nullptr) {
+            parent = staticNode;
+        }
+        else if (dynamicNode != nullptr) {
+            routeParams.emplace_back(dynamicNode->ParameterName(), segmentedRoute[i]);
+            parent = dynamicNode;
+        }
+        else {
+            reachedLastSegment = false;
+            break;
+        }
+    }
 
-                    // Substitute route parameter here
-                    req.routeParams.insert(std::make_pair(
-                        routeParameterKey,
-                        segmentedRoute[i].value
-                    ));
+    if (reachedLastSegment) {
+        if (parent->handlers.IsEmpty() == false) {
+            req.routeParams.insert(routeParams.begin(), routeParams.end());
+            return parent;
+        }
 
-                    continue;
-                }
+        // A wildcard directly below also matches an empty remainder, ex: `/files/{*path}` for "/files"
+        for (const std::shared_ptr<UrlSegment>& nextNode : parent->next) {
+            if (nextNode->isWildcard()) {
+                fallbackWildcard = nextNode.get();
+                fallbackSegmentIndex = numSegments;
+                fallbackParamCount = routeParams.size();
+                break;
             }
         }
+    }
 
-        if (nextStaticNodeFound == false && nextDynamicNodeFound == false) {
-            return nullptr;
-        }
+    if (fallbackWildcard == nullptr) {
+        return nullptr;
+    }
 
-        nextStaticNodeFound = false;
-        nextDynamicNodeFound = false;
+    std::string remainder;
+    for (size_t i = fallbackSegmentIndex; i < numSegments; i++) {
+        if (i != fallbackSegmentIndex) {
+            remainder += '/';
+        }
+        remainder += segmentedRoute[i];
     }
 
-    return parent.get();
+    routeParams.resize(fallbackParamCount);
+    routeParams.emplace_back(fallbackWildcard->ParameterName(), std::move(remainder));
+    req.routeParams.insert(routeParams.begin(), routeParams.end());
+
+    return fallbackWildcard;
 }
 
 
@@ -304,48 +768,250 @@ const SegmentHandlerFunctions* Router::FetchFunctionsForRoute(
 }
 
 
+CompiledRoutes::MatchResult Router::DispatchCompiledRoutes(
+    HttpRequest& req,
+    HttpResponse& res,
+    uint16_t* methodMask
+) const {
+
+    if (m_compiledRoutes == nullptr) {
+        return CompiledRoutes::MatchResult::NOT_FOUND;
+    }
+
+    return m_compiledRoutes(req, res, methodMask);
+}
+
+
+/*
+    @brief Add every route of `subRouter` under the given prefix
+    @param prefix URL prefix to mount at, ex: "/api/v2"
+    @param subRouter Router whose routes to add
+*/
+void Router::Mount(std::string prefix, const Router& subRouter) {
+
+    if (prefix.empty() || prefix[0] != '/') {
+        Log::Error(std::format(
+            "Router::Mount(): Illegal prefix start, prefixes must start with a slash (/): {}",
+            prefix
+        ));
+
+        return;
+    }
+
+    if (prefix.find("{*") != std::string::npos) {
+        Log::Error(std::format(
+            "Router::Mount(): Prefix cannot contain a wildcard segment: {}",
+            prefix
+        ));
+
+        return;
+    }
+
+    if (&subRouter == this) {
+        Log::Error("Router::Mount(): Cannot mount a router onto itself");
+        return;
+    }
+
+    SanitizeURL(prefix);
+
+    const auto joinUrl = [&prefix] (const std::string& url) {
+        if (prefix == "/") {
+            return url;
+        }
+        if (url == "/") {
+            return prefix;
+        }
+
+        return prefix + url;
+    };
+
+    static constexpr HttpMethod methods[] = {
+        HttpMethod::GET, HttpMethod::HEAD, HttpMethod::POST,
+        HttpMethod::PUT, HttpMethod::DELETE, HttpMethod::CONNECT,
+        HttpMethod::OPTIONS, HttpMethod::TRACE, HttpMethod::PATCH
+    };
+
+    // Point at the sub router's handlers instead of copying them
+    m_handlerTable->KeepAlive(subRouter.m_handlerTable);
+
+    /*
+        Handlers only need composing if either router has middleware that isn't applied yet
+        The sub router's middleware goes inside this router's
+    */
+    const bool composeSubMiddleware = subRouter.m_isFrozen == false && subRouter.m_middlewares.empty() == false;
+    const bool composeOwnMiddleware = m_isFrozen && m_middlewares.empty() == false;
+
+    std::unordered_map<const HandlerFunction*, const HandlerFunction*> composedHandlers;
+    const auto resolveHandler = [&] (const HandlerFunction* handler) {
+        if (composeSubMiddleware == false && composeOwnMiddleware == false) {
+            return handler;
+        }
+
+        const auto [it, inserted] = composedHandlers.try_emplace(handler, nullptr);
+        if (inserted) {
+            HandlerFunction composed = *handler;
+            if (composeSubMiddleware) {
+                composed = ComposeMiddleware(subRouter.m_middlewares, std::move(composed));
+            }
+            if (composeOwnMiddleware) {
+                composed = ComposeMiddleware(m_middlewares, std::move(composed));
+            }
+
+            it->second = m_handlerTable->Intern(composed);
+        }
+
+        return it->second;
+    };
+
+    const auto addRoutes = [this, &joinUrl, &resolveHandler] (
+        const std::string& url,
+        const SegmentHandlerFunctions& handlers
+    ) {
+        for (const HttpMethod method : methods) {
+            if (handlers.HasHandler(method)) {
+                AddRoute(
+                    method,
+                    joinUrl(url),
+                    resolveHandler(&handlers.GetHandler(method)),
+                    handlers.GetExecution(method),
+                    handlers.GetBodyOptions(method)
+                );
+            }
+        }
+    };
+
+    for (const auto& [url, handlers] : subRouter.m_staticRoutes) {
+        addRoutes(url, handlers);
+    }
+
+    // Walk the dynamic tree, rebuilding the URL of every node on the way down
+    std::vector<std::pair<const UrlSegment*, std::string>> toVisit;
+    for (const std::shared_ptr<UrlSegment>& node : subRouter.m_dynamicRoutesTreeRoot->next) {
+        toVisit.emplace_back(node.get(), "/" + node->value);
+    }
+
+    while (toVisit.empty() == false) {
+        const auto [node, url] = std::move(toVisit.back());
+        toVisit.pop_back();
+
+        addRoutes(url, node->handlers);
+
+        for (const std::shared_ptr<UrlSegment>& nextNode : node->next) {
+            toVisit.emplace_back(nextNode.get(), url + "/" + nextNode->value);
+        }
+    }
+
+    return;
+}
+
+
+void Router::Use(const Middleware& middleware) {
+
+    if (m_isFrozen) {
+        Log::Error("Router::Use(): Cannot add middleware to a router that has been frozen");
+        return;
+    }
+
+    if (middleware == nullptr) {
+        Log::Error("Router::Use(): Middleware is empty");
+        return;
+    }
+
+    m_middlewares.push_back(middleware);
+    return;
+}
+
+
+void Router::Freeze(const int retryAfterSeconds) {
+
+    m_handlerTable->SetRetryAfterSeconds(retryAfterSeconds);
+
+    if (m_isFrozen) {
+        return;
+    }
+
+    m_isFrozen = true;
+
+    if (m_middlewares.empty()) {
+        return;
+    }
+
+    // Handlers shared between routes are composed only once
+    std::unordered_map<const HandlerFunction*, const HandlerFunction*> composedHandlers;
+
+    const auto composeHandlers = [this, &composedHandlers] (SegmentHandlerFunctions& handlers) {
+        for (const HandlerFunction*& handler : handlers.m_handlers) {
+            const auto [it, inserted] = composedHandlers.try_emplace(handler, nullptr);
+            if (inserted) {
+                it->second = m_handlerTable->Intern(ComposeMiddleware(m_middlewares, *handler));
+            }
+
+            handler = it->second;
+        }
+    };
+
+    for (auto& [url, handlers] : m_staticRoutes) {
+        composeHandlers(handlers);
+    }
+
+    std::vector<UrlSegment*> toVisit = {m_dynamicRoutesTreeRoot.get()};
+    while (toVisit.empty() == false) {
+        UrlSegment* node = toVisit.back();
+        toVisit.pop_back();
+
+        composeHandlers(node->handlers);
+
+        for (const std::shared_ptr<UrlSegment>& nextNode : node->next) {
+            toVisit.push_back(nextNode.get());
+        }
+    }
+
+    return;
+}
+
+
 // Individual functions for request types
-void Router::Post(const std::string& requestUrl, const HandlerFunction& handler) {
-    this->AddRoute(HttpMethod::POST, requestUrl, handler);
+void Router::Post(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options) {
+    this->AddRoute(HttpMethod::POST, requestUrl, handler, options);
     return;
 };
 
-void Router::Get(const std::string& requestUrl, const HandlerFunction& handler) {
-    this->AddRoute(HttpMethod::GET, requestUrl, handler);
+void Router::Get(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options) {
+    this->AddRoute(HttpMethod::GET, requestUrl, handler, options);
     return;
 };
 
-void Router::Head(const std::string& requestUrl, const HandlerFunction& handler) {
-    this->AddRoute(HttpMethod::HEAD, requestUrl, handler);
+void Router::Head(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options) {
+    this->AddRoute(HttpMethod::HEAD, requestUrl, handler, options);
     return;
 };
 
-void Router::Put(const std::string& requestUrl, const HandlerFunction& handler) {
-    this->AddRoute(HttpMethod::PUT, requestUrl, handler);
+void Router::Put(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options) {
+    this->AddRoute(HttpMethod::PUT, requestUrl, handler, options);
     return;
 };
 
-void Router::Delete(const std::string& requestUrl, const HandlerFunction& handler) {
-    this->AddRoute(HttpMethod::DELETE, requestUrl, handler);
+void Router::Delete(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options) {
+    this->AddRoute(HttpMethod::DELETE, requestUrl, handler, options);
     return;
 };
 
-void Router::Connect(const std::string& requestUrl, const HandlerFunction& handler) {
-    this->AddRoute(HttpMethod::CONNECT, requestUrl, handler);
+void Router::Connect(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options) {
+    this->AddRoute(HttpMethod::CONNECT, requestUrl, handler, options);
     return;
 };
 
-void Router::Options(const std::string& requestUrl, const HandlerFunction& handler) {
-    this->AddRoute(HttpMethod::OPTIONS, requestUrl, handler);
+void Router::Options(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options) {
+    this->AddRoute(HttpMethod::OPTIONS, requestUrl, handler, options);
     return;
 };
 
-void Router::Trace(const std::string& requestUrl, const HandlerFunction& handler) {
-    this->AddRoute(HttpMethod::TRACE, requestUrl, handler);
+void Router::Trace(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options) {
+    this->AddRoute(HttpMethod::TRACE, requestUrl, handler, options);
     return;
 };
 
-void Router::Patch(const std::string& requestUrl, const HandlerFunction& handler) {
-    this->AddRoute(HttpMethod::PATCH, requestUrl, handler);
+void Router::Patch(const std::string& requestUrl, const HandlerFunction& handler, const RouteOptions& options) {
+    this->AddRoute(HttpMethod::PATCH, requestUrl, handler, options);
     return;
 };
@@ -73,6 +73,28 @@ void StaticRoutes::AddStaticFile(
         }
     );
 
+    // HEAD only needs the size, so the file is never read
+    router.Head(route,
+        [path] (const HttpRequest& req, HttpResponse& res) {
+
+            std::error_code errorCode;
+            const uintmax_t fileSize = fs::file_size(path, errorCode);
+
+            if (path.extension() == ".js") {
+                res.SetHeader("Content-Type", "text/javascript");
+            }
+
+            if (errorCode) {
+                res.SetStatus(404);
+                return;
+            }
+
+            res.SetHeader("Content-Length", std::to_string(fileSize));
+            res.SetStatus(200);
+            return;
+        }
+    );
+
     return;
 }
 
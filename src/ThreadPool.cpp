@@ -1,19 +1,139 @@
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <format>
 #include <mutex>
+#include <numeric>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
 
 #include "knots/ThreadPool.hpp"
+#include "knots/utils/Log.hpp"
+
+/*
+    @brief Current time on a monotonic clock, in nanoseconds
+*/
+static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+}
+
+/*
+    Order in which a worker looks at the priority lanes first, one round of weighted round robin
+    Smooth weighted round robin spreads each lane's picks across the round, ex: 8/4/1 gives
+    critical, normal, critical, critical, normal, critical, ... instead of 8 criticals in a row
+*/
+constexpr int laneRoundLength = std::accumulate(ThreadPool::laneWeights.begin(), ThreadPool::laneWeights.end(), 0);
+
+constexpr std::array<uint8_t, laneRoundLength> MakeLaneSchedule() {
+    std::array<uint8_t, laneRoundLength> schedule{};
+    std::array<int, ThreadPool::laneWeights.size()> current{};
+
+    for (int pick = 0; pick < laneRoundLength; pick++) {
+        size_t best = 0;
+        for (size_t lane = 0; lane < current.size(); lane++) {
+            current[lane] += ThreadPool::laneWeights[lane];
+            if (current[lane] > current[best]) {
+                best = lane;
+            }
+        }
+
+        current[best] -= laneRoundLength;
+        schedule[pick] = static_cast<uint8_t>(best);
+    }
+
+    return schedule;
+}
+
+constexpr std::array<uint8_t, laneRoundLength> laneSchedule = MakeLaneSchedule();
+
+/*
+    @brief Tell the CPU this is a spin-wait loop, so it backs off and lets the sibling
+    hyperthread run
+*/
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// The pool and worker the current thread belongs to, if it is a pool thread
+thread_local ThreadPool* currentPool = nullptr;
+thread_local size_t currentWorkerIndex = 0;
 
 /*
     @brief Startup the thread pool
-    @param threadCount Number of threads to spin up in the pool
+    @param config Configuration, see `ThreadPoolConfiguration`
 */
-void ThreadPool::InitializeThreadPool(const int threadCount) {
+void ThreadPool::InitializeThreadPool(const ThreadPoolConfiguration& config) {
 
-    m_threadCount = threadCount;
+    m_threadCount = config.threadCount;
     m_isRunning = true;
-    
-    // Spin up the threads
+    m_overloadPolicy = config.overloadPolicy;
+
+    m_minThreadCount = std::clamp(config.minThreadCount.value_or(m_threadCount), 0, m_threadCount);
+    m_idleTimeoutNs = std::chrono::nanoseconds(config.idleTimeout).count();
+    m_spinIterations = std::max(config.spinIterations, 0);
+
+    m_queueDelayTargetNs = std::chrono::nanoseconds(config.queueDelayTarget).count();
+    m_queueDelayIntervalNs = std::chrono::nanoseconds(config.queueDelayInterval).count();
+
+    for (std::unique_ptr<InjectionQueue>& queue : m_injectionQueues) {
+        queue = std::make_unique<InjectionQueue>(config.queueCapacity);
+    }
+
+    m_affinity = config.affinity;
+    m_cpus = config.cpus;
+
+    // No list means every CPU the process may run on
+    if (m_affinity != ThreadAffinity::NONE && m_cpus.empty()) {
+        cpu_set_t allowedCpus;
+        CPU_ZERO(&allowedCpus);
+        sched_getaffinity(0, sizeof(allowedCpus), &allowedCpus);
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowedCpus)) {
+                m_cpus.push_back(cpu);
+            }
+        }
+    }
+
+    std::erase_if(m_cpus, [] (const int cpu) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE) {
+            Log::Error(std::format("ThreadPool: Ignoring invalid CPU {}", cpu));
+            return true;
+        }
+        return false;
+    });
+
+    if (m_cpus.empty()) {
+        m_affinity = ThreadAffinity::NONE;
+    }
+
+    // The first worker pinned to each CPU takes the jobs meant for it
+    if (m_affinity == ThreadAffinity::CORE) {
+        m_cpuWorkers.assign(*std::max_element(m_cpus.begin(), m_cpus.end()) + 1, -1);
+        for (int i = std::min<int>(m_threadCount, m_cpus.size()) - 1; i >= 0; i--) {
+            m_cpuWorkers[m_cpus[i]] = i;
+        }
+    }
+
+    // Every worker needs its slot before any thread starts stealing from it
     for (int i = 0; i < m_threadCount; i++) {
-        m_threads.emplace_back(std::jthread(&ThreadPool::ThreadLoop, this));
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+
+    // Spin up the threads
+    StartWorkers(m_minThreadCount);
+
+    if (m_minThreadCount < m_threadCount) {
+        m_monitorThread = std::jthread([this] (std::stop_token stopToken) {
+            MonitorLoop(stopToken);
+        });
     }
 
     return;
@@ -21,72 +141,817 @@ void ThreadPool::InitializeThreadPool(const int threadCount) {
 
 
 /*
-    @brief Infinite loop function that waits for jobs in m_jobs
+    @brief Start threads in free worker slots
+    @param count How many to start, at most as many as there are free slots
 */
-void ThreadPool::ThreadLoop() {
-    while (true) {
-        std::function<void()> job;
+void ThreadPool::StartWorkers(int count) {
+
+    for (size_t i = 0; i < m_workers.size() && count > 0; i++) {
+        Worker& worker = *m_workers[i];
+        if (worker.isActive.load(std::memory_order_acquire)) {
+            continue;
+        }
+
+        // Assigning over a retired thread joins it first, it has already left `ThreadLoop()`
+        worker.isActive.store(true, std::memory_order_relaxed);
+        m_liveThreads.fetch_add(1, std::memory_order_relaxed);
+        worker.thread = std::jthread(&ThreadPool::ThreadLoop, this, i);
+        count--;
+    }
+
+    return;
+}
+
+
+/*
+    @brief Claim one of the threads above `m_minThreadCount` for retirement
+    @return `true` if the calling thread should exit, `false` if the pool is at its minimum
+*/
+bool ThreadPool::TryRetire() {
+
+    int liveThreads = m_liveThreads.load(std::memory_order_relaxed);
+    while (liveThreads > m_minThreadCount) {
+        if (m_liveThreads.compare_exchange_weak(liveThreads, liveThreads - 1, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+    @brief Resize the pool until it is stopped, see `ThreadPoolConfiguration`
+    @param stopToken Requested by `Stop()`
+*/
+void ThreadPool::MonitorLoop(std::stop_token stopToken) {
+
+    std::mutex mutex;
+    std::condition_variable_any sleeper;
+
+    bool wasBacklogged = false;
+    int64_t lastSweepNs = NowNs();
+
+    while (stopToken.stop_requested() == false) {
         {
-            std::unique_lock<std::mutex> lock(m_jobsMutex);
+            std::unique_lock<std::mutex> lock(mutex);
+            sleeper.wait_for(lock, stopToken, monitorInterval, [] () { return false; });
+        }
 
-            m_mutexCondition.wait(lock, [this] {
-                return m_jobs.empty() == false || m_isRunning == false;
-            });
+        /*
+            Jobs waiting, and nobody idle to take them: if that lasts a whole interval, start a
+            thread for each of them
+            An empty pool doesn't wait that long, nothing would ever take the jobs
+        */
+        const size_t queuedJobs = QueuedJobs();
+        const int liveThreads = m_liveThreads.load(std::memory_order_relaxed);
+        const bool isBacklogged = queuedJobs > 0 && m_parkedWorkers.load(std::memory_order_relaxed) == 0;
+
+        if (isBacklogged && (wasBacklogged || liveThreads == 0)) {
+            StartWorkers(static_cast<int>(std::min<size_t>(queuedJobs, m_threadCount - liveThreads)));
+        }
+        wasBacklogged = isBacklogged;
+
+        // Parked threads only notice they have been idle for too long once woken up
+        const int64_t nowNs = NowNs();
+        if (nowNs - lastSweepNs >= m_idleTimeoutNs / 2
+            && liveThreads > m_minThreadCount
+            && m_parkedWorkers.load(std::memory_order_relaxed) > 0) {
+            m_wakeEpoch.fetch_add(1, std::memory_order_release);
+            m_wakeEpoch.notify_all();
+            lastSweepNs = nowNs;
+        }
+    }
+
+    return;
+}
+
+ThreadPool::~ThreadPool() {
+    Stop();
+}
+
+
+/*
+    @brief Take the next job from one of the shared queues, or a worker's inbox
+    @param queue The queue
+    @param isSheddable Whether the queue's jobs may be dropped while the pool is overloaded
+
+    @return A job, or `std::nullopt` if the queue is empty
+*/
+std::optional<Job> ThreadPool::PopInjectionQueue(InjectionQueue& queue, const bool isSheddable) {
+
+    while (std::optional<QueuedJob> queued = queue.TryPop()) {
+        WakeBlockedProducers();
+
+        if (m_queueDelayTargetNs > 0) {
+            const int64_t nowNs = NowNs();
+            const int64_t queueDelayNs = nowNs - queued->enqueueTimeNs;
+            UpdateQueueDelay(queueDelayNs, nowNs);
+
+            // Whoever enqueued this has most likely given up on it already
+            if (isSheddable
+                && m_isOverloaded.load(std::memory_order_relaxed)
+                && queueDelayNs > m_queueDelayIntervalNs) {
+                m_rejectedJobs.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+        }
+
+        return std::move(queued->job);
+    }
+
+    return std::nullopt;
+}
+
+
+/*
+    @brief Look for a job: this worker's own queues first, then the shared queues, then steal
+    @param workerIndex Index of the worker looking
+
+    @return A job, or `std::nullopt` if there is nothing to do anywhere
+*/
+std::optional<Job> ThreadPool::FindJob(const size_t workerIndex) {
+
+    WorkerQueues& ownQueues = *m_workers[workerIndex]->queues.load(std::memory_order_relaxed);
+
+    if (std::optional<Job> job = ownQueues.jobs.Pop()) {
+        return job;
+    }
+
+    if (ownQueues.inbox != nullptr) {
+        if (std::optional<Job> job = PopInjectionQueue(*ownQueues.inbox, true)) {
+            return job;
+        }
+    }
+
+    // The lane whose turn it is goes first, then the rest from the highest priority down
+    thread_local size_t schedulePosition = 0;
+    const size_t firstLane = laneSchedule[schedulePosition];
+    schedulePosition = (schedulePosition + 1) % laneSchedule.size();
+
+    const auto popLane = [this] (const size_t lane) {
+        return PopInjectionQueue(*m_injectionQueues[lane], lane != static_cast<size_t>(JobPriority::CRITICAL));
+    };
+
+    if (std::optional<Job> job = popLane(firstLane)) {
+        return job;
+    }
+
+    for (size_t lane = 0; lane < priorityCount; lane++) {
+        if (lane == firstLane) {
+            continue;
+        }
+
+        if (std::optional<Job> job = popLane(lane)) {
+            return job;
+        }
+    }
 
-            if (m_isRunning == false) {
-                return;
+    // No standing queue, so no overload either
+    if (m_queueDelayTargetNs > 0 && m_aboveTargetSinceNs.load(std::memory_order_relaxed) != 0) {
+        m_aboveTargetSinceNs.store(0, std::memory_order_relaxed);
+        m_isOverloaded.store(false, std::memory_order_relaxed);
+    }
+
+    // Start at a different victim each time, so thieves don't all pile onto worker 0
+    thread_local uint32_t randomState = static_cast<uint32_t>(workerIndex) * 2654435761u + 1;
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+
+    const size_t workerCount = m_workers.size();
+    const size_t start = randomState % workerCount;
+
+    for (size_t i = 0; i < workerCount; i++) {
+        const size_t victim = (start + i) % workerCount;
+        WorkerQueues* victimQueues = m_workers[victim]->queues.load(std::memory_order_acquire);
+        if (victim == workerIndex || victimQueues == nullptr) {
+            continue;
+        }
+
+        if (std::optional<Job> job = victimQueues->jobs.Steal()) {
+            return job;
+        }
+    }
+
+    // Jobs meant for another CPU still run here rather than wait for a busy worker
+    if (m_affinity == ThreadAffinity::CORE) {
+        for (size_t i = 0; i < workerCount; i++) {
+            const size_t victim = (start + i) % workerCount;
+            WorkerQueues* victimQueues = m_workers[victim]->queues.load(std::memory_order_acquire);
+            if (victim == workerIndex || victimQueues == nullptr || victimQueues->inbox == nullptr) {
+                continue;
             }
 
-            job = m_jobs.front();
-            m_jobs.pop();
+            if (std::optional<Job> job = PopInjectionQueue(*victimQueues->inbox, true)) {
+                return job;
+            }
         }
+    }
 
-        job();
+    return std::nullopt;
+}
+
+
+/*
+    @brief Loop that runs jobs until the pool is stopped, parking whenever there is nothing to do
+    @param workerIndex Index of the worker this thread runs as
+*/
+void ThreadPool::ThreadLoop(const size_t workerIndex) {
+
+    currentPool = this;
+    currentWorkerIndex = workerIndex;
+
+    PinCurrentThread(workerIndex);
+
+    // Allocated by the worker itself, so the memory is local to the CPU it is pinned to
+    Worker& worker = *m_workers[workerIndex];
+    if (worker.queues.load(std::memory_order_relaxed) == nullptr) {
+        const size_t inboxCapacity = m_affinity == ThreadAffinity::CORE ? workerInboxCapacity : 0;
+        worker.queues.store(new WorkerQueues(workerQueueCapacity, inboxCapacity), std::memory_order_release);
     }
 
+    const bool isResizable = m_minThreadCount < m_threadCount;
+    int64_t idleSinceNs = 0;
+    bool isRetired = false;
+
+    while (m_isRunning) {
+        if (std::optional<Job> job = FindJob(workerIndex)) {
+            (*job)();
+            idleSinceNs = 0;
+            continue;
+        }
+
+        // Keep looking for a while before parking, a job that shows up meanwhile needs no wake
+        std::optional<Job> spunJob;
+        if (m_spinIterations > 0) {
+            m_spinningWorkers.fetch_add(1, std::memory_order_relaxed);
+            for (int i = 0; i < m_spinIterations && spunJob.has_value() == false && m_isRunning; i++) {
+                CpuRelax();
+                spunJob = FindJob(workerIndex);
+            }
+            m_spinningWorkers.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        if (spunJob.has_value()) {
+            (*spunJob)();
+            idleSinceNs = 0;
+            continue;
+        }
+
+        if (isResizable) {
+            const int64_t nowNs = NowNs();
+            if (idleSinceNs == 0) {
+                idleSinceNs = nowNs;
+            }
+            else if (nowNs - idleSinceNs >= m_idleTimeoutNs && TryRetire()) {
+                isRetired = true;
+                break;
+            }
+        }
+
+        /*
+            Announce that this worker is about to park, then look once more
+            Either this look sees a job enqueued in the meantime, or that enqueue sees
+            `m_parkedWorkers` and bumps the epoch, in which case the wait returns immediately
+        */
+        const uint32_t epoch = m_wakeEpoch.load(std::memory_order_acquire);
+        m_parkedWorkers.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        std::optional<Job> job = FindJob(workerIndex);
+        if (job.has_value() == false && m_isRunning) {
+            m_wakeEpoch.wait(epoch, std::memory_order_acquire);
+        }
+
+        m_parkedWorkers.fetch_sub(1, std::memory_order_relaxed);
+
+        if (job.has_value()) {
+            (*job)();
+            idleSinceNs = 0;
+        }
+    }
+
+    if (isRetired == false) {
+        m_liveThreads.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Free the slot for `StartWorkers()`, this worker's deque is empty
+    worker.isActive.store(false, std::memory_order_release);
+
     return;
 }
 
 
 /*
-    @brief Enqueue the job in m_jobs
-    @param job The function to execute, of signature `void ()`
+    @brief Pin the calling thread to the CPUs of a worker, see `ThreadAffinity`
+    @param workerIndex Index of the worker the thread runs as
 */
-void ThreadPool::EnqueueJob(const std::function<void()>& job) {
-    {
-        std::scoped_lock<std::mutex> lock(m_jobsMutex);
-        m_jobs.push(job);
+void ThreadPool::PinCurrentThread(const size_t workerIndex) const {
+
+    if (m_affinity == ThreadAffinity::NONE) {
+        return;
     }
 
-    m_mutexCondition.notify_one();
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+
+    if (m_affinity == ThreadAffinity::CORE) {
+        CPU_SET(m_cpus[workerIndex % m_cpus.size()], &cpuSet);
+    }
+    else {
+        for (const int cpu : m_cpus) {
+            CPU_SET(cpu, &cpuSet);
+        }
+    }
+
+    const int result = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+    if (result != 0) {
+        Log::Error(std::format(
+            "ThreadPool: Could not pin worker {} to its CPUs: {}",
+            workerIndex, strerror(result)
+        ));
+    }
+
+    return;
+}
+
+
+/*
+    @brief Wake one parked worker, if any are parked
+*/
+void ThreadPool::WakeWorker() {
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_parkedWorkers.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    m_wakeEpoch.fetch_add(1, std::memory_order_release);
+    m_wakeEpoch.notify_one();
+
     return;
 }
 
 
+/*
+    @brief Track how long jobs wait in the shared queue, and flag the pool as overloaded if
+    that has stayed above the target for a whole interval (CoDel)
+    @param queueDelayNs How long the job just taken off the queue waited
+    @param nowNs Current time
+*/
+void ThreadPool::UpdateQueueDelay(const int64_t queueDelayNs, const int64_t nowNs) {
+
+    if (queueDelayNs < m_queueDelayTargetNs) {
+        m_aboveTargetSinceNs.store(0, std::memory_order_relaxed);
+        if (m_isOverloaded.load(std::memory_order_relaxed)) {
+            m_isOverloaded.store(false, std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    int64_t aboveTargetSinceNs = m_aboveTargetSinceNs.load(std::memory_order_relaxed);
+    if (aboveTargetSinceNs == 0) {
+        m_aboveTargetSinceNs.compare_exchange_strong(aboveTargetSinceNs, nowNs, std::memory_order_relaxed);
+        return;
+    }
+
+    if (nowNs - aboveTargetSinceNs >= m_queueDelayIntervalNs && m_isOverloaded.load(std::memory_order_relaxed) == false) {
+        m_isOverloaded.store(true, std::memory_order_relaxed);
+    }
+
+    return;
+}
+
+
+/*
+    @brief Wake producers waiting for room in the shared queue, if there are any
+*/
+void ThreadPool::WakeBlockedProducers() {
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_blockedProducers.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    m_spaceEpoch.fetch_add(1, std::memory_order_release);
+    m_spaceEpoch.notify_all();
+
+    return;
+}
+
+
+/*
+    @brief Park until a worker takes a job off a shared queue, or the pool stops
+    @param queue The full queue
+*/
+void ThreadPool::WaitForSpace(const InjectionQueue& queue) {
+
+    // Same handshake as parking workers, see `ThreadLoop()`
+    const uint32_t epoch = m_spaceEpoch.load(std::memory_order_acquire);
+    m_blockedProducers.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (queue.Size() >= queue.Capacity() && m_isRunning) {
+        m_spaceEpoch.wait(epoch, std::memory_order_acquire);
+    }
+
+    m_blockedProducers.fetch_sub(1, std::memory_order_relaxed);
+    return;
+}
+
+
+/*
+    @brief Enqueue a job, on the current worker's deque if called from a job, else on a shared queue
+    @param job The job, moved from only if it was enqueued, left as it was otherwise
+    @param priority Picks the shared queue
+    @param preferredCpu CPU whose worker's inbox to try first, -1 for none
+
+    @return `true` if enqueued, `false` if the pool is full, overloaded, or not running
+*/
+bool ThreadPool::Enqueue(Job& job, const JobPriority priority, const int preferredCpu) {
+
+    const bool isPoolThread = currentPool == this;
+
+    // Work spawned by running jobs is always let in, it's how they finish
+    if (isPoolThread && m_isRunning && m_workers[currentWorkerIndex]->queues.load(std::memory_order_relaxed)->jobs.Push(job)) {
+        WakeWorker();
+        return true;
+    }
+
+    if (isPoolThread == false && priority != JobPriority::CRITICAL && m_isOverloaded.load(std::memory_order_relaxed)) {
+        m_rejectedJobs.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    QueuedJob queued{std::move(job), m_queueDelayTargetNs > 0 ? NowNs() : 0};
+
+    // Best effort only: a full inbox, or a worker that hasn't started yet, leaves it to the lanes
+    if (priority == JobPriority::NORMAL
+        && preferredCpu >= 0
+        && preferredCpu < static_cast<int>(m_cpuWorkers.size())
+        && m_cpuWorkers[preferredCpu] >= 0
+        && m_isRunning) {
+        const WorkerQueues* preferredQueues = m_workers[m_cpuWorkers[preferredCpu]]->queues.load(std::memory_order_acquire);
+        if (preferredQueues != nullptr && preferredQueues->inbox->TryPush(queued)) {
+            WakeWorker();
+            return true;
+        }
+    }
+
+    InjectionQueue& queue = *m_injectionQueues[static_cast<size_t>(priority)];
+
+    while (m_isRunning) {
+        if (queue.TryPush(queued)) {
+            WakeWorker();
+            return true;
+        }
+
+        if (m_overloadPolicy == OverloadPolicy::DROP_OLDEST) {
+            // The dropped job is destroyed at the end of this scope, without running
+            if (std::optional<QueuedJob> oldest = queue.TryPop()) {
+                m_rejectedJobs.fetch_add(1, std::memory_order_relaxed);
+            }
+            continue;
+        }
+
+        if (m_overloadPolicy == OverloadPolicy::BLOCK && isPoolThread == false) {
+            WaitForSpace(queue);
+            continue;
+        }
+
+        m_rejectedJobs.fetch_add(1, std::memory_order_relaxed);
+        break;
+    }
+
+    // Hand it back, the caller may still run it
+    job = std::move(queued.job);
+    return false;
+}
+
+
 /*
     @brief Check if the thread pool is busy
 
     @return `true` if it's busy, `false` if it's not
 
-    @note The pool is "busy" if there is even one job in the m_jobs
+    @note The pool is "busy" if there is even one job waiting to run
 */
 bool ThreadPool::IsBusy() {
-    bool isBusy = false;
-    {
-        std::scoped_lock<std::mutex> lock(m_jobsMutex);
-        isBusy = m_jobs.empty() == false;
+
+    if (QueuedJobs() > 0) {
+        return true;
+    }
+
+    for (const std::unique_ptr<Worker>& worker : m_workers) {
+        const WorkerQueues* queues = worker->queues.load(std::memory_order_acquire);
+        if (queues != nullptr && queues->jobs.Size() > 0) {
+            return true;
+        }
     }
 
-    return isBusy;
+    return false;
+}
+
+/*
+    @brief Approximate number of jobs waiting in the shared queues and workers' inboxes
+*/
+size_t ThreadPool::QueuedJobs() const {
+
+    size_t queuedJobs = 0;
+    for (const std::unique_ptr<InjectionQueue>& queue : m_injectionQueues) {
+        if (queue != nullptr) {
+            queuedJobs += queue->Size();
+        }
+    }
+
+    for (const std::unique_ptr<Worker>& worker : m_workers) {
+        const WorkerQueues* queues = worker->queues.load(std::memory_order_acquire);
+        if (queues != nullptr && queues->inbox != nullptr) {
+            queuedJobs += queues->inbox->Size();
+        }
+    }
+
+    return queuedJobs;
+}
+
+/*
+    @brief Add a timer, starting the timer thread if it isn't running yet
+    @param job What to run
+    @param delay Time until the first run
+    @param interval Time between runs, zero for a timer that runs once
+    @param priority Priority the job is enqueued with
+
+    @return Id of the timer, 0 if the pool isn't running
+*/
+ThreadPool::TimerId ThreadPool::AddTimer(
+    Job& job,
+    const TimerClock::duration delay,
+    const TimerClock::duration interval,
+    const JobPriority priority
+) {
+
+    std::scoped_lock<std::mutex> lock(m_timerMutex);
+
+    if (m_isRunning == false) {
+        return 0;
+    }
+
+    if (m_timerThread.joinable() == false) {
+        m_timerThread = std::jthread([this] (std::stop_token stopToken) {
+            TimerLoop(stopToken);
+        });
+    }
+
+    const TimerId id = m_nextTimerId++;
+    m_timers.emplace(id, std::make_shared<Timer>(std::move(job), interval, priority));
+    m_timerQueue.push({TimerClock::now() + delay, id});
+    m_timerCondition.notify_one();
+
+    return id;
+}
+
+
+/*
+    @brief Queue a periodic timer's next run, if it hasn't been cancelled
+    @param id Id of the timer
+    @param previousDeadline When the run that just finished was due
+
+    @note Called with `m_timerMutex` held
+*/
+void ThreadPool::RearmTimer(const TimerId id, const TimerClock::time_point previousDeadline) {
+
+    const auto found = m_timers.find(id);
+    if (found == m_timers.end()) {
+        return;
+    }
+
+    // Fall behind by a whole interval and the missed runs are skipped
+    const TimerClock::duration interval = found->second->interval;
+    const TimerClock::time_point now = TimerClock::now();
+    TimerClock::time_point deadline = previousDeadline + interval;
+    if (deadline <= now) {
+        deadline = now + interval;
+    }
+
+    m_timerQueue.push({deadline, id});
+    m_timerCondition.notify_one();
+
+    return;
+}
+
+
+/*
+    @brief Sleep until the earliest timer is due and enqueue it, until the pool is stopped
+    @param stopToken Requested by `Stop()`
+*/
+void ThreadPool::TimerLoop(std::stop_token stopToken) {
+
+    std::unique_lock<std::mutex> lock(m_timerMutex);
+
+    while (stopToken.stop_requested() == false) {
+        if (m_timerQueue.empty()) {
+            m_timerCondition.wait(lock, stopToken, [this] () {
+                return m_timerQueue.empty() == false;
+            });
+            continue;
+        }
+
+        // Sleep until it is due, or an earlier timer is added
+        const TimerEntry next = m_timerQueue.top();
+        if (TimerClock::now() < next.deadline) {
+            m_timerCondition.wait_until(lock, stopToken, next.deadline, [this, &next] () {
+                return m_timerQueue.top().deadline < next.deadline;
+            });
+            continue;
+        }
+
+        m_timerQueue.pop();
+
+        const auto found = m_timers.find(next.id);
+        if (found == m_timers.end()) {
+            continue;
+        }
+
+        std::shared_ptr<Timer> timer = found->second;
+        const bool isPeriodic = timer->interval > TimerClock::duration::zero();
+
+        lock.unlock();
+
+        // A periodic timer is only rearmed once its run is over, so runs never overlap
+        const bool isEnqueued = EnqueueJob([this, timer, id = next.id, deadline = next.deadline, isPeriodic] () {
+            timer->job();
+
+            if (isPeriodic) {
+                std::scoped_lock<std::mutex> timerLock(m_timerMutex);
+                RearmTimer(id, deadline);
+            }
+        }, timer->priority);
+
+        lock.lock();
+
+        // A one-shot timer is only done with once its run is enqueued, it may be cancelled meanwhile
+        if (isEnqueued && isPeriodic == false) {
+            m_timers.erase(next.id);
+        }
+
+        // Turned away by a full pool, a periodic timer tries again next interval, a one-shot
+        // one shortly after, so it isn't lost
+        if (isEnqueued == false && isPeriodic) {
+            RearmTimer(next.id, next.deadline);
+        }
+        else if (isEnqueued == false && m_timers.contains(next.id)) {
+            m_timerQueue.push({TimerClock::now() + timerRetryDelay, next.id});
+        }
+    }
+
+    return;
+}
+
+
+/*
+    @brief Cancel a timer. A run that has already started still finishes
+    @param id Id returned by `Schedule()` or `Every()`
+
+    @return `true` if the timer was pending, `false` if it had already run or was cancelled
+*/
+bool ThreadPool::Cancel(const TimerId id) {
+    std::scoped_lock<std::mutex> lock(m_timerMutex);
+    return m_timers.erase(id) > 0;
+}
+
+
+/*
+    @brief Wait until every job of a task has finished
+    @param state The task's state
+    A pool thread runs other queued jobs meanwhile, any other thread just blocks
+*/
+void ThreadPool::Wait(const TaskState& state) {
+
+    const bool isPoolThread = currentPool == this;
+
+    while (true) {
+        const uint32_t pending = state.pending.load(std::memory_order_acquire);
+        if (pending == 0) {
+            return;
+        }
+
+        if (isPoolThread) {
+            if (std::optional<Job> job = FindJob(currentWorkerIndex)) {
+                (*job)();
+                continue;
+            }
+        }
+
+        /*
+            Nothing left to run here means the task's jobs are already running elsewhere, or
+            this isn't a pool thread, so blocking can't hold up the jobs being waited on
+        */
+        state.pending.wait(pending, std::memory_order_acquire);
+    }
+}
+
+ThreadPool* ThreadPool::Current() {
+    return currentPool;
+}
+
+int ThreadPool::ThreadCount() const {
+    return m_liveThreads.load(std::memory_order_relaxed);
+}
+
+int ThreadPool::AvailableThreads() const {
+    const int unstartedThreads = m_threadCount - m_liveThreads.load(std::memory_order_relaxed);
+    return m_parkedWorkers.load(std::memory_order_relaxed)
+        + m_spinningWorkers.load(std::memory_order_relaxed)
+        + std::max(unstartedThreads, 0);
+}
+
+uint64_t ThreadPool::RejectedJobs() const {
+    return m_rejectedJobs.load(std::memory_order_relaxed);
+}
+
+bool ThreadPool::IsOverloaded() const {
+    return m_isOverloaded.load(std::memory_order_relaxed);
 }
 
 /*
     @brief Stop the thread pool
-    Joins all the threads
+    Joins all the threads, jobs that haven't started yet are discarded
 */
 void ThreadPool::Stop() {
     m_isRunning = false;
 
-    m_mutexCondition.notify_all();
-    m_threads.clear();
-}
\ No newline at end of file
+    // No new threads or timers from here on
+    m_monitorThread = std::jthread();
+
+    // Joined outside the lock, the timer thread needs it to notice the stop
+    std::jthread timerThread;
+    {
+        std::scoped_lock<std::mutex> lock(m_timerMutex);
+        timerThread = std::move(m_timerThread);
+    }
+    timerThread = std::jthread();
+
+    m_wakeEpoch.fetch_add(1, std::memory_order_release);
+    m_wakeEpoch.notify_all();
+
+    m_spaceEpoch.fetch_add(1, std::memory_order_release);
+    m_spaceEpoch.notify_all();
+
+    for (const std::unique_ptr<Worker>& worker : m_workers) {
+        worker->thread = std::jthread();
+    }
+}
+
+
+/*
+    @brief Parse a list of CPUs in the format `taskset -c` takes, ex: "0-3,8"
+    @param cpuList List to parse, empty for every CPU the process may run on
+
+    @return The CPUs, or `std::nullopt` if the list is malformed
+*/
+std::optional<std::vector<int>> ThreadPool::ParseCpuList(const std::string_view cpuList) {
+
+    std::vector<int> cpus;
+
+    const auto parseCpu = [] (const std::string_view text) -> std::optional<int> {
+        int cpu = -1;
+        const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), cpu);
+        if (text.empty() || error != std::errc() || end != text.data() + text.size() || cpu >= CPU_SETSIZE) {
+            return std::nullopt;
+        }
+        return cpu;
+    };
+
+    size_t position = 0;
+    while (position < cpuList.size()) {
+        size_t end = cpuList.find(',', position);
+        if (end == std::string_view::npos) {
+            end = cpuList.size();
+        }
+
+        const std::string_view item = cpuList.substr(position, end - position);
+        const size_t dash = item.find('-');
+
+        const std::optional<int> first = parseCpu(item.substr(0, dash));
+        const std::optional<int> last = dash == std::string_view::npos ? first : parseCpu(item.substr(dash + 1));
+        if (first.has_value() == false || last.has_value() == false || first.value() > last.value()) {
+            return std::nullopt;
+        }
+
+        for (int cpu = first.value(); cpu <= last.value(); cpu++) {
+            cpus.push_back(cpu);
+        }
+
+        // A trailing comma leaves an empty item
+        if (end == cpuList.size() - 1) {
+            return std::nullopt;
+        }
+        position = end + 1;
+    }
+
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+
+    return cpus;
+}
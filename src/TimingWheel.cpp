@@ -0,0 +1,158 @@
+#include <algorithm>
+
+#include "knots/TimingWheel.hpp"
+
+TimingWheel::TimingWheel(const Clock::duration tick, const size_t slotCount) :
+    m_tick(std::max(tick, Clock::duration(1))),
+    m_slots(std::max<size_t>(slotCount, 1), nullptr),
+    m_currentSlot(0),
+    m_armedCount(0),
+    m_nextTick{} {
+
+    m_thread = std::jthread([this] (std::stop_token stopToken) {
+        Run(stopToken);
+    });
+}
+
+TimingWheel::~TimingWheel() {
+    m_thread = std::jthread();
+}
+
+
+/*
+    @brief Arm a timer, or push it back if it is already armed
+    @param timer The timer
+    @param timeout Time from now until it expires
+*/
+void TimingWheel::Arm(Timer& timer, const Clock::duration timeout) {
+
+    std::scoped_lock<std::mutex> lock(m_mutex);
+
+    if (timer.m_isArmed) {
+        Unlink(timer);
+    }
+
+    // The wheel doesn't turn while it is empty, so the first tick is a whole tick from now
+    if (m_armedCount == 0) {
+        m_nextTick = Clock::now() + m_tick;
+        m_timerArmed.notify_one();
+    }
+
+    // One more tick than it takes, as the next tick may be just about due
+    const Clock::duration clampedTimeout = std::max(timeout, Clock::duration::zero());
+    const size_t ticks = static_cast<size_t>((clampedTimeout + m_tick - Clock::duration(1)) / m_tick) + 1;
+
+    Link(timer, ticks);
+    return;
+}
+
+
+/*
+    @brief Disarm a timer, if it is armed
+    @param timer The timer
+*/
+void TimingWheel::Cancel(Timer& timer) {
+
+    std::scoped_lock<std::mutex> lock(m_mutex);
+
+    if (timer.m_isArmed) {
+        Unlink(timer);
+    }
+
+    return;
+}
+
+
+/*
+    @brief Put a timer in the slot `ticks` ticks ahead of the current one
+    @note Called with `m_mutex` held
+*/
+void TimingWheel::Link(Timer& timer, const size_t ticks) {
+
+    timer.m_slot = (m_currentSlot + ticks) % m_slots.size();
+    timer.m_rounds = (ticks - 1) / m_slots.size();
+
+    timer.m_previous = nullptr;
+    timer.m_next = m_slots[timer.m_slot];
+    if (timer.m_next != nullptr) {
+        timer.m_next->m_previous = &timer;
+    }
+    m_slots[timer.m_slot] = &timer;
+
+    timer.m_isArmed = true;
+    m_armedCount++;
+
+    return;
+}
+
+
+/*
+    @brief Take a timer out of its slot
+    @note Called with `m_mutex` held
+*/
+void TimingWheel::Unlink(Timer& timer) {
+
+    if (timer.m_previous == nullptr) {
+        m_slots[timer.m_slot] = timer.m_next;
+    }
+    else {
+        timer.m_previous->m_next = timer.m_next;
+    }
+
+    if (timer.m_next != nullptr) {
+        timer.m_next->m_previous = timer.m_previous;
+    }
+
+    timer.m_previous = nullptr;
+    timer.m_next = nullptr;
+    timer.m_isArmed = false;
+    m_armedCount--;
+
+    return;
+}
+
+
+/*
+    @brief Turn the wheel one slot per tick and expire what is due, until stopped
+    @param stopToken Requested by the destructor
+*/
+void TimingWheel::Run(std::stop_token stopToken) {
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (stopToken.stop_requested() == false) {
+        if (m_armedCount == 0) {
+            m_timerArmed.wait(lock, stopToken, [this] () {
+                return m_armedCount > 0;
+            });
+            continue;
+        }
+
+        if (Clock::now() < m_nextTick) {
+            m_timerArmed.wait_until(lock, stopToken, m_nextTick, [] () {
+                return false;
+            });
+            continue;
+        }
+
+        m_nextTick += m_tick;
+        m_currentSlot = (m_currentSlot + 1) % m_slots.size();
+
+        Timer* timer = m_slots[m_currentSlot];
+        while (timer != nullptr) {
+            Timer* next = timer->m_next;
+
+            if (timer->m_rounds == 0) {
+                Unlink(*timer);
+                timer->m_onExpire();
+            }
+            else {
+                timer->m_rounds--;
+            }
+
+            timer = next;
+        }
+    }
+
+    return;
+}
@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <string_view>
+
+#include "knots/ChunkedDecoder.hpp"
+
+TEST(ChunkedDecoderTest, DecodesInOnePiece) {
+
+    ChunkedDecoder decoder;
+
+    const std::string body =
+        "5\r\nhello\r\n"
+        "7;name=value\r\n, world\r\n"
+        "0\r\n"
+        "\r\n"
+        "GET /next HTTP/1.1\r\n";
+
+    // Stops at the end of the body, the pipelined request after it is left alone
+    const size_t consumed = decoder.Feed(body);
+    EXPECT_EQ(consumed, body.find("GET"));
+    EXPECT_EQ(decoder.GetStatus(), ChunkedDecoder::Status::COMPLETE);
+    EXPECT_EQ(decoder.Body(), "hello, world");
+    EXPECT_TRUE(decoder.Trailers().empty());
+}
+
+TEST(ChunkedDecoderTest, DecodesByteByByte) {
+
+    ChunkedDecoder decoder;
+
+    const std::string body =
+        "A\r\n0123456789\r\n"
+        "1a\r\nabcdefghijklmnopqrstuvwxyz\r\n"
+        "0\r\n"
+        "Checksum: abc123\r\n"
+        "X-Trailer:  spaced  \r\n"
+        "\r\n";
+
+    for (size_t i = 0; i < body.size(); i++) {
+        EXPECT_EQ(decoder.GetStatus(), ChunkedDecoder::Status::INCOMPLETE);
+        EXPECT_EQ(decoder.Feed(std::string_view(body).substr(i, 1)), 1);
+    }
+
+    EXPECT_EQ(decoder.GetStatus(), ChunkedDecoder::Status::COMPLETE);
+    EXPECT_EQ(decoder.Body(), "0123456789abcdefghijklmnopqrstuvwxyz");
+    EXPECT_EQ(decoder.Trailers().at("checksum"), "abc123");
+    EXPECT_EQ(decoder.Trailers().at("X-Trailer"), "spaced");
+}
+
+TEST(ChunkedDecoderTest, RejectsMalformedFraming) {
+
+    const auto decode = [] (const std::string& body) {
+        ChunkedDecoder decoder;
+        decoder.Feed(body);
+        return decoder.GetStatus();
+    };
+
+    EXPECT_EQ(decode("\r\n"), ChunkedDecoder::Status::MALFORMED);
+    EXPECT_EQ(decode("xyz\r\n"), ChunkedDecoder::Status::MALFORMED);
+    EXPECT_EQ(decode(";ext\r\n"), ChunkedDecoder::Status::MALFORMED);
+    EXPECT_EQ(decode("5\nhello\r\n"), ChunkedDecoder::Status::MALFORMED);
+    EXPECT_EQ(decode("3\r\nhello\r\n"), ChunkedDecoder::Status::MALFORMED);
+    EXPECT_EQ(decode("0\r\nno colon\r\n\r\n"), ChunkedDecoder::Status::MALFORMED);
+    EXPECT_EQ(decode("1;" + std::string(ChunkedDecoder::maxSizeLineLength, 'x')), ChunkedDecoder::Status::MALFORMED);
+
+    // Not malformed, only not all there yet
+    EXPECT_EQ(decode("5\r\nhel"), ChunkedDecoder::Status::INCOMPLETE);
+}
+
+TEST(ChunkedDecoderTest, EnforcesLimits) {
+
+    ChunkedDecoder smallBody(8, 64);
+    smallBody.Feed("5\r\nhello\r\n");
+    EXPECT_EQ(smallBody.GetStatus(), ChunkedDecoder::Status::INCOMPLETE);
+
+    // Turned away from the chunk size alone, before any of its data arrives
+    smallBody.Feed("4\r\n");
+    EXPECT_EQ(smallBody.GetStatus(), ChunkedDecoder::Status::BODY_TOO_LARGE);
+
+    // A size that would overflow is too large, not wrapped around
+    ChunkedDecoder hugeChunk;
+    hugeChunk.Feed("fffffffffffffffffffff\r\n");
+    EXPECT_EQ(hugeChunk.GetStatus(), ChunkedDecoder::Status::BODY_TOO_LARGE);
+
+    ChunkedDecoder smallTrailers(1024, 16);
+    smallTrailers.Feed("0\r\nX-Long-Trailer: 0123456789\r\n\r\n");
+    EXPECT_EQ(smallTrailers.GetStatus(), ChunkedDecoder::Status::TRAILERS_TOO_LARGE);
+
+    EXPECT_TRUE(ChunkedDecoder::IsChunked(" Chunked "));
+    EXPECT_FALSE(ChunkedDecoder::IsChunked("gzip, chunked"));
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+
+#include "knots/CompiledRoutes.hpp"
+#include "knots/Router.hpp"
+#include "knots/utils/Log.hpp"
+
+void CreateUser(const HttpRequest& req, HttpResponse& res) {
+    res.SetStatus(201);
+    return;
+}
+
+namespace {
+    constexpr auto createUserHandler = [] (const HttpRequest& req, HttpResponse& res) {
+        CreateUser(req, res);
+    };
+
+    constexpr auto healthHandler = [] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody(std::string("healthy"));
+    };
+
+    constexpr auto userHandler = [] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody("user " + req.GetRouteParam("id").value_or(""));
+    };
+
+    constexpr auto meHandler = [] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody(std::string("me"));
+    };
+
+    constexpr auto assetHandler = [] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody("asset " + req.GetRouteParam("path").value_or(""));
+    };
+
+    // The static route is declared last, but still wins over `{id}`
+    using Routes = CompiledRoutes::Table<
+        CompiledRoutes::Get<"/health">(healthHandler),
+        CompiledRoutes::Get<"/users/{id}">(userHandler),
+        CompiledRoutes::Post<"/users">(createUserHandler),
+        CompiledRoutes::Get<"/assets/{*path}">(assetHandler),
+        CompiledRoutes::Get<"/users/me">(meHandler)
+    >;
+}
+
+// Route patterns and conflicts are checked by the compiler
+static_assert(CompiledRoutes::IsValidPattern("/users/{id}/orders"));
+static_assert(CompiledRoutes::IsValidPattern("/"));
+static_assert(CompiledRoutes::IsValidPattern("users") == false);
+static_assert(CompiledRoutes::IsValidPattern("/users/") == false);
+static_assert(CompiledRoutes::IsValidPattern("/files/{*path}/tail") == false);
+static_assert(CompiledRoutes::IsValidPattern("/users/id}") == false);
+
+static_assert(CompiledRoutes::IsSameShape("/users/{id}", "/users/{userId}"));
+static_assert(CompiledRoutes::IsSameShape("/users/{id}", "/users/me") == false);
+static_assert(CompiledRoutes::IsSameShape("/users/{id}", "/users/{id}/orders") == false);
+
+static_assert(CompiledRoutes::MatchPattern("/users/{id}", "/users/100"));
+static_assert(CompiledRoutes::MatchPattern("/users/{id}", "/users") == false);
+static_assert(CompiledRoutes::MatchPattern("/files/{*path}", "/files/a/b/c"));
+static_assert(CompiledRoutes::MatchPattern("/files/{*path}", "/files"));
+
+TEST(CompiledRoutesTest, Dispatch) {
+
+    const std::vector<std::tuple<HttpMethod, std::string, std::string>> cases = {
+        {HttpMethod::GET, "/health",            "healthy"},
+        {HttpMethod::GET, "/health/",           "healthy"},
+        {HttpMethod::GET, "/users/100",         "user 100"},
+        {HttpMethod::GET, "/users/me",          "me"},
+        {HttpMethod::GET, "/assets/css/a.css",  "asset css/a.css"},
+    };
+
+    for (const auto& [method, url, expectedBody] : cases) {
+        HttpRequest req(method, url, HttpVersion::HTTP_1_1, {}, {}, {}, {});
+        HttpResponse res;
+
+        EXPECT_EQ(Routes::Dispatch(req, res), CompiledRoutes::MatchResult::HANDLED) << url;
+        EXPECT_EQ(res.body, expectedBody) << url;
+    }
+
+    HttpRequest post(HttpMethod::POST, "/users", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    HttpResponse postRes;
+    EXPECT_EQ(Routes::Dispatch(post, postRes), CompiledRoutes::MatchResult::HANDLED);
+    EXPECT_EQ(postRes.statusCode, 201);
+
+    HttpRequest wrongMethod(HttpMethod::DELETE, "/users/100", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    HttpResponse res;
+    EXPECT_EQ(Routes::Dispatch(wrongMethod, res), CompiledRoutes::MatchResult::METHOD_NOT_ALLOWED);
+
+    // The methods of every route matching the URL, to build the "Allow" header from
+    uint16_t methodMask = 0;
+    EXPECT_EQ(Routes::Dispatch(wrongMethod, res, &methodMask), CompiledRoutes::MatchResult::METHOD_NOT_ALLOWED);
+    EXPECT_EQ(methodMask, SegmentHandlerFunctions::MethodBit(HttpMethod::GET));
+    EXPECT_EQ(
+        SegmentHandlerFunctions::AllowedMethodsFor(SegmentHandlerFunctions::AllowedMethodMaskFor(methodMask)),
+        "GET, HEAD, OPTIONS"
+    );
+
+    HttpRequest wrongMethodOnPost(HttpMethod::PUT, "/users", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    methodMask = 0;
+    EXPECT_EQ(Routes::Dispatch(wrongMethodOnPost, res, &methodMask), CompiledRoutes::MatchResult::METHOD_NOT_ALLOWED);
+    EXPECT_EQ(
+        SegmentHandlerFunctions::AllowedMethodsFor(SegmentHandlerFunctions::AllowedMethodMaskFor(methodMask)),
+        "POST, OPTIONS"
+    );
+
+    HttpRequest missing(HttpMethod::GET, "/nothing/here", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    methodMask = 0;
+    EXPECT_EQ(Routes::Dispatch(missing, res, &methodMask), CompiledRoutes::MatchResult::NOT_FOUND);
+    EXPECT_EQ(methodMask, 0);
+}
+
+TEST(CompiledRoutesTest, RouterFallsBackToRuntimeRoutes) {
+
+    Router router;
+    router.UseCompiledRoutes<Routes>();
+    router.Get("/runtime", [] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody(std::string("runtime"));
+    });
+
+    HttpRequest compiled(HttpMethod::GET, "/health", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    HttpResponse res;
+    EXPECT_EQ(router.DispatchCompiledRoutes(compiled, res), CompiledRoutes::MatchResult::HANDLED);
+    EXPECT_EQ(res.body, "healthy");
+
+    HttpRequest runtime(HttpMethod::GET, "/runtime", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    EXPECT_EQ(router.DispatchCompiledRoutes(runtime, res), CompiledRoutes::MatchResult::NOT_FOUND);
+    EXPECT_TRUE(router.FetchFunctionsForRoute(runtime));
+}
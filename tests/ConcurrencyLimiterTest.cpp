@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "knots/ConcurrencyLimiter.hpp"
+
+using namespace std::chrono_literals;
+
+TEST(ConcurrencyLimiterTest, FixedLimit) {
+
+    ConcurrencyLimiter limiter(1, 2, 0ms);
+
+    ConcurrencyLimiter::Permit first = limiter.Acquire(0ms);
+    ConcurrencyLimiter::Permit second = limiter.Acquire(0ms);
+    EXPECT_TRUE(first.IsHeld());
+    EXPECT_TRUE(second.IsHeld());
+    EXPECT_EQ(limiter.InFlight(), 2);
+
+    // Full, and nothing frees up in time
+    EXPECT_FALSE(limiter.Acquire(0ms).IsHeld());
+    EXPECT_FALSE(limiter.Acquire(5ms).IsHeld());
+    EXPECT_EQ(limiter.RejectedCount(), 2);
+
+    first.Release();
+    EXPECT_FALSE(first.IsHeld());
+    EXPECT_TRUE(limiter.Acquire(0ms).IsHeld());
+
+    // Without a latency target the limit never moves
+    EXPECT_EQ(limiter.Limit(), 2);
+}
+
+TEST(ConcurrencyLimiterTest, WaitsForAFreeSlot) {
+
+    ConcurrencyLimiter limiter(1, 1, 0ms);
+    ConcurrencyLimiter::Permit held = limiter.Acquire(0ms);
+
+    std::jthread releaser([&held] () {
+        std::this_thread::sleep_for(10ms);
+        held.Release();
+    });
+
+    EXPECT_TRUE(limiter.Acquire(5s).IsHeld());
+
+    // No room to wait, turned away right away
+    ConcurrencyLimiter noQueue(1, 1, 0ms, 0);
+    ConcurrencyLimiter::Permit noQueueHeld = noQueue.Acquire(0ms);
+    EXPECT_FALSE(noQueue.Acquire(5s).IsHeld());
+    EXPECT_EQ(noQueue.RejectedCount(), 1);
+}
+
+TEST(ConcurrencyLimiterTest, AdaptsToLatency) {
+
+    ConcurrencyLimiter limiter(2, 10, 5ms);
+    EXPECT_EQ(limiter.Limit(), 10);
+
+    // Slow requests cut the limit, once per round of requests
+    for (int round = 0; round < 5; round++) {
+        std::vector<ConcurrencyLimiter::Permit> permits;
+        for (int i = 0; i < limiter.Limit(); i++) {
+            permits.push_back(limiter.Acquire(0ms));
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+    EXPECT_EQ(limiter.Limit(), 5);
+
+    // ...but never below the minimum
+    for (int round = 0; round < 20; round++) {
+        ConcurrencyLimiter::Permit permit = limiter.Acquire(0ms);
+        std::this_thread::sleep_for(6ms);
+    }
+    EXPECT_EQ(limiter.Limit(), 2);
+
+    // Fast requests that fill the limit raise it again
+    for (int round = 0; round < 10; round++) {
+        std::vector<ConcurrencyLimiter::Permit> permits;
+        for (int i = 0; i < limiter.Limit(); i++) {
+            permits.push_back(limiter.Acquire(0ms));
+        }
+    }
+    EXPECT_GT(limiter.Limit(), 2);
+
+    // ...but never above the maximum
+    for (int round = 0; round < 200; round++) {
+        std::vector<ConcurrencyLimiter::Permit> permits;
+        for (int i = 0; i < limiter.Limit(); i++) {
+            permits.push_back(limiter.Acquire(0ms));
+        }
+    }
+    EXPECT_EQ(limiter.Limit(), 10);
+}
@@ -203,9 +203,39 @@ TEST(HttpRequestTest, ParseInvalidRequest) {
     
     // Headers
     EXPECT_EQ(req.headers.size(), 0);
-    
+
     // Body
     EXPECT_EQ(req.body, "");
+
+    // A length that isn't a number, or is longer than what was sent, is rejected without throwing
+    std::stringstream badLength;
+    badLength << "POST /upload HTTP/1.1\r\n"
+              << "Content-Length: abc\r\n\r\n"
+              << "body";
+    EXPECT_FALSE(HttpRequest().ParseFrom(badLength));
+
+    std::stringstream shortBody;
+    shortBody << "POST /upload HTTP/1.1\r\n"
+              << "Content-Length: 99999999999\r\n\r\n"
+              << "body";
+    EXPECT_FALSE(HttpRequest().ParseFrom(shortBody));
+
+    // Repeated lengths have to agree
+    std::stringstream repeatedLength;
+    repeatedLength << "POST /upload HTTP/1.1\r\n"
+                   << "Content-Length: 4\r\n"
+                   << "content-length: 4\r\n\r\n"
+                   << "body";
+    HttpRequest repeated;
+    EXPECT_TRUE(repeated.ParseFrom(repeatedLength));
+    EXPECT_EQ(repeated.body, "body");
+
+    std::stringstream conflictingLength;
+    conflictingLength << "POST /upload HTTP/1.1\r\n"
+                      << "Content-Length: 0\r\n"
+                      << "Content-Length: 4\r\n\r\n"
+                      << "body";
+    EXPECT_FALSE(HttpRequest().ParseFrom(conflictingLength));
 }
 
 TEST(HttpRequestTest, GetHeaderAPI) {
@@ -274,4 +304,68 @@ TEST(HttpRequestTest, GetRouteParamAPI) {
     EXPECT_EQ(req.GetRouteParam("userId"), "123");
     EXPECT_EQ(req.GetRouteParam("orderId"), "abc456");
     EXPECT_EQ(req.GetRouteParam("not-present-param"), std::nullopt);
-}
\ No newline at end of file
+}
+
+TEST(HttpRequestTest, IsKeepAlive) {
+
+    const auto makeRequest = [] (const HttpVersion version, const std::string& connection) {
+        HttpRequest req(HttpMethod::GET, "/test", version, {{"Host", "localhost:8600"}}, "", {}, {});
+        if (connection.empty() == false) {
+            req.headers["Connection"] = connection;
+        }
+        return req;
+    };
+
+    // HTTP/1.1 persists by default
+    EXPECT_TRUE(makeRequest(HttpVersion::HTTP_1_1, "").IsKeepAlive());
+    EXPECT_TRUE(makeRequest(HttpVersion::HTTP_1_1, "keep-alive").IsKeepAlive());
+    EXPECT_TRUE(makeRequest(HttpVersion::HTTP_1_1, "Upgrade").IsKeepAlive());
+    EXPECT_FALSE(makeRequest(HttpVersion::HTTP_1_1, "close").IsKeepAlive());
+    EXPECT_FALSE(makeRequest(HttpVersion::HTTP_1_1, "Upgrade,  Close ").IsKeepAlive());
+
+    // HTTP/1.0 only when asked for
+    EXPECT_FALSE(makeRequest(HttpVersion::HTTP_1_0, "").IsKeepAlive());
+    EXPECT_TRUE(makeRequest(HttpVersion::HTTP_1_0, "Keep-Alive").IsKeepAlive());
+    EXPECT_TRUE(makeRequest(HttpVersion::HTTP_1_0, "TE, keep-alive").IsKeepAlive());
+    EXPECT_FALSE(makeRequest(HttpVersion::HTTP_1_0, "keep-alive, close").IsKeepAlive());
+}
+
+/*
+    @brief Parse a request with a chunked body, and trailers
+*/
+TEST(HttpRequestTest, ParseChunkedRequest) {
+    std::stringstream ss;
+    ss << "POST /upload HTTP/1.1\r\n"
+       << "Host: localhost:8080\r\n"
+       << "Transfer-Encoding: chunked\r\n\r\n"
+       << "4\r\nWiki\r\n"
+       << "6\r\npedia \r\n"
+       << "0\r\n"
+       << "Checksum: 1234\r\n"
+       << "Host: evil.example\r\n\r\n";
+
+    HttpRequest req;
+    EXPECT_TRUE(req.ParseFrom(ss));
+
+    EXPECT_EQ(req.body, "Wikipedia ");
+    EXPECT_EQ(req.trailers.at("checksum"), "1234");
+
+    // Trailers never reach the headers, or override them
+    EXPECT_EQ(req.GetHeader("Checksum"), std::nullopt);
+    EXPECT_EQ(req.GetHeader("Host"), "localhost:8080");
+    EXPECT_EQ(req.trailers.at("Host"), "evil.example");
+
+    // Unknown codings, and a length alongside the chunks, are both rejected
+    std::stringstream gzipped;
+    gzipped << "POST /upload HTTP/1.1\r\n"
+            << "Transfer-Encoding: gzip\r\n\r\n"
+            << "0\r\n\r\n";
+    EXPECT_FALSE(HttpRequest().ParseFrom(gzipped));
+
+    std::stringstream ambiguous;
+    ambiguous << "POST /upload HTTP/1.1\r\n"
+              << "Transfer-Encoding: chunked\r\n"
+              << "Content-Length: 5\r\n\r\n"
+              << "0\r\n\r\n";
+    EXPECT_FALSE(HttpRequest().ParseFrom(ambiguous));
+}
@@ -1,10 +1,18 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
 #include <thread>
 
+#include "knots/ChunkedDecoder.hpp"
 #include "knots/HttpServer.hpp"
 #include "knots/NetworkIO.hpp"
+#include "knots/RequestReader.hpp"
+#include "knots/ResponseWriter.hpp"
 #include "knots/Socket.hpp"
+#include "knots/Task.hpp"
 #include "knots/utils/Config.hpp"
 #include "knots/utils/Log.hpp"
 
@@ -171,9 +179,10 @@ TEST(HttpServerTest, BasicRequestResponse) {
 
     buffer = buffer.substr(0, bytesReceived);
 
+    // HTTP/1.1 connections persist unless the client asks otherwise
     const std::string expectedResponse = std::format(
         "HTTP/1.1 200 OK\r\n"
-        "Connection: close\r\n"
+        "Connection: keep-alive\r\n"
         "Content-Length: {}\r\n"
         "\r\n"
         "{}",
@@ -355,4 +364,871 @@ TEST(HttpServerTest, ConnectionStaysAlive) {
         << Log::MakeErrorMessage("Unexpected response from server");
 
     server.Shutdown();
-}
\ No newline at end of file
+}
+
+namespace {
+    constexpr auto compiledHandler = [] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody(std::string("compiled"));
+    };
+
+    using CompiledHeadAndOptionsRoutes = CompiledRoutes::Table<
+        CompiledRoutes::Get<"/compiled">(compiledHandler)
+    >;
+}
+
+/*
+    HEAD and OPTIONS are answered automatically for routes that only have a GET handler
+*/
+TEST(HttpServerTest, AutomaticHeadAndOptions) {
+
+    const std::string messageToSend = "<h1>Hello world!</h1>\n";
+
+    constexpr HttpServerConfiguration config(
+        serverPort, serverMaxConnections, inputPollingIntervalMs, verbosity, timeZone,
+        "https://example.com"
+    );
+
+    Router router;
+    router.Get("/", [messageToSend] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody(messageToSend);
+    });
+    router.UseCompiledRoutes<CompiledHeadAndOptionsRoutes>();
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+
+    const auto sendRequest = [] (const std::string& req) {
+        Client client;
+        EXPECT_TRUE(client.ConnectToServer())
+            << Log::MakeErrorMessage("Client could not connect to server");
+        EXPECT_TRUE(NetworkIO::Send(client.m_socket, req, 0))
+            << Log::MakeErrorMessage("Client failed to send request to server");
+
+        std::string buffer(1024, '\0');
+        const ssize_t bytesReceived = recv(client.m_socket.Get(), buffer.data(), buffer.size() - 1, 0);
+
+        return bytesReceived > 0 ? buffer.substr(0, bytesReceived) : std::string{};
+    };
+
+    // HEAD gets the GET route's headers, but no body
+    const std::string headResponse = sendRequest(
+        "HEAD / HTTP/1.1\r\n"
+        "Host: localhost:10000\r\n"
+        "\r\n"
+    );
+    EXPECT_TRUE(headResponse.starts_with("HTTP/1.1 200 OK\r\n")) << headResponse;
+    EXPECT_NE(headResponse.find(std::format("Content-Length: {}\r\n", messageToSend.size())), std::string::npos)
+        << headResponse;
+    EXPECT_TRUE(headResponse.ends_with("\r\n\r\n")) << headResponse;
+
+    // CORS preflight
+    const std::string optionsResponse = sendRequest(
+        "OPTIONS / HTTP/1.1\r\n"
+        "Host: localhost:10000\r\n"
+        "Origin: https://example.com\r\n"
+        "Access-Control-Request-Method: GET\r\n"
+        "Access-Control-Request-Headers: X-Token\r\n"
+        "\r\n"
+    );
+    EXPECT_TRUE(optionsResponse.starts_with("HTTP/1.1 204 No Content\r\n")) << optionsResponse;
+    EXPECT_NE(optionsResponse.find("Allow: GET, HEAD, OPTIONS\r\n"), std::string::npos) << optionsResponse;
+    EXPECT_NE(optionsResponse.find("Access-Control-Allow-Origin: https://example.com\r\n"), std::string::npos)
+        << optionsResponse;
+    EXPECT_NE(optionsResponse.find("Access-Control-Allow-Headers: X-Token\r\n"), std::string::npos)
+        << optionsResponse;
+
+    // Other methods still get a 405, which lists what is allowed
+    const std::string postResponse = sendRequest(
+        "POST / HTTP/1.1\r\n"
+        "Host: localhost:10000\r\n"
+        "\r\n"
+    );
+    EXPECT_TRUE(postResponse.starts_with("HTTP/1.1 405 Method Not Allowed\r\n")) << postResponse;
+    EXPECT_NE(postResponse.find("Allow: GET, HEAD, OPTIONS\r\n"), std::string::npos) << postResponse;
+
+    // Compiled routes get the same treatment
+    const std::string compiledOptionsResponse = sendRequest(
+        "OPTIONS /compiled HTTP/1.1\r\n"
+        "Host: localhost:10000\r\n"
+        "Origin: https://example.com\r\n"
+        "\r\n"
+    );
+    EXPECT_TRUE(compiledOptionsResponse.starts_with("HTTP/1.1 204 No Content\r\n")) << compiledOptionsResponse;
+    EXPECT_NE(compiledOptionsResponse.find("Allow: GET, HEAD, OPTIONS\r\n"), std::string::npos)
+        << compiledOptionsResponse;
+    EXPECT_NE(compiledOptionsResponse.find("Access-Control-Allow-Methods: GET, HEAD, OPTIONS\r\n"), std::string::npos)
+        << compiledOptionsResponse;
+
+    const std::string compiledPostResponse = sendRequest(
+        "POST /compiled HTTP/1.1\r\n"
+        "Host: localhost:10000\r\n"
+        "\r\n"
+    );
+    EXPECT_TRUE(compiledPostResponse.starts_with("HTTP/1.1 405 Method Not Allowed\r\n")) << compiledPostResponse;
+    EXPECT_NE(compiledPostResponse.find("Allow: GET, HEAD, OPTIONS\r\n"), std::string::npos) << compiledPostResponse;
+
+    server.Shutdown();
+}
+
+/*
+    Connections beyond what the thread pool can queue get a 503 with "Retry-After"
+*/
+TEST(HttpServerTest, OverloadReturns503) {
+
+    HttpServerConfiguration config(
+        serverPort, 1, inputPollingIntervalMs, verbosity, timeZone
+    );
+    config.maxQueuedConnections = 2;
+    config.overloadPolicy = OverloadPolicy::REJECT;
+    config.retryAfterSeconds = 5;
+
+    Router router;
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+
+    // Occupies the only thread, sending nothing
+    Client busyClient;
+    EXPECT_TRUE(busyClient.ConnectToServer());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // Wait in the queue
+    Client queuedClients[2];
+    for (Client& queuedClient : queuedClients) {
+        EXPECT_TRUE(queuedClient.ConnectToServer());
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    // Turned away
+    Client rejectedClient;
+    EXPECT_TRUE(rejectedClient.ConnectToServer());
+
+    std::string buffer(1024, '\0');
+    const ssize_t bytesReceived = recv(rejectedClient.m_socket.Get(), buffer.data(), buffer.size() - 1, 0);
+    ASSERT_GT(bytesReceived, 0);
+    buffer.resize(bytesReceived);
+
+    EXPECT_TRUE(buffer.starts_with("HTTP/1.1 503 Service Unavailable\r\n")) << buffer;
+    EXPECT_NE(buffer.find("Retry-After: 5\r\n"), std::string::npos) << buffer;
+
+    // Let the busy connections finish, so shutting down doesn't wait on them
+    shutdown(busyClient.m_socket.Get(), SHUT_RDWR);
+    for (Client& queuedClient : queuedClients) {
+        shutdown(queuedClient.m_socket.Get(), SHUT_RDWR);
+    }
+
+    server.Shutdown();
+}
+
+/*
+    Requests beyond the concurrency limit get a 503, even with threads to spare
+*/
+TEST(HttpServerTest, ConcurrencyLimitReturns503) {
+
+    HttpServerConfiguration config(
+        serverPort, serverMaxConnections, inputPollingIntervalMs, verbosity, timeZone
+    );
+    config.maxConcurrentRequests = 1;
+    config.concurrencyQueueTimeoutMs = 0;
+
+    std::atomic<bool> isStarted = false;
+    std::atomic<bool> isReleased = false;
+
+    Router router;
+    router.Get("/slow", [&isStarted, &isReleased] (const HttpRequest&, HttpResponse& res) {
+        isStarted = true;
+        while (isReleased == false) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        res.SetStatus(200);
+    });
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+
+    const std::string req = "GET /slow HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+    Client slowClient;
+    EXPECT_TRUE(slowClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(slowClient.m_socket, req, 0));
+    while (isStarted == false) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    Client rejectedClient;
+    EXPECT_TRUE(rejectedClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(rejectedClient.m_socket, req, 0));
+
+    std::string buffer(1024, '\0');
+    const ssize_t bytesReceived = recv(rejectedClient.m_socket.Get(), buffer.data(), buffer.size() - 1, 0);
+    ASSERT_GT(bytesReceived, 0);
+    buffer.resize(bytesReceived);
+
+    EXPECT_TRUE(buffer.starts_with("HTTP/1.1 503 Service Unavailable\r\n")) << buffer;
+
+    isReleased = true;
+    server.Shutdown();
+}
+
+/*
+    The priority classifier sees the first request of a connection before it is queued
+*/
+TEST(HttpServerTest, PriorityClassifier) {
+
+    const HttpServerConfiguration config(
+        serverPort, serverMaxConnections, inputPollingIntervalMs, verbosity, timeZone
+    );
+
+    Router router;
+    router.Get("/health", [] (const HttpRequest&, HttpResponse& res) {
+        res.SetStatus(200);
+    });
+
+    HttpServer server(config, router);
+
+    std::atomic<bool> isClassified = false;
+    server.SetPriorityClassifier([&isClassified] (const HttpRequest& req) {
+        isClassified = req.requestUrl == "/health" && req.GetHeader("Host") == "localhost";
+        return isClassified ? JobPriority::CRITICAL : JobPriority::NORMAL;
+    });
+
+    // Have the whole request waiting before the server accepts the connection
+    Client client;
+    EXPECT_TRUE(client.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(client.m_socket, "GET /health HTTP/1.1\r\nHost: localhost\r\n\r\n", 0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+
+    std::string buffer(1024, '\0');
+    const ssize_t bytesReceived = recv(client.m_socket.Get(), buffer.data(), buffer.size() - 1, 0);
+    ASSERT_GT(bytesReceived, 0);
+    buffer.resize(bytesReceived);
+
+    EXPECT_TRUE(buffer.starts_with("HTTP/1.1 200 OK\r\n")) << buffer;
+    EXPECT_TRUE(isClassified);
+
+    server.Shutdown();
+}
+
+/*
+    Offloaded handlers run on the compute pool, the connection thread moves on meanwhile
+*/
+TEST(HttpServerTest, OffloadedHandlers) {
+
+    HttpServerConfiguration config(
+        serverPort, 1, inputPollingIntervalMs, verbosity, timeZone
+    );
+    config.computeThreads = 1;
+
+    std::atomic<bool> isStarted = false;
+    std::atomic<bool> isReleased = false;
+    std::atomic<std::thread::id> inlineThread;
+    std::atomic<std::thread::id> offloadThread;
+
+    Router router;
+    router.Get("/blocking", [&] (const HttpRequest&, HttpResponse& res) {
+        offloadThread = std::this_thread::get_id();
+        isStarted = true;
+        while (isReleased == false) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        res.SetStatus(200);
+        res.body = "blocking";
+    }, RouteOptions{.execution = HandlerExecution::OFFLOAD});
+    router.Get("/inline", [&] (const HttpRequest&, HttpResponse& res) {
+        inlineThread = std::this_thread::get_id();
+        res.SetStatus(200);
+        res.body = "inline";
+    });
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+
+    const auto receive = [] (Client& client) {
+        std::string buffer(1024, '\0');
+        const ssize_t bytesReceived = recv(client.m_socket.Get(), buffer.data(), buffer.size() - 1, 0);
+        buffer.resize(bytesReceived > 0 ? bytesReceived : 0);
+        return buffer;
+    };
+
+    // Kept alive, so the connection goes back to the connection thread afterwards
+    Client blockingClient;
+    EXPECT_TRUE(blockingClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(blockingClient.m_socket, "GET /blocking HTTP/1.1\r\nConnection: keep-alive\r\n\r\n", 0));
+    while (isStarted == false) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // The only connection thread is free to serve others while the blocking handler runs
+    Client inlineClient;
+    EXPECT_TRUE(inlineClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(inlineClient.m_socket, "GET /inline HTTP/1.1\r\n\r\n", 0));
+    EXPECT_NE(receive(inlineClient).find("inline"), std::string::npos);
+    EXPECT_NE(inlineThread.load(), offloadThread.load());
+
+    isReleased = true;
+    EXPECT_NE(receive(blockingClient).find("blocking"), std::string::npos);
+
+    // Same connection, next request
+    EXPECT_TRUE(NetworkIO::Send(blockingClient.m_socket, "GET /inline HTTP/1.1\r\n\r\n", 0));
+    EXPECT_NE(receive(blockingClient).find("inline"), std::string::npos);
+
+    server.Shutdown();
+}
+
+
+/*
+    A client that trickles in its request is cut off once the header deadline passes, while
+    one whose request arrives in pieces in time is answered as usual
+*/
+TEST(HttpServerTest, ConnectionDeadlines) {
+
+    HttpServerConfiguration config(
+        serverPort, serverMaxConnections, inputPollingIntervalMs, verbosity, timeZone
+    );
+    config.headerTimeoutMs = 200;
+    config.keepAliveTimeoutMs = 200;
+
+    Router router;
+    router.Get("/", [] (const HttpRequest&, HttpResponse& res) {
+        res.body = "hello";
+    });
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // Split across two writes, both within the deadline
+    Client splitClient;
+    ASSERT_TRUE(splitClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(splitClient.m_socket, std::string("GET / HTTP/1.1\r\nHost: loc"), 0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_TRUE(NetworkIO::Send(splitClient.m_socket, std::string("alhost\r\nConnection: keep-alive\r\n\r\n"), 0));
+
+    std::string buffer(1024, '\0');
+    ssize_t bytesReceived = recv(splitClient.m_socket.Get(), buffer.data(), buffer.size(), 0);
+    ASSERT_GT(bytesReceived, 0);
+    buffer.resize(bytesReceived);
+    EXPECT_TRUE(buffer.starts_with("HTTP/1.1 200 OK\r\n")) << buffer;
+
+    // Kept alive, then closed once idle for too long
+    const auto idleStart = std::chrono::steady_clock::now();
+    char byte;
+    EXPECT_EQ(recv(splitClient.m_socket.Get(), &byte, 1, 0), 0);
+    EXPECT_GE(std::chrono::steady_clock::now() - idleStart, std::chrono::milliseconds(200));
+
+    // A byte every 50ms never finishes the headers
+    Client slowClient;
+    ASSERT_TRUE(slowClient.ConnectToServer());
+
+    const auto slowStart = std::chrono::steady_clock::now();
+    const std::string request = "GET / HTTP/1.1\r\nHost: localhost\r\nX-Padding: aaaaaaaaaaaaaaaaaaaaaaaa\r\n\r\n";
+    for (const char c : request) {
+        if (send(slowClient.m_socket.Get(), &c, 1, MSG_NOSIGNAL) <= 0) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    EXPECT_LE(recv(slowClient.m_socket.Get(), &byte, 1, 0), 0);
+    EXPECT_LT(std::chrono::steady_clock::now() - slowStart, std::chrono::seconds(2));
+
+    server.Shutdown();
+}
+
+
+TEST(HttpServerTest, PersistentConnections) {
+
+    HttpServerConfiguration config(
+        serverPort, 1, inputPollingIntervalMs, verbosity, timeZone
+    );
+    config.maxRequestsPerConnection = 2;
+
+    Router router;
+    router.Get("/", [] (const HttpRequest&, HttpResponse& res) {
+        res.body = "hello";
+    });
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    const auto sendRequest = [] (const Client& client, const std::string& request) {
+        EXPECT_TRUE(NetworkIO::Send(client.m_socket, request, 0));
+
+        std::string buffer(1024, '\0');
+        const ssize_t bytesReceived = recv(client.m_socket.Get(), buffer.data(), buffer.size(), 0);
+        buffer.resize(std::max<ssize_t>(bytesReceived, 0));
+        return buffer;
+    };
+    const auto isClosed = [] (const Client& client) {
+        char byte;
+        return recv(client.m_socket.Get(), &byte, 1, 0) <= 0;
+    };
+
+    // HTTP/1.1 stays open without asking, until `maxRequestsPerConnection`
+    Client client;
+    ASSERT_TRUE(client.ConnectToServer());
+    std::string response = sendRequest(client, "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK\r\n")) << response;
+    EXPECT_NE(response.find("Connection: keep-alive\r\n"), std::string::npos) << response;
+
+    response = sendRequest(client, "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK\r\n")) << response;
+    EXPECT_NE(response.find("Connection: close\r\n"), std::string::npos) << response;
+    EXPECT_TRUE(isClosed(client));
+
+    // HTTP/1.0 closes unless asked not to
+    Client oldClient;
+    ASSERT_TRUE(oldClient.ConnectToServer());
+    response = sendRequest(oldClient, "GET / HTTP/1.0\r\nHost: localhost\r\n\r\n");
+    EXPECT_NE(response.find("Connection: close\r\n"), std::string::npos) << response;
+    EXPECT_TRUE(isClosed(oldClient));
+
+    // With its only thread held by an idle connection, the server closes it for a new one
+    Client idleClient;
+    ASSERT_TRUE(idleClient.ConnectToServer());
+    response = sendRequest(idleClient, "GET / HTTP/1.0\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n");
+    EXPECT_NE(response.find("Connection: keep-alive\r\n"), std::string::npos) << response;
+
+    Client newClient;
+    ASSERT_TRUE(newClient.ConnectToServer());
+    response = sendRequest(newClient, "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n");
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK\r\n")) << response;
+    EXPECT_TRUE(isClosed(idleClient));
+
+    server.Shutdown();
+}
+
+TEST(HttpServerTest, PipelinedRequests) {
+
+    HttpServerConfiguration config(
+        serverPort, serverMaxConnections, inputPollingIntervalMs, verbosity, timeZone
+    );
+
+    Router router;
+    router.Get("/first", [] (const HttpRequest&, HttpResponse& res) {
+        res.body = "first";
+    });
+    router.Post("/second", [] (const HttpRequest& req, HttpResponse& res) {
+        res.body = req.body;
+    });
+    router.Get("/third", [] (const HttpRequest&, HttpResponse& res) {
+        res.body = "third";
+    });
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    Client client;
+    ASSERT_TRUE(client.ConnectToServer());
+
+    // All three in one write, the last one split across a second write
+    const std::string requests =
+        "GET /first HTTP/1.1\r\nHost: localhost\r\n\r\n"
+        "POST /second HTTP/1.1\r\nHost: localhost\r\nContent-Length: 6\r\n\r\nsecond"
+        "GET /third HTTP/1.1\r\nHost: loc";
+    EXPECT_TRUE(NetworkIO::Send(client.m_socket, requests, 0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_TRUE(NetworkIO::Send(client.m_socket, std::string("alhost\r\nConnection: close\r\n\r\n"), 0));
+
+    // Read until the server closes the connection
+    std::string received;
+    std::string buffer(4096, '\0');
+    ssize_t bytesReceived;
+    while ((bytesReceived = recv(client.m_socket.Get(), buffer.data(), buffer.size(), 0)) > 0) {
+        received.append(buffer.data(), bytesReceived);
+    }
+
+    // In order, with a length on every response but the last, which ends with the connection
+    const std::string expected =
+        "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\nContent-Length: 5\r\n\r\nfirst"
+        "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\nContent-Length: 6\r\n\r\nsecond"
+        "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nthird";
+    EXPECT_EQ(received, expected);
+
+    server.Shutdown();
+}
+
+TEST(HttpServerTest, ChunkedRequestBodies) {
+
+    HttpServerConfiguration config(
+        serverPort, serverMaxConnections, inputPollingIntervalMs, verbosity, timeZone
+    );
+
+    Router router;
+    router.Post("/echo", [] (const HttpRequest& req, HttpResponse& res) {
+        const auto checksum = req.trailers.find("Checksum");
+        res.body = req.body + "|" + (checksum != req.trailers.end() ? checksum->second : "");
+    });
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    const auto readUntilClosed = [] (const Client& client) {
+        std::string received;
+        std::string buffer(4096, '\0');
+        ssize_t bytesReceived;
+        while ((bytesReceived = recv(client.m_socket.Get(), buffer.data(), buffer.size(), 0)) > 0) {
+            received.append(buffer.data(), bytesReceived);
+        }
+        return received;
+    };
+
+    // Chunks split across writes, then a pipelined request right after the trailers
+    Client client;
+    ASSERT_TRUE(client.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(client.m_socket, std::string(
+        "POST /echo HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhel"
+    ), 0));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_TRUE(NetworkIO::Send(client.m_socket, std::string(
+        "lo\r\n6;ext=1\r\n world\r\n0\r\nChecksum: 42\r\n\r\n"
+        "POST /echo HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nContent-Length: 4\r\n\r\nnext"
+    ), 0));
+
+    std::string received = readUntilClosed(client);
+    EXPECT_NE(received.find("\r\n\r\nhello world|42HTTP/1.1 200 OK\r\n"), std::string::npos) << received;
+    EXPECT_TRUE(received.ends_with("\r\n\r\nnext|")) << received;
+
+    // Broken framing gets a 400, and a coding other than chunked a 501
+    Client malformedClient;
+    ASSERT_TRUE(malformedClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(malformedClient.m_socket, std::string(
+        "POST /echo HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n"
+    ), 0));
+    received = readUntilClosed(malformedClient);
+    EXPECT_TRUE(received.starts_with("HTTP/1.1 400 Bad Request\r\n")) << received;
+
+    Client gzipClient;
+    ASSERT_TRUE(gzipClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(gzipClient.m_socket, std::string(
+        "POST /echo HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: gzip\r\n\r\n"
+    ), 0));
+    received = readUntilClosed(gzipClient);
+    EXPECT_TRUE(received.starts_with("HTTP/1.1 501 ")) << received;
+
+    // Repeated lengths are fine if they agree, and a 400 if they don't, never a second request
+    Client repeatedClient;
+    ASSERT_TRUE(repeatedClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(repeatedClient.m_socket, std::string(
+        "POST /echo HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+        "Content-Length: 4\r\ncontent-length: 4\r\n\r\nbody"
+    ), 0));
+    received = readUntilClosed(repeatedClient);
+    EXPECT_TRUE(received.ends_with("\r\n\r\nbody|")) << received;
+
+    Client conflictingClient;
+    ASSERT_TRUE(conflictingClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(conflictingClient.m_socket, std::string(
+        "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\nContent-Length: 40\r\n\r\n"
+        "GET /echo HTTP/1.1\r\nHost: localhost\r\n\r\n"
+    ), 0));
+    received = readUntilClosed(conflictingClient);
+    EXPECT_TRUE(received.starts_with("HTTP/1.1 400 Bad Request\r\n")) << received;
+    EXPECT_EQ(received.find("HTTP/1.1", 1), std::string::npos) << received;
+
+    server.Shutdown();
+}
+
+TEST(HttpServerTest, StreamedRequestBodies) {
+
+    HttpServerConfiguration config(
+        serverPort, serverMaxConnections, inputPollingIntervalMs, verbosity, timeZone
+    );
+
+    // Counts the body as it comes in, never holding more than a piece of it
+    Router router;
+    router.Post("/upload", [] (const HttpRequest& req, HttpResponse& res) {
+        EXPECT_TRUE(req.body.empty());
+        size_t largestPiece = 0;
+        while (const std::optional<std::string_view> piece = req.bodyReader->Read()) {
+            largestPiece = std::max(largestPiece, piece->size());
+        }
+        res.body = std::format("{}|{}", req.bodyReader->BytesRead(), largestPiece <= RequestReader::bufferSize);
+    }, RouteOptions{.maxBodySize = 4 << 20, .streamBody = true});
+    router.Post("/small", [] (const HttpRequest& req, HttpResponse& res) {
+        res.body = req.body;
+    }, RouteOptions{.maxBodySize = 8});
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    const auto readUntilClosed = [] (const Client& client) {
+        std::string received;
+        std::string buffer(4096, '\0');
+        ssize_t bytesReceived;
+        while ((bytesReceived = recv(client.m_socket.Get(), buffer.data(), buffer.size(), 0)) > 0) {
+            received.append(buffer.data(), bytesReceived);
+        }
+        return received;
+    };
+
+    // Past the 1MiB a buffered body is held to, then a pipelined request right after it
+    const size_t bodySize = 3 << 20;
+    Client client;
+    ASSERT_TRUE(client.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(client.m_socket, std::format(
+        "POST /upload HTTP/1.1\r\nHost: localhost\r\nContent-Length: {}\r\n\r\n{}"
+        "POST /small HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nContent-Length: 4\r\n\r\nnext",
+        bodySize,
+        std::string(bodySize, 'x')
+    ), 0));
+
+    std::string received = readUntilClosed(client);
+    EXPECT_NE(received.find(std::format("\r\n\r\n{}|trueHTTP/1.1 200 OK\r\n", bodySize)), std::string::npos) << received;
+    EXPECT_TRUE(received.ends_with("\r\n\r\nnext")) << received;
+
+    // Chunked bodies are streamed too
+    Client chunkedClient;
+    ASSERT_TRUE(chunkedClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(chunkedClient.m_socket, std::string(
+        "POST /upload HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n"
+    ), 0));
+    received = readUntilClosed(chunkedClient);
+    EXPECT_TRUE(received.ends_with("\r\n\r\n11|true")) << received;
+
+    // Too large for the route, turned away from the headers alone
+    Client largeClient;
+    ASSERT_TRUE(largeClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(largeClient.m_socket, std::string(
+        "POST /small HTTP/1.1\r\nHost: localhost\r\nContent-Length: 1000000\r\n\r\n"
+    ), 0));
+    received = readUntilClosed(largeClient);
+    EXPECT_TRUE(received.starts_with("HTTP/1.1 413 ")) << received;
+
+    // A length that isn't a number gets a 400
+    Client badLengthClient;
+    ASSERT_TRUE(badLengthClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(badLengthClient.m_socket, std::string(
+        "POST /small HTTP/1.1\r\nHost: localhost\r\nContent-Length: 12abc\r\n\r\nbody"
+    ), 0));
+    received = readUntilClosed(badLengthClient);
+    EXPECT_TRUE(received.starts_with("HTTP/1.1 400 Bad Request\r\n")) << received;
+
+    server.Shutdown();
+}
+
+TEST(HttpServerTest, StreamedResponses) {
+
+    HttpServerConfiguration config(
+        serverPort, serverMaxConnections, inputPollingIntervalMs, verbosity, timeZone
+    );
+
+    Router router;
+    router.Get("/export", [] (const HttpRequest&, HttpResponse& res) {
+        res.SetHeader("Content-Type", "text/csv");
+        res.Stream([] (ResponseWriter& writer) {
+            for (int i = 0; i < 10000 && writer.Write(std::format("{},row\n", i)); i++) {}
+        });
+    });
+    router.Get("/sized", [] (const HttpRequest&, HttpResponse& res) {
+        res.Stream([] (ResponseWriter& writer) {
+            writer.Write("sized");
+        }, 5);
+    });
+    router.Get("/badLength", [] (const HttpRequest&, HttpResponse& res) {
+        res.Stream([] (ResponseWriter& writer) {
+            writer.Write("unsized");
+        });
+        res.SetHeader("Content-Length", "12abc");
+    });
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    const auto readUntilClosed = [] (const Client& client) {
+        std::string received;
+        std::string buffer(65536, '\0');
+        ssize_t bytesReceived;
+        while ((bytesReceived = recv(client.m_socket.Get(), buffer.data(), buffer.size(), 0)) > 0) {
+            received.append(buffer.data(), bytesReceived);
+        }
+        return received;
+    };
+
+    std::string expectedBody;
+    for (int i = 0; i < 10000; i++) {
+        expectedBody += std::format("{},row\n", i);
+    }
+
+    // HTTP/1.1 gets chunks, and the connection stays usable after the last one
+    Client client;
+    ASSERT_TRUE(client.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(client.m_socket, std::string(
+        "GET /export HTTP/1.1\r\nHost: localhost\r\n\r\n"
+        "GET /sized HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+    ), 0));
+
+    const std::string received = readUntilClosed(client);
+    const size_t headEnd = received.find("\r\n\r\n") + 4;
+    EXPECT_NE(received.substr(0, headEnd).find("Transfer-Encoding: chunked\r\n"), std::string::npos) << received.substr(0, headEnd);
+
+    ChunkedDecoder decoder;
+    const size_t bodySize = decoder.Feed(std::string_view(received).substr(headEnd));
+    EXPECT_EQ(decoder.GetStatus(), ChunkedDecoder::Status::COMPLETE);
+    EXPECT_EQ(decoder.Body(), expectedBody);
+
+    const std::string sized = received.substr(headEnd + bodySize);
+    EXPECT_TRUE(sized.starts_with("HTTP/1.1 200 OK\r\n")) << sized;
+    EXPECT_NE(sized.find("Content-Length: 5\r\n"), std::string::npos) << sized;
+    EXPECT_TRUE(sized.ends_with("\r\n\r\nsized")) << sized;
+
+    // HTTP/1.0 reads until the connection closes
+    Client oldClient;
+    ASSERT_TRUE(oldClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(oldClient.m_socket, std::string(
+        "GET /export HTTP/1.0\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+    ), 0));
+    const std::string oldReceived = readUntilClosed(oldClient);
+    EXPECT_NE(oldReceived.find("Connection: close\r\n"), std::string::npos);
+    EXPECT_TRUE(oldReceived.ends_with("\r\n\r\n" + expectedBody));
+
+    // A length that isn't a number is dropped, and the body sent in chunks instead
+    Client badLengthClient;
+    ASSERT_TRUE(badLengthClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(badLengthClient.m_socket, std::string(
+        "GET /badLength HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+    ), 0));
+    const std::string badLengthReceived = readUntilClosed(badLengthClient);
+    EXPECT_EQ(badLengthReceived.find("Content-Length"), std::string::npos) << badLengthReceived;
+    EXPECT_TRUE(badLengthReceived.ends_with("\r\n\r\n7\r\nunsized\r\n0\r\n\r\n")) << badLengthReceived;
+
+    server.Shutdown();
+}
+
+TEST(HttpServerTest, AsyncHandlers) {
+
+    // One thread, so the polls below can only overlap if they let go of it while they wait
+    HttpServerConfiguration config(
+        serverPort, 1, inputPollingIntervalMs, verbosity, timeZone
+    );
+
+    constexpr auto pollTime = std::chrono::milliseconds(250);
+
+    Router router;
+    router.Get("/poll", AsyncHandler([pollTime] (const HttpRequest&, HttpResponse& res) -> Task<void> {
+        co_await SleepFor(pollTime);
+        res.body = "polled";
+    }));
+    router.Get("/fail", AsyncHandler([] (const HttpRequest&, HttpResponse&) -> Task<void> {
+        co_await SleepFor(std::chrono::milliseconds(1));
+        throw std::runtime_error("failed");
+    }));
+    router.Get("/sync", [] (const HttpRequest&, HttpResponse& res) {
+        res.body = "sync";
+    });
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    const auto readResponse = [] (const Client& client) {
+        std::string buffer(1024, '\0');
+        const ssize_t bytesReceived = recv(client.m_socket.Get(), buffer.data(), buffer.size(), 0);
+        buffer.resize(std::max<ssize_t>(bytesReceived, 0));
+        return buffer;
+    };
+
+    constexpr int pollCount = 4;
+    std::vector<std::unique_ptr<Client>> pollClients;
+    const auto start = std::chrono::steady_clock::now();
+
+    // Paced, the listen backlog is as short as the thread count
+    for (int i = 0; i < pollCount; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        pollClients.push_back(std::make_unique<Client>());
+        ASSERT_TRUE(pollClients.back()->ConnectToServer());
+        EXPECT_TRUE(NetworkIO::Send(pollClients.back()->m_socket, std::string(
+            "GET /poll HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+        ), 0));
+    }
+
+    // Sync handlers are answered while the polls are parked
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    Client syncClient;
+    ASSERT_TRUE(syncClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(syncClient.m_socket, std::string(
+        "GET /sync HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+    ), 0));
+    std::string response = readResponse(syncClient);
+    EXPECT_TRUE(response.ends_with("\r\n\r\nsync")) << response;
+    EXPECT_LT(std::chrono::steady_clock::now() - start, pollTime);
+
+    for (const std::unique_ptr<Client>& client : pollClients) {
+        response = readResponse(*client);
+        EXPECT_TRUE(response.starts_with("HTTP/1.1 200 OK\r\n")) << response;
+        EXPECT_TRUE(response.ends_with("\r\n\r\npolled")) << response;
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - start, pollTime * (pollCount - 1));
+
+    // A throwing handler gets a 500
+    Client failClient;
+    ASSERT_TRUE(failClient.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(failClient.m_socket, std::string("GET /fail HTTP/1.1\r\nHost: localhost\r\n\r\n"), 0));
+    response = readResponse(failClient);
+    EXPECT_TRUE(response.starts_with("HTTP/1.1 500 Internal Server Error\r\n")) << response;
+
+    // The connection is kept alive past an async handler
+    Client client;
+    ASSERT_TRUE(client.ConnectToServer());
+    EXPECT_TRUE(NetworkIO::Send(client.m_socket, std::string("GET /poll HTTP/1.1\r\nHost: localhost\r\n\r\n"), 0));
+    response = readResponse(client);
+    EXPECT_NE(response.find("Connection: keep-alive\r\n"), std::string::npos) << response;
+    EXPECT_TRUE(response.ends_with("\r\n\r\npolled")) << response;
+
+    EXPECT_TRUE(NetworkIO::Send(client.m_socket, std::string("GET /sync HTTP/1.1\r\nHost: localhost\r\n\r\n"), 0));
+    response = readResponse(client);
+    EXPECT_TRUE(response.ends_with("\r\n\r\nsync")) << response;
+
+    server.Shutdown();
+}
+
+TEST(HttpServerTest, AsyncRequestDeadline) {
+
+    HttpServerConfiguration config(
+        serverPort, serverMaxConnections, inputPollingIntervalMs, verbosity, timeZone
+    );
+    config.requestTimeoutMs = 100;
+
+    // Never written to, so waiting on it never ends by itself
+    int fds[2] = {-1, -1};
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    const Socket silent(fds[0]);
+    const Socket silentPeer(fds[1]);
+
+    Router router;
+    router.Get("/stuck", AsyncHandler([&silent] (const HttpRequest&, HttpResponse& res) -> Task<void> {
+        co_await WaitReadable(silent.Get());
+        res.body = "unstuck";
+    }));
+
+    HttpServer server(config, router);
+    std::jthread thread(&HttpServer::AcceptConnections, &server);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    Client client;
+    ASSERT_TRUE(client.ConnectToServer());
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(NetworkIO::Send(client.m_socket, std::string("GET /stuck HTTP/1.1\r\nHost: localhost\r\n\r\n"), 0));
+
+    // Answered, and the connection closed, even though the coroutine still waits
+    std::string received;
+    std::string buffer(1024, '\0');
+    ssize_t bytesReceived;
+    while ((bytesReceived = recv(client.m_socket.Get(), buffer.data(), buffer.size(), 0)) > 0) {
+        received.append(buffer.data(), bytesReceived);
+    }
+    EXPECT_TRUE(received.starts_with("HTTP/1.1 504 Gateway Timeout\r\n")) << received;
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+
+    // Shutting down wakes the coroutine, it finishes without answering again
+    server.Shutdown();
+}
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+
+#include "knots/RequestReader.hpp"
+#include "knots/Socket.hpp"
+
+/*
+    @brief Connected pair of sockets, the reader's end and the client's end
+*/
+static std::pair<Socket, Socket> MakeSocketPair() {
+    int fds[2] = {-1, -1};
+    EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    return {Socket(fds[0]), Socket(fds[1])};
+}
+
+static std::string ReadAll(RequestReader& reader) {
+    std::string body;
+    while (const std::optional<std::string_view> piece = reader.Read()) {
+        EXPECT_LE(piece->size(), RequestReader::bufferSize);
+        body += *piece;
+    }
+    return body;
+}
+
+TEST(RequestReaderTest, ReadsContentLength) {
+
+    auto [server, client] = MakeSocketPair();
+
+    // Far more than the socket buffers hold, so the client is held back until it is read
+    const std::string body(1 << 20, 'x');
+    std::jthread sender([&client, &body] () {
+        EXPECT_EQ(send(client.Get(), body.data(), body.size(), 0), static_cast<ssize_t>(body.size()));
+        EXPECT_EQ(send(client.Get(), "GET /next", 9, 0), 9);
+    });
+
+    // Part of the body came in with the head
+    size_t receives = 0;
+    RequestReader reader(server, "xxxx", RequestReader::Framing::CONTENT_LENGTH, body.size() + 4, body.size() + 4, [&receives] () {
+        receives++;
+    });
+
+    EXPECT_EQ(ReadAll(reader), "xxxx" + body);
+    EXPECT_TRUE(reader.IsComplete());
+    EXPECT_FALSE(reader.HasFailed());
+    EXPECT_EQ(reader.BytesRead(), body.size() + 4);
+    EXPECT_GE(receives, body.size() / RequestReader::bufferSize);
+
+    // Nothing past the body is read off the socket
+    sender.join();
+    EXPECT_TRUE(reader.TakeLeftover().empty());
+    std::string next(9, '\0');
+    EXPECT_EQ(recv(server.Get(), next.data(), next.size(), 0), 9);
+    EXPECT_EQ(next, "GET /next");
+}
+
+TEST(RequestReaderTest, ReadsChunks) {
+
+    auto [server, client] = MakeSocketPair();
+
+    const std::string rest =
+        "lo\r\n"
+        "7\r\n, world\r\n"
+        "0\r\n"
+        "Checksum: abc\r\n"
+        "\r\n"
+        "GET /next HTTP/1.1\r\n";
+    EXPECT_EQ(send(client.Get(), rest.data(), rest.size(), 0), static_cast<ssize_t>(rest.size()));
+
+    RequestReader reader(server, "5\r\nhel", RequestReader::Framing::CHUNKED, 0, 1024);
+
+    EXPECT_EQ(ReadAll(reader), "hello, world");
+    EXPECT_TRUE(reader.IsComplete());
+    EXPECT_EQ(reader.Trailers().at("checksum"), "abc");
+
+    // Read along with the end of the body, handed back for the connection
+    EXPECT_EQ(reader.TakeLeftover(), "GET /next HTTP/1.1\r\n");
+}
+
+TEST(RequestReaderTest, FailsOnLimitsAndDisconnects) {
+
+    auto [server, client] = MakeSocketPair();
+
+    // Turned away from the length alone
+    RequestReader tooLong(server, "", RequestReader::Framing::CONTENT_LENGTH, 100, 10);
+    EXPECT_EQ(tooLong.Read(), std::nullopt);
+    EXPECT_EQ(tooLong.ErrorStatus(), 413);
+
+    // Or from a chunk size, before its data arrives
+    RequestReader tooManyChunks(server, "8\r\n01234567\r\n", RequestReader::Framing::CHUNKED, 0, 10);
+    EXPECT_EQ(tooManyChunks.Read(), "01234567");
+    EXPECT_EQ(send(client.Get(), "8\r\n", 3, 0), 3);
+    EXPECT_EQ(tooManyChunks.Read(), std::nullopt);
+    EXPECT_EQ(tooManyChunks.ErrorStatus(), 413);
+
+    RequestReader malformed(server, "zz\r\n", RequestReader::Framing::CHUNKED, 0, 10);
+    EXPECT_EQ(malformed.Read(), std::nullopt);
+    EXPECT_EQ(malformed.ErrorStatus(), 400);
+
+    // A body cut short by the client going away has no status to answer with
+    RequestReader cutShort(server, "0123", RequestReader::Framing::CONTENT_LENGTH, 8, 8);
+    shutdown(client.Get(), SHUT_WR);
+    EXPECT_EQ(ReadAll(cutShort), "0123");
+    EXPECT_TRUE(cutShort.HasFailed());
+    EXPECT_EQ(cutShort.ErrorStatus(), 0);
+    EXPECT_FALSE(cutShort.Discard(1024));
+
+    // What a handler leaves unread is only read past up to a point
+    RequestReader unread(server, "0123456789", RequestReader::Framing::CONTENT_LENGTH, 10, 10);
+    EXPECT_TRUE(unread.Discard(16));
+    RequestReader tooMuchUnread(server, "", RequestReader::Framing::CONTENT_LENGTH, 1 << 20, 1 << 20);
+    EXPECT_FALSE(tooMuchUnread.Discard(16));
+}
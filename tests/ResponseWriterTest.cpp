@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+
+#include "knots/ChunkedDecoder.hpp"
+#include "knots/ResponseWriter.hpp"
+#include "knots/Socket.hpp"
+
+/*
+    @brief Connected pair of sockets, the writer's end and the client's end
+*/
+static std::pair<Socket, Socket> MakeSocketPair() {
+    int fds[2] = {-1, -1};
+    EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    return {Socket(fds[0]), Socket(fds[1])};
+}
+
+static std::string ReadAll(const Socket& socket) {
+    std::string received;
+    std::string buffer(65536, '\0');
+    ssize_t bytesReceived;
+    while ((bytesReceived = recv(socket.Get(), buffer.data(), buffer.size(), 0)) > 0) {
+        received.append(buffer.data(), bytesReceived);
+    }
+    return received;
+}
+
+TEST(ResponseWriterTest, WritesChunks) {
+
+    auto [server, client] = MakeSocketPair();
+
+    {
+        ResponseWriter writer(server, ResponseWriter::Framing::CHUNKED);
+
+        // Small writes are gathered, a large one goes out as its own chunk
+        EXPECT_TRUE(writer.Write("hello"));
+        EXPECT_TRUE(writer.Write(", "));
+        EXPECT_TRUE(writer.Flush());
+        EXPECT_TRUE(writer.Write(std::string(ResponseWriter::bufferSize, 'x')));
+        EXPECT_TRUE(writer.Write("world"));
+        EXPECT_TRUE(writer.Finish());
+        EXPECT_EQ(writer.BytesWritten(), 12 + ResponseWriter::bufferSize);
+
+        // Nothing after the end
+        EXPECT_FALSE(writer.Write("more"));
+    }
+    shutdown(server.Get(), SHUT_WR);
+
+    const std::string received = ReadAll(client);
+    EXPECT_TRUE(received.starts_with("7\r\nhello, \r\n4000\r\nxxx")) << received.substr(0, 32);
+    EXPECT_TRUE(received.ends_with("\r\n5\r\nworld\r\n0\r\n\r\n"));
+
+    ChunkedDecoder decoder;
+    EXPECT_EQ(decoder.Feed(received), received.size());
+    EXPECT_EQ(decoder.GetStatus(), ChunkedDecoder::Status::COMPLETE);
+    EXPECT_EQ(decoder.Body(), "hello, " + std::string(ResponseWriter::bufferSize, 'x') + "world");
+}
+
+TEST(ResponseWriterTest, HoldsToContentLength) {
+
+    auto [server, client] = MakeSocketPair();
+
+    ResponseWriter exact(server, ResponseWriter::Framing::CONTENT_LENGTH, 10);
+    EXPECT_TRUE(exact.Write("01234"));
+    EXPECT_TRUE(exact.Write("56789"));
+    EXPECT_TRUE(exact.Finish());
+
+    // Too much is refused before anything of it is sent, too little fails at the end
+    ResponseWriter tooLong(server, ResponseWriter::Framing::CONTENT_LENGTH, 4);
+    EXPECT_FALSE(tooLong.Write("01234"));
+    EXPECT_TRUE(tooLong.HasFailed());
+
+    ResponseWriter tooShort(server, ResponseWriter::Framing::CONTENT_LENGTH, 4);
+    EXPECT_TRUE(tooShort.Write("012"));
+    EXPECT_FALSE(tooShort.Finish());
+
+    shutdown(server.Get(), SHUT_WR);
+    EXPECT_EQ(ReadAll(client), "0123456789012");
+}
+
+TEST(ResponseWriterTest, BlocksWhileClientIsBehind) {
+
+    auto [server, client] = MakeSocketPair();
+
+    // Far more than the socket buffers hold, so the writer has to wait on the reader
+    constexpr size_t bodySize = 32 << 20;
+    std::atomic<size_t> bytesRead = 0;
+
+    std::jthread reader([&client, &bytesRead] () {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        bytesRead = ReadAll(client).size();
+    });
+
+    ResponseWriter writer(server, ResponseWriter::Framing::UNTIL_CLOSE);
+    const std::string piece(4096, 'x');
+
+    const auto start = std::chrono::steady_clock::now();
+    size_t written = 0;
+    while (written < bodySize && writer.Write(piece)) {
+        written += piece.size();
+    }
+
+    // Only the end of the connection marks the end of this body
+    EXPECT_FALSE(writer.Finish());
+    EXPECT_FALSE(writer.HasFailed());
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(40));
+
+    shutdown(server.Get(), SHUT_WR);
+    reader.join();
+    EXPECT_EQ(bytesRead, bodySize);
+}
@@ -1,4 +1,6 @@
 #include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
 
 #include "knots/Router.hpp"
 #include "knots/utils/Log.hpp"
@@ -268,4 +270,441 @@ TEST(RouterTest, CheckRouteParameterParsing) {
             }
         }
     }
-}
\ No newline at end of file
+}
+
+TEST(RouterTest, WildcardSegments) {
+
+    Router router;
+
+    const auto makeHandler = [] (const std::string& name) {
+        return [name] (const HttpRequest& req, HttpResponse& res) {
+            res.SetBody(name);
+            return;
+        };
+    };
+
+    router.Get("/files/{*path}", makeHandler("wildcard"));
+    router.Get("/files/{fileId}", makeHandler("dynamic"));
+    router.Get("/files/readme", makeHandler("static"));
+    router.Get("/files/{fileId}/meta", makeHandler("meta"));
+    router.Get("/{*spa}", makeHandler("spa"));
+
+    // Illegal, a wildcard has to be the last segment
+    router.Get("/broken/{*rest}/tail", makeHandler("broken"));
+
+    const std::vector<std::tuple<std::string, std::string, std::string, std::string>> cases = {
+        // URL, expected handler, route parameter, expected value
+        {"/files/readme",       "static",   "",       ""},
+        {"/files/100",          "dynamic",  "fileId", "100"},
+        {"/files/100/meta",     "meta",     "fileId", "100"},
+        {"/files/100/raw/blob", "wildcard", "path",   "100/raw/blob"},
+        {"/files",              "wildcard", "path",   ""},
+        {"/dashboard/settings", "spa",      "spa",    "dashboard/settings"},
+        {"/",                   "spa",      "spa",    ""},
+        {"/broken/a/tail",      "spa",      "spa",    "broken/a/tail"},
+    };
+
+    for (const auto& [url, expectedBody, param, expectedValue] : cases) {
+        HttpRequest req(HttpMethod::GET, url, HttpVersion::HTTP_1_1, {}, {}, {}, {});
+        HttpResponse res;
+
+        const SegmentHandlerFunctions* handlers = router.FetchFunctionsForRoute(req);
+        ASSERT_TRUE(handlers) << Log::MakeErrorMessage(std::format(
+            "No handlers found for {}", url
+        ));
+
+        const HandlerFunction& handler = handlers->GetHandler(req.method);
+        ASSERT_TRUE(handler);
+        handler(req, res);
+
+        EXPECT_EQ(res.body, expectedBody) << url;
+        if (param.empty() == false) {
+            EXPECT_EQ(req.GetRouteParam(param).value_or("<missing>"), expectedValue) << url;
+        }
+    }
+
+    // Parameters captured below the wildcard are thrown away when falling back to it
+    HttpRequest req(HttpMethod::GET, "/files/100/raw", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    EXPECT_TRUE(router.FetchFunctionsForRoute(req));
+    EXPECT_FALSE(req.GetRouteParam("fileId").has_value());
+    EXPECT_EQ(req.GetRouteParam("path"), "100/raw");
+}
+
+TEST(RouterTest, ConflictingParameterNames) {
+
+    Router router;
+
+    const auto makeHandler = [] (const std::string& name) {
+        return [name] (const HttpRequest& req, HttpResponse& res) {
+            res.SetBody(name);
+            return;
+        };
+    };
+
+    router.Get("/a/{x}", makeHandler("x"));
+    // Rejected, `{y}` would sit at the same position as `{x}`
+    router.Get("/a/{y}/b", makeHandler("y"));
+    router.Get("/a/{x}/c", makeHandler("c"));
+    router.Get("/f/{*rest}", makeHandler("rest"));
+    router.Get("/f/{*other}", makeHandler("other"));
+
+    HttpRequest req(HttpMethod::GET, "/a/1", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    HttpResponse res;
+    const SegmentHandlerFunctions* handlers = router.FetchFunctionsForRoute(req);
+    ASSERT_TRUE(handlers);
+    handlers->GetHandler(req.method)(req, res);
+    EXPECT_EQ(res.body, "x");
+    EXPECT_EQ(req.GetRouteParam("x"), "1");
+
+    HttpRequest rejected(HttpMethod::GET, "/a/1/b", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    EXPECT_FALSE(router.FetchFunctionsForRoute(rejected));
+
+    HttpRequest nested(HttpMethod::GET, "/a/1/c", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    HttpResponse nestedRes;
+    handlers = router.FetchFunctionsForRoute(nested);
+    ASSERT_TRUE(handlers);
+    handlers->GetHandler(nested.method)(nested, nestedRes);
+    EXPECT_EQ(nestedRes.body, "c");
+    EXPECT_EQ(nested.GetRouteParam("x"), "1");
+
+    HttpRequest wildcard(HttpMethod::GET, "/f/1/2", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    HttpResponse wildcardRes;
+    handlers = router.FetchFunctionsForRoute(wildcard);
+    ASSERT_TRUE(handlers);
+    handlers->GetHandler(wildcard.method)(wildcard, wildcardRes);
+    EXPECT_EQ(wildcardRes.body, "rest");
+    EXPECT_EQ(wildcard.GetRouteParam("rest"), "1/2");
+}
+
+TEST(RouterTest, MountSubRouter) {
+
+    Router subRouter;
+    subRouter.Get("/", [] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody(std::string("root"));
+    });
+    subRouter.Get("/users", [] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody(std::string("users"));
+    });
+    subRouter.Post("/users/{userId}", [] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody(req.GetRouteParam("userId").value_or(""));
+    });
+    subRouter.Get("/assets/{*path}", [] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody(req.GetRouteParam("path").value_or(""));
+    });
+
+    Router router;
+    router.Mount("/api/v2/", subRouter);
+
+    const std::vector<std::tuple<HttpMethod, std::string, std::string>> cases = {
+        {HttpMethod::GET,  "/api/v2",                "root"},
+        {HttpMethod::GET,  "/api/v2/users",          "users"},
+        {HttpMethod::POST, "/api/v2/users/100",      "100"},
+        {HttpMethod::GET,  "/api/v2/assets/css/a.css", "css/a.css"},
+    };
+
+    for (const auto& [method, url, expectedBody] : cases) {
+        HttpRequest req(method, url, HttpVersion::HTTP_1_1, {}, {}, {}, {});
+        HttpResponse res;
+
+        const SegmentHandlerFunctions* handlers = router.FetchFunctionsForRoute(req);
+        ASSERT_TRUE(handlers) << url;
+
+        const HandlerFunction& handler = handlers->GetHandler(req.method);
+        ASSERT_TRUE(handler) << url;
+        handler(req, res);
+
+        EXPECT_EQ(res.body, expectedBody) << url;
+    }
+
+    // Nothing leaks outside the prefix
+    HttpRequest req(HttpMethod::GET, "/users", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    EXPECT_FALSE(router.FetchFunctionsForRoute(req));
+}
+
+void SharedHandler(const HttpRequest& req, HttpResponse& res) {
+    res.SetBody(std::string("shared"));
+    return;
+}
+
+TEST(RouterTest, HandlersAreStoredOnce) {
+
+    Router router;
+
+    router.Get("/a", SharedHandler);
+    router.Post("/a", SharedHandler);
+    router.Get("/b/{id}", SharedHandler);
+    router.Put("/a", [] (const HttpRequest& req, HttpResponse& res) {
+        res.SetBody(std::string("put"));
+    });
+
+    HttpRequest getA(HttpMethod::GET, "/a", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    HttpRequest getB(HttpMethod::GET, "/b/100", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+
+    const SegmentHandlerFunctions* handlersA = router.FetchFunctionsForRoute(getA);
+    const SegmentHandlerFunctions* handlersB = router.FetchFunctionsForRoute(getB);
+    ASSERT_TRUE(handlersA);
+    ASSERT_TRUE(handlersB);
+
+    // Only the methods that were registered take up space
+    EXPECT_EQ(handlersA->m_handlers.size(), 3);
+    EXPECT_EQ(handlersB->m_handlers.size(), 1);
+    EXPECT_TRUE(handlersA->HasHandler(HttpMethod::PUT));
+    EXPECT_FALSE(handlersA->HasHandler(HttpMethod::DELETE));
+    EXPECT_FALSE(handlersA->GetHandler(HttpMethod::DELETE));
+
+    // The same function pointer is interned into a single handler
+    EXPECT_EQ(&handlersA->GetHandler(HttpMethod::GET), &handlersA->GetHandler(HttpMethod::POST));
+    EXPECT_EQ(&handlersA->GetHandler(HttpMethod::GET), &handlersB->GetHandler(HttpMethod::GET));
+
+    HttpResponse res;
+    handlersA->GetHandler(HttpMethod::PUT)(getA, res);
+    EXPECT_EQ(res.body, "put");
+}
+
+TEST(RouterTest, MiddlewareRunsAroundHandlers) {
+
+    Router router;
+    std::vector<std::string> calls;
+
+    router.Use([&calls] (const HttpRequest& req, HttpResponse& res, const HandlerFunction& next) {
+        calls.push_back("outer before");
+        next(req, res);
+        calls.push_back("outer after");
+    });
+    router.Use([&calls] (const HttpRequest& req, HttpResponse& res, const HandlerFunction& next) {
+        // Short circuit anything under /private
+        if (req.requestUrl.starts_with("/private")) {
+            res.SetStatus(403);
+            calls.push_back("denied");
+            return;
+        }
+
+        calls.push_back("inner before");
+        next(req, res);
+        calls.push_back("inner after");
+    });
+
+    router.Get("/public", [&calls] (const HttpRequest& req, HttpResponse& res) {
+        calls.push_back("handler");
+    });
+    router.Get("/private/{id}", [&calls] (const HttpRequest& req, HttpResponse& res) {
+        calls.push_back("handler");
+    });
+
+    // Middleware only applies once the router is frozen
+    Router frozen = router;
+    frozen.Freeze();
+    frozen.Freeze();
+
+    frozen.Get("/late", [&calls] (const HttpRequest& req, HttpResponse& res) {
+        calls.push_back("handler");
+    });
+
+    const auto run = [] (const Router& router, const std::string& url) {
+        HttpRequest req(HttpMethod::GET, url, HttpVersion::HTTP_1_1, {}, {}, {}, {});
+        HttpResponse res;
+
+        const SegmentHandlerFunctions* handlers = router.FetchFunctionsForRoute(req);
+        if (handlers == nullptr) {
+            return res;
+        }
+
+        handlers->GetHandler(req.method)(req, res);
+        return res;
+    };
+
+    run(frozen, "/public");
+    EXPECT_EQ(calls, std::vector<std::string>({
+        "outer before", "inner before", "handler", "inner after", "outer after"
+    }));
+
+    calls.clear();
+    HttpResponse res = run(frozen, "/private/1");
+    EXPECT_EQ(res.statusCode, 403);
+    EXPECT_EQ(calls, std::vector<std::string>({"outer before", "denied", "outer after"}));
+
+    // Routes added after freezing still get the middleware
+    calls.clear();
+    run(frozen, "/late");
+    EXPECT_EQ(calls, std::vector<std::string>({
+        "outer before", "inner before", "handler", "inner after", "outer after"
+    }));
+
+    // The original router is left untouched by freezing its copy
+    calls.clear();
+    run(router, "/private/1");
+    EXPECT_EQ(calls, std::vector<std::string>({"handler"}));
+}
+
+TEST(RouterTest, MountedRouterMiddleware) {
+
+    Router api;
+    api.Use([] (const HttpRequest& req, HttpResponse& res, const HandlerFunction& next) {
+        res.body += "api ";
+        next(req, res);
+    });
+    api.Get("/users", [] (const HttpRequest& req, HttpResponse& res) {
+        res.body += "users";
+    });
+
+    Router router;
+    router.Use([] (const HttpRequest& req, HttpResponse& res, const HandlerFunction& next) {
+        res.body += "root ";
+        next(req, res);
+    });
+    router.Get("/health", [] (const HttpRequest& req, HttpResponse& res) {
+        res.body += "ok";
+    });
+    router.Mount("/api", api);
+    router.Freeze();
+
+    const std::vector<std::pair<std::string, std::string>> cases = {
+        {"/health", "root ok"},
+        {"/api/users", "root api users"},
+    };
+
+    for (const auto& [url, expectedBody] : cases) {
+        HttpRequest req(HttpMethod::GET, url, HttpVersion::HTTP_1_1, {}, {}, {}, {});
+        HttpResponse res;
+
+        const SegmentHandlerFunctions* handlers = router.FetchFunctionsForRoute(req);
+        ASSERT_TRUE(handlers) << url;
+        handlers->GetHandler(req.method)(req, res);
+
+        EXPECT_EQ(res.body, expectedBody) << url;
+    }
+}
+
+TEST(RouterTest, AllowedMethods) {
+
+    Router router;
+    router.Get("/a", SharedHandler);
+    router.Post("/a", SharedHandler);
+    router.Delete("/b/{id}", SharedHandler);
+
+    HttpRequest reqA(HttpMethod::GET, "/a", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    HttpRequest reqB(HttpMethod::GET, "/b/1", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+
+    const SegmentHandlerFunctions* handlersA = router.FetchFunctionsForRoute(reqA);
+    const SegmentHandlerFunctions* handlersB = router.FetchFunctionsForRoute(reqB);
+    ASSERT_TRUE(handlersA);
+    ASSERT_TRUE(handlersB);
+
+    // HEAD comes with GET, OPTIONS is always allowed
+    EXPECT_EQ(handlersA->AllowedMethods(), "GET, HEAD, POST, OPTIONS");
+    EXPECT_EQ(handlersB->AllowedMethods(), "DELETE, OPTIONS");
+
+    // Routes with the same methods share the string
+    router.Get("/c", SharedHandler);
+    router.Post("/c", SharedHandler);
+    HttpRequest reqC(HttpMethod::GET, "/c", HttpVersion::HTTP_1_1, {}, {}, {}, {});
+    EXPECT_EQ(&router.FetchFunctionsForRoute(reqC)->AllowedMethods(), &handlersA->AllowedMethods());
+}
+
+/*
+    A route capped with `RouteOptions` answers 503 while full, other routes are unaffected
+*/
+TEST(RouterTest, RouteConcurrencyLimit) {
+
+    std::atomic<bool> isStarted = false;
+    std::atomic<bool> isReleased = false;
+
+    Router router;
+    router.Get("/slow", [&isStarted, &isReleased] (const HttpRequest&, HttpResponse& res) {
+        isStarted = true;
+        while (isReleased == false) {
+            std::this_thread::yield();
+        }
+        res.SetStatus(200);
+    }, RouteOptions{.maxConcurrentRequests = 1});
+    router.Get("/health", [] (const HttpRequest&, HttpResponse& res) {
+        res.SetStatus(200);
+    });
+
+    HttpRequest slowReq;
+    slowReq.method = HttpMethod::GET;
+    slowReq.requestUrl = "/slow";
+
+    const HandlerFunction& slowHandler = router.FetchFunctionsForRoute(slowReq)->GetHandler(HttpMethod::GET);
+
+    std::jthread first([&slowHandler, &slowReq] () {
+        HttpResponse res;
+        slowHandler(slowReq, res);
+    });
+    while (isStarted == false) {
+        std::this_thread::yield();
+    }
+
+    HttpResponse rejected;
+    slowHandler(slowReq, rejected);
+    EXPECT_EQ(rejected.statusCode, 503);
+    EXPECT_EQ(rejected.GetHeader("Retry-After"), "1");
+
+    // Frozen by a server, the route answers with the server's "Retry-After", mounted or not
+    router.Freeze(7);
+    HttpResponse rejectedFrozen;
+    slowHandler(slowReq, rejectedFrozen);
+    EXPECT_EQ(rejectedFrozen.GetHeader("Retry-After"), "7");
+
+    Router parent;
+    parent.Mount("/api", router);
+    parent.Freeze(9);
+    HttpResponse rejectedMounted;
+    slowHandler(slowReq, rejectedMounted);
+    EXPECT_EQ(rejectedMounted.GetHeader("Retry-After"), "9");
+
+    HttpRequest healthReq;
+    healthReq.method = HttpMethod::GET;
+    healthReq.requestUrl = "/health";
+
+    HttpResponse health;
+    router.FetchFunctionsForRoute(healthReq)->GetHandler(HttpMethod::GET)(healthReq, health);
+    EXPECT_EQ(health.statusCode, 200);
+
+    isReleased = true;
+    first.join();
+
+    HttpResponse afterwards;
+    slowHandler(slowReq, afterwards);
+    EXPECT_EQ(afterwards.statusCode, 200);
+
+    // A coroutine is still one behind the limit, so the server can park it
+    router.Get("/async", AsyncHandler([] (const HttpRequest&, HttpResponse& res) -> Task<void> {
+        co_await SleepFor(std::chrono::milliseconds(1));
+        res.SetStatus(202);
+    }), RouteOptions{.maxConcurrentRequests = 1});
+
+    HttpRequest asyncReq;
+    asyncReq.method = HttpMethod::GET;
+    asyncReq.requestUrl = "/async";
+
+    const HandlerFunction& asyncHandler = router.FetchFunctionsForRoute(asyncReq)->GetHandler(HttpMethod::GET);
+    ASSERT_NE(asyncHandler.target<AsyncHandler>(), nullptr);
+
+    HttpResponse asyncRes;
+    asyncHandler.target<AsyncHandler>()->MakeTask(asyncReq, asyncRes).Run();
+    EXPECT_EQ(asyncRes.statusCode, 202);
+}
+
+TEST(RouterTest, HandlerExecution) {
+
+    const auto handler = [] (const HttpRequest&, HttpResponse&) {};
+
+    Router subRouter;
+    subRouter.Get("/report/{id}", handler, RouteOptions{.execution = HandlerExecution::OFFLOAD});
+    subRouter.Post("/report/{id}", handler);
+
+    Router router;
+    router.Mount("/api", subRouter);
+
+    HttpRequest req;
+    req.method = HttpMethod::GET;
+    req.requestUrl = "/api/report/7";
+
+    // Carried over when mounting
+    const SegmentHandlerFunctions* handlers = router.FetchFunctionsForRoute(req);
+    ASSERT_NE(handlers, nullptr);
+    EXPECT_EQ(handlers->GetExecution(HttpMethod::GET), HandlerExecution::OFFLOAD);
+    EXPECT_EQ(handlers->GetExecution(HttpMethod::POST), HandlerExecution::INLINE);
+    EXPECT_EQ(handlers->GetExecution(HttpMethod::PUT), HandlerExecution::INLINE);
+}
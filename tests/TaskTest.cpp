@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "knots/EventLoop.hpp"
+#include "knots/Socket.hpp"
+#include "knots/Task.hpp"
+#include "knots/ThreadPool.hpp"
+
+static Task<int> Add(const int a, const int b) {
+    co_await SleepFor(std::chrono::milliseconds(1));
+    co_return a + b;
+}
+
+static Task<int> Sum(const int count) {
+    int sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum = co_await Add(sum, i);
+    }
+    co_return sum;
+}
+
+static Task<void> Fail() {
+    co_await SleepFor(std::chrono::milliseconds(1));
+    throw std::runtime_error("failed");
+}
+
+static Task<std::string> Catch() {
+    try {
+        co_await Fail();
+    }
+    catch (const std::runtime_error& error) {
+        co_return error.what();
+    }
+    co_return "not thrown";
+}
+
+TEST(TaskTest, AwaitsOtherTasks) {
+
+    // Without an event loop, awaiting blocks the thread instead
+    EXPECT_EQ(Sum(10).Run(), 45);
+    EXPECT_EQ(Catch().Run(), "failed");
+    EXPECT_THROW(Fail().Run(), std::runtime_error);
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({2});
+    EventLoop loop;
+
+    Task<int> task = Sum(10);
+    std::atomic<bool> isDone = false;
+    task.Start(TaskContext{&pool, &loop}, [&isDone] () {
+        isDone = true;
+        isDone.notify_one();
+    });
+    isDone.wait(false);
+
+    EXPECT_TRUE(task.IsDone());
+    EXPECT_FALSE(task.HasFailed());
+    EXPECT_EQ(task.Result(), 45);
+}
+
+TEST(TaskTest, SleepsWithoutHoldingAThread) {
+
+    constexpr int taskCount = 50;
+    constexpr auto sleepTime = std::chrono::milliseconds(100);
+
+    const auto sleeper = [sleepTime] (std::atomic<int>& finished) -> Task<void> {
+        co_await SleepFor(sleepTime);
+        finished++;
+        finished.notify_one();
+    };
+
+    // Declared before the pool, so they outlive the last of them finishing on it
+    std::atomic<int> finished = 0;
+    std::vector<Task<void>> tasks;
+
+    // One thread, many sleeping tasks, they only finish in time if they don't hold it
+    ThreadPool pool;
+    pool.InitializeThreadPool({1});
+    EventLoop loop;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < taskCount; i++) {
+        tasks.push_back(sleeper(finished));
+    }
+    for (Task<void>& task : tasks) {
+        pool.EnqueueJob([&task, &pool, &loop] () {
+            task.Start(TaskContext{&pool, &loop}, nullptr);
+        });
+    }
+
+    for (int count = finished; count < taskCount; count = finished) {
+        finished.wait(count);
+    }
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_GE(elapsed, sleepTime);
+    EXPECT_LT(elapsed, sleepTime * (taskCount / 5));
+}
+
+TEST(TaskTest, WaitsForSockets) {
+
+    int fds[2] = {-1, -1};
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    const Socket reader(fds[0]);
+    const Socket writer(fds[1]);
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({1});
+    EventLoop loop;
+
+    const auto readOne = [] (const Socket& socket) -> Task<std::string> {
+        if (co_await WaitReadable(socket.Get()) == false) {
+            co_return "not ready";
+        }
+        char c = '\0';
+        EXPECT_EQ(recv(socket.Get(), &c, 1, MSG_DONTWAIT), 1);
+        co_return std::string(1, c);
+    };
+
+    Task<std::string> task = readOne(reader);
+    std::atomic<bool> isDone = false;
+    task.Start(TaskContext{&pool, &loop}, [&isDone] () {
+        isDone = true;
+        isDone.notify_one();
+    });
+
+    // Nothing to read yet, so it waits
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(isDone);
+
+    EXPECT_EQ(send(writer.Get(), "x", 1, 0), 1);
+    isDone.wait(false);
+    EXPECT_EQ(task.Result(), "x");
+
+    // Stopping the loop wakes whatever still waits
+    Task<std::string> stopped = readOne(reader);
+    isDone = false;
+    stopped.Start(TaskContext{&pool, &loop}, [&isDone] () {
+        isDone = true;
+        isDone.notify_one();
+    });
+    loop.Stop();
+    isDone.wait(false);
+    EXPECT_EQ(stopped.Result(), "not ready");
+
+    // And nothing waits on a stopped loop
+    Task<std::string> afterStop = readOne(reader);
+    afterStop.Start(TaskContext{&pool, &loop}, nullptr);
+    EXPECT_TRUE(afterStop.IsDone());
+    EXPECT_EQ(afterStop.Result(), "not ready");
+
+    // A loop can be stopped from its own callback, ex: a command to shut down
+    EventLoop selfStopped;
+    isDone = false;
+    EXPECT_TRUE(selfStopped.AddTimer(EventLoop::Clock::now(), [&selfStopped, &isDone] (uint32_t) {
+        selfStopped.Stop();
+        isDone = true;
+        isDone.notify_one();
+    }));
+    isDone.wait(false);
+    EXPECT_FALSE(selfStopped.AddTimer(EventLoop::Clock::now(), [] (uint32_t) {}));
+}
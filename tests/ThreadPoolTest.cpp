@@ -0,0 +1,824 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <sched.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "knots/ConcurrentQueues.hpp"
+#include "knots/Job.hpp"
+#include "knots/Socket.hpp"
+#include "knots/ThreadPool.hpp"
+
+/*
+    Spin until `condition` holds, or give up after a few seconds
+*/
+template <typename Condition>
+bool WaitFor(const Condition& condition) {
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (condition() == false) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return true;
+}
+
+TEST(ThreadPoolTest, WorkStealingDeque) {
+
+    WorkStealingDeque<int> deque(4);
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(deque.Push(i));
+    }
+
+    // Full
+    int extra = 4;
+    EXPECT_FALSE(deque.Push(extra));
+
+    // Owner pops the newest, thieves steal the oldest
+    EXPECT_EQ(deque.Pop(), 3);
+    EXPECT_EQ(deque.Steal(), 0);
+    EXPECT_EQ(deque.Steal(), 1);
+    EXPECT_EQ(deque.Pop(), 2);
+    EXPECT_EQ(deque.Pop(), std::nullopt);
+    EXPECT_EQ(deque.Steal(), std::nullopt);
+}
+
+TEST(ThreadPoolTest, BoundedMpmcQueue) {
+
+    BoundedMpmcQueue<int> queue(3);
+    EXPECT_EQ(queue.Capacity(), 4);
+    EXPECT_EQ(BoundedMpmcQueue<int>(1).Capacity(), 2);
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(queue.TryPush(i));
+    }
+
+    int extra = 4;
+    EXPECT_FALSE(queue.TryPush(extra));
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(queue.TryPop(), i);
+    }
+    EXPECT_EQ(queue.TryPop(), std::nullopt);
+}
+
+/*
+    Many producers, many thieves; every job runs exactly once
+*/
+TEST(ThreadPoolTest, RunsEveryJob) {
+
+    constexpr int producerCount = 4;
+    constexpr int jobsPerProducer = 5000;
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({8});
+
+    std::atomic<int> jobsRun = 0;
+    std::atomic<int> nestedJobsRun = 0;
+
+    std::vector<std::jthread> producers;
+    for (int p = 0; p < producerCount; p++) {
+        producers.emplace_back([&pool, &jobsRun, &nestedJobsRun] () {
+            for (int i = 0; i < jobsPerProducer; i++) {
+                // Jobs enqueued from inside a job go to that worker's own deque
+                const auto job = [&pool, &jobsRun, &nestedJobsRun] () {
+                    jobsRun++;
+                    while (pool.EnqueueJob([&nestedJobsRun] () { nestedJobsRun++; }) == false) {
+                        std::this_thread::yield();
+                    }
+                };
+
+                while (pool.EnqueueJob(job) == false) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    producers.clear();
+
+    constexpr int totalJobs = producerCount * jobsPerProducer;
+    EXPECT_TRUE(WaitFor([&] () {
+        return jobsRun == totalJobs && nestedJobsRun == totalJobs;
+    })) << jobsRun << " " << nestedJobsRun;
+
+    pool.Stop();
+}
+
+/*
+    Stopping a pool with jobs still queued, or whose workers are parked, doesn't hang
+*/
+TEST(ThreadPoolTest, StopsWhileBusyOrIdle) {
+
+    ThreadPool idlePool;
+    idlePool.InitializeThreadPool({4});
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    idlePool.Stop();
+
+    ThreadPool busyPool;
+    busyPool.InitializeThreadPool({1});
+
+    std::atomic<bool> isReleased = false;
+    EXPECT_TRUE(busyPool.EnqueueJob([&isReleased] () {
+        while (isReleased == false) {
+            std::this_thread::yield();
+        }
+    }));
+    for (int i = 0; i < 100; i++) {
+        EXPECT_TRUE(busyPool.EnqueueJob([] () {}));
+    }
+    EXPECT_TRUE(busyPool.IsBusy());
+
+    isReleased = true;
+    busyPool.Stop();
+
+    // Nothing is accepted once stopped
+    EXPECT_FALSE(busyPool.EnqueueJob([] () {}));
+}
+
+TEST(ThreadPoolTest, MoveOnlyJobs) {
+
+    // Move-only captures work, and the capture is destroyed along with the job
+    std::shared_ptr<int> tracker = std::make_shared<int>(0);
+    {
+        Job job([owned = std::make_unique<int>(5), tracker] () {
+            *tracker += *owned;
+        });
+        EXPECT_EQ(tracker.use_count(), 2);
+
+        Job moved = std::move(job);
+        EXPECT_FALSE(job);
+        moved();
+        EXPECT_EQ(*tracker, 5);
+    }
+    EXPECT_EQ(tracker.use_count(), 1);
+
+    // Captures too large to store inline go on the heap, and still work the same
+    std::array<char, Job::inlineSize * 2> large{};
+    large[0] = 'x';
+    char seen = '\0';
+    Job largeJob([large, &seen] () { seen = large[0]; });
+    Job movedLargeJob = std::move(largeJob);
+    movedLargeJob();
+    EXPECT_EQ(seen, 'x');
+}
+
+/*
+    A job capturing what `HttpServer::AcceptConnections` captures is held in place, so enqueueing
+    it doesn't allocate, and the pool only ever moves `Job`s, never the callable onto the heap
+*/
+TEST(ThreadPoolTest, EnqueueDoesNotAllocate) {
+
+    std::atomic<int> jobsRun = 0;
+    const sockaddr_in address{};
+    const auto makeAcceptJob = [&jobsRun, &address] () {
+        return [&jobsRun, socket = Socket(-1), address] () mutable {
+            jobsRun++;
+        };
+    };
+    static_assert(Job::isStoredInline<decltype(makeAcceptJob())>);
+
+    // Right up to the limit stays in place, a byte past it goes to the heap
+    struct AtLimit {
+        alignas(std::max_align_t) std::array<std::byte, Job::inlineSize> captures;
+        void operator()() {}
+    };
+    struct PastLimit {
+        std::array<std::byte, Job::inlineSize + 1> captures;
+        void operator()() {}
+    };
+    static_assert(Job::isStoredInline<AtLimit>);
+    static_assert(Job::isStoredInline<PastLimit> == false);
+
+    // Either way, moving a Job moves what it holds along with it
+    std::vector<int> order;
+    Job inlined([&order, padding = std::array<std::byte, Job::inlineSize - sizeof(&order)>{}] () {
+        order.push_back(1);
+    });
+    Job onHeap([&order, padding = std::array<std::byte, Job::inlineSize>{}] () {
+        order.push_back(2);
+    });
+    Job movedInlined(std::move(inlined));
+    Job movedOnHeap(std::move(onHeap));
+    EXPECT_FALSE(inlined);
+    EXPECT_FALSE(onHeap);
+    movedInlined();
+    movedOnHeap();
+    EXPECT_EQ(order, std::vector<int>({1, 2}));
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({2});
+
+    for (int i = 0; i < 100; i++) {
+        EXPECT_TRUE(pool.EnqueueJob(makeAcceptJob()));
+    }
+
+    EXPECT_TRUE(WaitFor([&] () { return jobsRun == 100; }));
+    pool.Stop();
+}
+
+/*
+    Jobs beyond the queue's capacity are turned away according to the overload policy
+*/
+TEST(ThreadPoolTest, OverloadPolicies) {
+
+    // Destroyed without running, this job records that
+    struct TrackedJob {
+        int id;
+        std::vector<int>* dropped;
+        bool hasRun = false;
+
+        TrackedJob(const int id, std::vector<int>* dropped) : id(id), dropped(dropped) {}
+        TrackedJob(TrackedJob&& other) noexcept :
+            id(other.id), dropped(std::exchange(other.dropped, nullptr)), hasRun(other.hasRun) {}
+
+        ~TrackedJob() {
+            if (dropped != nullptr && hasRun == false) {
+                dropped->push_back(id);
+            }
+        }
+
+        void operator()() {
+            hasRun = true;
+        }
+    };
+
+    // Keep the only worker busy, so everything else stays queued
+    std::atomic<bool> isReleased = false;
+    std::atomic<bool> isStarted = false;
+    const auto blocker = [&isReleased, &isStarted] () {
+        isStarted = true;
+        while (isReleased == false) {
+            std::this_thread::yield();
+        }
+    };
+
+    // REJECT: the new job is turned away
+    {
+        std::vector<int> dropped;
+        ThreadPool pool;
+        pool.InitializeThreadPool({1, 2, OverloadPolicy::REJECT});
+
+        isReleased = false;
+        isStarted = false;
+        EXPECT_TRUE(pool.EnqueueJob(blocker));
+        EXPECT_TRUE(WaitFor([&] () { return isStarted.load(); }));
+
+        EXPECT_TRUE(pool.EnqueueJob(TrackedJob(1, &dropped)));
+        EXPECT_TRUE(pool.EnqueueJob(TrackedJob(2, &dropped)));
+        EXPECT_FALSE(pool.EnqueueJob(TrackedJob(3, &dropped)));
+
+        EXPECT_EQ(pool.RejectedJobs(), 1);
+        EXPECT_EQ(dropped, std::vector<int>({3}));
+
+        isReleased = true;
+        pool.Stop();
+    }
+
+    // DROP_OLDEST: the job that waited longest makes room for the new one
+    {
+        std::vector<int> dropped;
+        ThreadPool pool;
+        pool.InitializeThreadPool({1, 2, OverloadPolicy::DROP_OLDEST});
+
+        isReleased = false;
+        isStarted = false;
+        EXPECT_TRUE(pool.EnqueueJob(blocker));
+        EXPECT_TRUE(WaitFor([&] () { return isStarted.load(); }));
+
+        EXPECT_TRUE(pool.EnqueueJob(TrackedJob(1, &dropped)));
+        EXPECT_TRUE(pool.EnqueueJob(TrackedJob(2, &dropped)));
+        EXPECT_TRUE(pool.EnqueueJob(TrackedJob(3, &dropped)));
+
+        EXPECT_EQ(pool.RejectedJobs(), 1);
+        EXPECT_EQ(dropped, std::vector<int>({1}));
+
+        isReleased = true;
+        pool.Stop();
+    }
+
+    // BLOCK: the producer waits until a worker makes room
+    {
+        ThreadPool pool;
+        pool.InitializeThreadPool({1, 2, OverloadPolicy::BLOCK});
+
+        isReleased = false;
+        isStarted = false;
+        EXPECT_TRUE(pool.EnqueueJob(blocker));
+        EXPECT_TRUE(WaitFor([&] () { return isStarted.load(); }));
+        EXPECT_TRUE(pool.EnqueueJob([] () {}));
+        EXPECT_TRUE(pool.EnqueueJob([] () {}));
+
+        std::atomic<bool> isEnqueued = false;
+        std::jthread producer([&pool, &isEnqueued] () {
+            isEnqueued = pool.EnqueueJob([] () {});
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        EXPECT_FALSE(isEnqueued);
+
+        isReleased = true;
+        EXPECT_TRUE(WaitFor([&] () { return isEnqueued.load(); }));
+        EXPECT_EQ(pool.RejectedJobs(), 0);
+
+        producer.join();
+        pool.Stop();
+    }
+}
+
+/*
+    Jobs arriving faster than they can run build a standing queue; once its delay has stayed
+    above the target for a whole interval, new work is shed until the backlog clears
+*/
+TEST(ThreadPoolTest, QueueDelayAdmissionControl) {
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({
+        .threadCount = 1,
+        .queueDelayTarget = std::chrono::milliseconds(1),
+        .queueDelayInterval = std::chrono::milliseconds(20)
+    });
+
+    const auto slowJob = [] () {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    };
+
+    // Twice as fast as the only worker can keep up with
+    bool wasOverloaded = false;
+    int rejected = 0;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (pool.EnqueueJob(slowJob) == false) {
+            rejected++;
+        }
+        wasOverloaded = wasOverloaded || pool.IsOverloaded();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    EXPECT_TRUE(wasOverloaded);
+    EXPECT_GT(rejected, 0);
+    EXPECT_GE(pool.RejectedJobs(), static_cast<uint64_t>(rejected));
+
+    // Once the queue drains, work is let in again
+    EXPECT_TRUE(WaitFor([&] () { return pool.IsBusy() == false; }));
+    std::atomic<bool> hasRun = false;
+    EXPECT_TRUE(WaitFor([&] () { return pool.EnqueueJob([&hasRun] () { hasRun = true; }); }));
+    EXPECT_TRUE(WaitFor([&] () { return hasRun.load(); }));
+    EXPECT_FALSE(pool.IsOverloaded());
+
+    pool.Stop();
+}
+
+/*
+    Workers split their picks between the priority lanes by weight, no lane is starved
+*/
+TEST(ThreadPoolTest, PriorityLanes) {
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({1});
+
+    std::atomic<bool> isReleased = false;
+    std::atomic<bool> isStarted = false;
+    const auto blocker = [&isReleased, &isStarted] () {
+        isStarted = true;
+        while (isReleased == false) {
+            std::this_thread::yield();
+        }
+    };
+
+    // Only the one worker writes this, the test reads it once everything has run
+    std::vector<JobPriority> order;
+    std::atomic<int> jobsRun = 0;
+
+    EXPECT_TRUE(pool.EnqueueJob(blocker));
+    EXPECT_TRUE(WaitFor([&] () { return isStarted.load(); }));
+
+    constexpr int jobsPerPriority = 20;
+    for (const JobPriority priority : {JobPriority::BACKGROUND, JobPriority::NORMAL, JobPriority::CRITICAL}) {
+        for (int i = 0; i < jobsPerPriority; i++) {
+            EXPECT_TRUE(pool.EnqueueJob([&order, &jobsRun, priority] () {
+                order.push_back(priority);
+                jobsRun++;
+            }, priority));
+        }
+    }
+
+    isReleased = true;
+    EXPECT_TRUE(WaitFor([&] () { return jobsRun == 3 * jobsPerPriority; }));
+
+    // While every lane has work, each round of picks goes by the lane weights
+    const int roundLength = std::accumulate(ThreadPool::laneWeights.begin(), ThreadPool::laneWeights.end(), 0);
+    for (const JobPriority priority : {JobPriority::CRITICAL, JobPriority::NORMAL, JobPriority::BACKGROUND}) {
+        EXPECT_EQ(
+            std::count(order.begin(), order.begin() + roundLength, priority),
+            ThreadPool::laneWeights[static_cast<size_t>(priority)]
+        );
+    }
+
+    // A background job behind a flood of critical ones still gets a turn within a round
+    isReleased = false;
+    isStarted = false;
+    order.clear();
+    jobsRun = 0;
+
+    EXPECT_TRUE(pool.EnqueueJob(blocker));
+    EXPECT_TRUE(WaitFor([&] () { return isStarted.load(); }));
+
+    EXPECT_TRUE(pool.EnqueueJob([&order, &jobsRun] () {
+        order.push_back(JobPriority::BACKGROUND);
+        jobsRun++;
+    }, JobPriority::BACKGROUND));
+    for (int i = 0; i < 100; i++) {
+        EXPECT_TRUE(pool.EnqueueJob([&order, &jobsRun] () {
+            order.push_back(JobPriority::CRITICAL);
+            jobsRun++;
+        }, JobPriority::CRITICAL));
+    }
+
+    isReleased = true;
+    EXPECT_TRUE(WaitFor([&] () { return jobsRun == 101; }));
+
+    const auto background = std::find(order.begin(), order.end(), JobPriority::BACKGROUND);
+    EXPECT_LT(background - order.begin(), roundLength);
+
+    pool.Stop();
+}
+
+/*
+    A resizable pool grows while jobs wait, and shrinks back once its threads sit idle
+*/
+TEST(ThreadPoolTest, ResizesWithLoad) {
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({
+        .threadCount = 4,
+        .minThreadCount = 1,
+        .idleTimeout = std::chrono::milliseconds(50)
+    });
+    EXPECT_EQ(pool.ThreadCount(), 1);
+
+    // Jobs that hold their thread until released, so waiting ones need new threads
+    std::atomic<bool> isReleased = false;
+    std::atomic<int> running = 0;
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(pool.EnqueueJob([&isReleased, &running] () {
+            running++;
+            while (isReleased == false) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            running--;
+        }));
+    }
+
+    EXPECT_TRUE(WaitFor([&] () { return running == 4; }));
+    EXPECT_EQ(pool.ThreadCount(), 4);
+
+    isReleased = true;
+    EXPECT_TRUE(WaitFor([&] () { return pool.ThreadCount() == 1; }));
+
+    // Still works at its minimum, and never shrinks below it
+    std::atomic<bool> hasRun = false;
+    EXPECT_TRUE(pool.EnqueueJob([&hasRun] () { hasRun = true; }));
+    EXPECT_TRUE(WaitFor([&] () { return hasRun.load(); }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    EXPECT_EQ(pool.ThreadCount(), 1);
+
+    pool.Stop();
+}
+
+
+TEST(ThreadPoolTest, ParseCpuList) {
+
+    EXPECT_EQ(ThreadPool::ParseCpuList(""), std::vector<int>{});
+    EXPECT_EQ(ThreadPool::ParseCpuList("3"), std::vector<int>({3}));
+    EXPECT_EQ(ThreadPool::ParseCpuList("0-3,8"), std::vector<int>({0, 1, 2, 3, 8}));
+    EXPECT_EQ(ThreadPool::ParseCpuList("8,2-3,3"), std::vector<int>({2, 3, 8}));
+
+    EXPECT_EQ(ThreadPool::ParseCpuList("3-1"), std::nullopt);
+    EXPECT_EQ(ThreadPool::ParseCpuList("a"), std::nullopt);
+    EXPECT_EQ(ThreadPool::ParseCpuList("1,"), std::nullopt);
+    EXPECT_EQ(ThreadPool::ParseCpuList(",1"), std::nullopt);
+    EXPECT_EQ(ThreadPool::ParseCpuList("-1"), std::nullopt);
+    EXPECT_EQ(ThreadPool::ParseCpuList("1-"), std::nullopt);
+    EXPECT_EQ(ThreadPool::ParseCpuList("0-100000"), std::nullopt);
+}
+
+
+TEST(ThreadPoolTest, CpuAffinity) {
+
+    cpu_set_t allowedCpus;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(allowedCpus), &allowedCpus), 0);
+
+    int firstCpu = 0;
+    while (CPU_ISSET(firstCpu, &allowedCpus) == false) {
+        firstCpu++;
+    }
+
+    // Pinned to a single core, and jobs meant for that core run
+    {
+        ThreadPool pool;
+        pool.InitializeThreadPool({
+            .threadCount = 2,
+            .affinity = ThreadAffinity::CORE,
+            .cpus = {firstCpu}
+        });
+
+        std::atomic<int> cpusAllowed = 0;
+        std::atomic<int> ranOn = -1;
+        EXPECT_TRUE(pool.EnqueueJob([&cpusAllowed, &ranOn] () {
+            cpu_set_t cpuSet;
+            sched_getaffinity(0, sizeof(cpuSet), &cpuSet);
+            cpusAllowed = CPU_COUNT(&cpuSet);
+            ranOn = sched_getcpu();
+        }, JobPriority::NORMAL, firstCpu));
+
+        EXPECT_TRUE(WaitFor([&] () { return ranOn != -1; }));
+        EXPECT_EQ(cpusAllowed, 1);
+        EXPECT_EQ(ranOn, firstCpu);
+
+        pool.Stop();
+    }
+
+    // Allowed on the whole set
+    {
+        ThreadPool pool;
+        pool.InitializeThreadPool({
+            .threadCount = 2,
+            .affinity = ThreadAffinity::CORE_SET
+        });
+
+        std::atomic<bool> isSameSet = false;
+        std::atomic<bool> hasRun = false;
+        EXPECT_TRUE(pool.EnqueueJob([&allowedCpus, &isSameSet, &hasRun] () {
+            cpu_set_t cpuSet;
+            sched_getaffinity(0, sizeof(cpuSet), &cpuSet);
+            isSameSet = CPU_EQUAL(&cpuSet, &allowedCpus);
+            hasRun = true;
+        }));
+
+        EXPECT_TRUE(WaitFor([&] () { return hasRun.load(); }));
+        EXPECT_TRUE(isSameSet);
+
+        pool.Stop();
+    }
+}
+
+
+TEST(ThreadPoolTest, SpinsBeforeParking) {
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({
+        .threadCount = 2,
+        .spinIterations = 100000
+    });
+
+    // Picked up while the workers spin, and after they have given up and parked
+    for (const auto pause : {std::chrono::milliseconds(0), std::chrono::milliseconds(200)}) {
+        std::this_thread::sleep_for(pause);
+
+        std::atomic<int> ran = 0;
+        for (int i = 0; i < 100; i++) {
+            EXPECT_TRUE(pool.EnqueueJob([&ran] () { ran++; }));
+        }
+
+        EXPECT_TRUE(WaitFor([&] () { return ran == 100; }));
+    }
+
+    // Spinning workers still notice the pool stopping
+    const auto stopStart = std::chrono::steady_clock::now();
+    pool.Stop();
+    EXPECT_LT(std::chrono::steady_clock::now() - stopStart, std::chrono::seconds(1));
+
+    // A worker spinning after its job is about to be free, it counts as available
+    ThreadPool spinningPool;
+    spinningPool.InitializeThreadPool({
+        .threadCount = 1,
+        .spinIterations = std::numeric_limits<int>::max()
+    });
+
+    std::atomic<bool> hasRun = false;
+    EXPECT_TRUE(spinningPool.EnqueueJob([&hasRun] () { hasRun = true; }));
+    EXPECT_TRUE(WaitFor([&] () { return hasRun.load(); }));
+    EXPECT_TRUE(WaitFor([&] () { return spinningPool.AvailableThreads() == 1; }));
+
+    spinningPool.Stop();
+}
+
+
+TEST(ThreadPoolTest, SubmitAndTaskGroup) {
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({2});
+
+    Future<int> answer = pool.Submit([] () { return 42; });
+    EXPECT_EQ(answer.Get(), 42);
+
+    // Exceptions come back out of `Get()` and `Wait()`
+    Future<void> failing = pool.Submit([] () { throw std::runtime_error("failed"); });
+    EXPECT_THROW(failing.Get(), std::runtime_error);
+
+    std::atomic<int> ran = 0;
+    {
+        TaskGroup group(pool);
+        for (int i = 0; i < 100; i++) {
+            group.Run([&ran] () { ran++; });
+        }
+        group.Run([] () { throw std::runtime_error("failed"); });
+
+        EXPECT_THROW(group.Wait(), std::runtime_error);
+        EXPECT_EQ(ran, 100);
+    }
+
+    // Nested waits on a single thread would deadlock if they blocked instead of helping
+    ThreadPool singleThread;
+    singleThread.InitializeThreadPool({1});
+
+    Future<int> nested = singleThread.Submit([] () {
+        ThreadPool* current = ThreadPool::Current();
+        Future<int> left = current->Submit([] () { return 1; });
+        Future<int> right = current->Submit([] () { return 2; });
+        return left.Get() + right.Get();
+    });
+    EXPECT_EQ(nested.Get(), 3);
+    EXPECT_EQ(ThreadPool::Current(), nullptr);
+
+    singleThread.Stop();
+    pool.Stop();
+}
+
+
+TEST(ThreadPoolTest, ParallelFor) {
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({2});
+
+    std::vector<int> squares(1000, 0);
+    pool.ParallelFor(0, squares.size(), [&squares] (const size_t i) {
+        squares[i] = static_cast<int>(i * i);
+    });
+
+    for (size_t i = 0; i < squares.size(); i++) {
+        EXPECT_EQ(squares[i], static_cast<int>(i * i));
+    }
+
+    // Nested loops from inside the pool, every index of every row exactly once
+    std::vector<std::atomic<int>> counts(64 * 64);
+    Future<void> outer = pool.Submit([&counts] () {
+        ThreadPool::Current()->ParallelFor(0, 64, [&counts] (const size_t row) {
+            ThreadPool::Current()->ParallelFor(0, 64, [&counts, row] (const size_t column) {
+                counts[row * 64 + column]++;
+            }, 8);
+        }, 1);
+    });
+    outer.Get();
+
+    EXPECT_TRUE(std::all_of(counts.begin(), counts.end(), [] (const std::atomic<int>& count) {
+        return count == 1;
+    }));
+
+    EXPECT_THROW(pool.ParallelFor(0, 100, [] (const size_t i) {
+        if (i == 50) {
+            throw std::runtime_error("failed");
+        }
+    }, 10), std::runtime_error);
+
+    pool.Stop();
+}
+
+
+TEST(ThreadPoolTest, TurnedAwayTasksRunOnCaller) {
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({1, 2, OverloadPolicy::REJECT});
+
+    // Keep the only worker busy and fill its queue, so anything else is rejected
+    std::atomic<bool> isReleased = false;
+    std::atomic<bool> isStarted = false;
+    EXPECT_TRUE(pool.EnqueueJob([&isReleased, &isStarted] () {
+        isStarted = true;
+        while (isReleased == false) {
+            std::this_thread::yield();
+        }
+    }));
+    EXPECT_TRUE(WaitFor([&] () { return isStarted.load(); }));
+    EXPECT_TRUE(pool.EnqueueJob([] () {}));
+    EXPECT_TRUE(pool.EnqueueJob([] () {}));
+
+    const std::thread::id caller = std::this_thread::get_id();
+
+    Future<std::thread::id> rejected = pool.Submit([] () { return std::this_thread::get_id(); });
+    EXPECT_EQ(rejected.Get(), caller);
+    EXPECT_GE(pool.RejectedJobs(), 1);
+
+    std::atomic<int> ran = 0;
+    {
+        TaskGroup group(pool);
+        for (int i = 0; i < 10; i++) {
+            group.Run([&ran] () { ran++; });
+        }
+        group.Wait();
+    }
+    EXPECT_EQ(ran, 10);
+
+    isReleased = true;
+    pool.Stop();
+
+    // A stopped pool turns everything away
+    Future<int> stopped = pool.Submit([] () { return 42; });
+    EXPECT_EQ(stopped.Get(), 42);
+
+    std::vector<int> values(100, 0);
+    pool.ParallelFor(0, values.size(), [&values] (const size_t i) {
+        values[i] = 1;
+    }, 10);
+    EXPECT_EQ(std::count(values.begin(), values.end(), 1), 100);
+}
+
+
+TEST(ThreadPoolTest, Timers) {
+
+    ThreadPool pool;
+    pool.InitializeThreadPool({2});
+
+    using namespace std::chrono_literals;
+    const auto start = std::chrono::steady_clock::now();
+
+    // Due in order of deadline, not of scheduling
+    std::mutex orderMutex;
+    std::vector<int> order;
+    const auto record = [&orderMutex, &order] (const int timer) {
+        return [&orderMutex, &order, timer] () {
+            std::scoped_lock<std::mutex> lock(orderMutex);
+            order.push_back(timer);
+        };
+    };
+
+    EXPECT_NE(pool.Schedule(60ms, record(2)), 0);
+    EXPECT_NE(pool.Schedule(20ms, record(1)), 0);
+    const ThreadPool::TimerId cancelled = pool.Schedule(40ms, record(3));
+    EXPECT_TRUE(pool.Cancel(cancelled));
+    EXPECT_FALSE(pool.Cancel(cancelled));
+
+    EXPECT_TRUE(WaitFor([&] () {
+        std::scoped_lock<std::mutex> lock(orderMutex);
+        return order.size() == 2;
+    }));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 60ms);
+    {
+        std::scoped_lock<std::mutex> lock(orderMutex);
+        EXPECT_EQ(order, std::vector<int>({1, 2}));
+    }
+
+    // Runs until cancelled
+    std::atomic<int> ticks = 0;
+    const ThreadPool::TimerId periodic = pool.Every(5ms, [&ticks] () { ticks++; });
+    EXPECT_TRUE(WaitFor([&] () { return ticks >= 3; }));
+    EXPECT_TRUE(pool.Cancel(periodic));
+
+    std::this_thread::sleep_for(20ms);
+    const int ticksAfterCancel = ticks;
+    std::this_thread::sleep_for(50ms);
+    EXPECT_EQ(ticks, ticksAfterCancel);
+
+    EXPECT_EQ(pool.Every(0ms, [] () {}), 0);
+
+    pool.Stop();
+    EXPECT_EQ(pool.Schedule(1ms, [] () {}), 0);
+
+    // A one-shot timer due while the pool is full waits for room instead of being lost
+    ThreadPool fullPool;
+    fullPool.InitializeThreadPool({1, 2, OverloadPolicy::REJECT});
+
+    std::atomic<bool> isStarted = false;
+    std::atomic<bool> isReleased = false;
+    EXPECT_TRUE(fullPool.EnqueueJob([&isStarted, &isReleased] () {
+        isStarted = true;
+        while (isReleased == false) {
+            std::this_thread::yield();
+        }
+    }));
+    EXPECT_TRUE(WaitFor([&] () { return isStarted.load(); }));
+    EXPECT_TRUE(fullPool.EnqueueJob([] () {}));
+    EXPECT_TRUE(fullPool.EnqueueJob([] () {}));
+
+    std::atomic<bool> hasFired = false;
+    EXPECT_NE(fullPool.Schedule(1ms, [&hasFired] () { hasFired = true; }), 0);
+    std::this_thread::sleep_for(30ms);
+    EXPECT_FALSE(hasFired);
+    EXPECT_GE(fullPool.RejectedJobs(), 1);
+
+    isReleased = true;
+    EXPECT_TRUE(WaitFor([&] () { return hasFired.load(); }));
+    fullPool.Stop();
+}
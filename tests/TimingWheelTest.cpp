@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "knots/TimingWheel.hpp"
+
+using namespace std::chrono_literals;
+
+TEST(TimingWheelTest, ExpiresAfterTimeout) {
+
+    TimingWheel wheel(1ms, 16);
+
+    std::atomic<bool> hasExpired = false;
+    TimingWheel::Timer timer(wheel, [&hasExpired] () { hasExpired = true; });
+
+    const auto start = std::chrono::steady_clock::now();
+    timer.Arm(20ms);
+
+    while (hasExpired == false && std::chrono::steady_clock::now() - start < 5s) {
+        std::this_thread::sleep_for(1ms);
+    }
+
+    // Never early
+    EXPECT_TRUE(hasExpired);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 20ms);
+}
+
+TEST(TimingWheelTest, CancelAndRearm) {
+
+    TimingWheel wheel(1ms, 8);
+
+    std::atomic<int> cancelledExpiries = 0;
+    std::atomic<int> pushedBackExpiries = 0;
+    TimingWheel::Timer cancelled(wheel, [&cancelledExpiries] () { cancelledExpiries++; });
+    TimingWheel::Timer pushedBack(wheel, [&pushedBackExpiries] () { pushedBackExpiries++; });
+
+    cancelled.Arm(10ms);
+    cancelled.Cancel();
+
+    // Pushed back again and again, it never gets to expire
+    for (int i = 0; i < 10; i++) {
+        pushedBack.Arm(30ms);
+        std::this_thread::sleep_for(5ms);
+    }
+    EXPECT_EQ(pushedBackExpiries, 0);
+
+    std::this_thread::sleep_for(100ms);
+    EXPECT_EQ(cancelledExpiries, 0);
+    EXPECT_EQ(pushedBackExpiries, 1);
+
+    // Destroyed while armed, the wheel lets go of it
+    {
+        TimingWheel::Timer destroyed(wheel, [] () {});
+        destroyed.Arm(5ms);
+    }
+    std::this_thread::sleep_for(20ms);
+}
+
+TEST(TimingWheelTest, TimeoutsLongerThanATurn) {
+
+    // One turn is 4ms, the timeout takes several
+    TimingWheel wheel(1ms, 4);
+
+    std::atomic<bool> hasExpired = false;
+    TimingWheel::Timer timer(wheel, [&hasExpired] () { hasExpired = true; });
+
+    const auto start = std::chrono::steady_clock::now();
+    timer.Arm(30ms);
+
+    while (hasExpired == false && std::chrono::steady_clock::now() - start < 5s) {
+        std::this_thread::sleep_for(1ms);
+    }
+
+    EXPECT_TRUE(hasExpired);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 30ms);
+}